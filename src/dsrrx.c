@@ -0,0 +1,392 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+/* dsrrx - receives the sequenced UDP stream from dsrtx (udp_format = rtp),
+ * repairs it with the parity packets if there are any, and writes the raw
+ * DSR stream back out. Frame pairs that can't be recovered are written as
+ * zeros, so everything after them stays in place. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <net/if.h>
+#include "rf.h"
+#include "fec.h"
+
+#define RX_BATCH  32
+#define RX_SIZE   9000
+
+/* Gaps longer than this many frame pairs (one second) aren't filled */
+#define RX_MAX_GAP (500 * RF_UDP_BLOCK_FRAMES)
+
+typedef struct {
+	
+	FILE *out;
+	int verbose;
+	int exit_idle;
+	int drop;
+	
+	/* Next frame pair due in the output */
+	int started;
+	uint64_t pos;
+	
+	uint64_t frames;
+	uint64_t concealed;
+	uint64_t dropped;
+	
+	fec_dec_t fec;
+	
+} dsrrx_t;
+
+volatile int _abort = 0;
+
+static void _sigint_callback_handler(int signum)
+{
+	_abort = 1;
+}
+
+static void print_usage(void)
+{
+	printf(
+		"\n"
+		"Usage: dsrrx [options] [address:]port\n"
+		"\n"
+		"  -o, --output <file>      Write the DSR stream here (default stdout).\n"
+		"  -d, --delay <packets>    Wait this many packets for a lost one to be\n"
+		"                           recovered (default 256).\n"
+		"  -i, --interface <name>   Join a multicast group on this interface.\n"
+		"  -e, --exit-idle          Exit once the stream stops for a second.\n"
+		"  -l, --loss <n>           Drop one packet in n at random, to test.\n"
+		"  -V, --verbose            Print statistics once a second.\n"
+		"\n"
+	);
+}
+
+/* Join the group if the address is a multicast one */
+static int _join(int sock, const struct sockaddr *addr, const char *iface)
+{
+	unsigned int ifindex = iface ? if_nametoindex(iface) : 0;
+	
+	if(addr->sa_family == AF_INET && IN_MULTICAST(ntohl(((const struct sockaddr_in *) addr)->sin_addr.s_addr)))
+	{
+		struct ip_mreqn mreq;
+		
+		memset(&mreq, 0, sizeof(mreq));
+		mreq.imr_multiaddr = ((const struct sockaddr_in *) addr)->sin_addr;
+		mreq.imr_ifindex = ifindex;
+		if(iface && !ifindex) inet_pton(AF_INET, iface, &mreq.imr_address);
+		
+		return(setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)));
+	}
+	
+	if(addr->sa_family == AF_INET6 && IN6_IS_ADDR_MULTICAST(&((const struct sockaddr_in6 *) addr)->sin6_addr))
+	{
+		struct ipv6_mreq mreq;
+		
+		mreq.ipv6mr_multiaddr = ((const struct sockaddr_in6 *) addr)->sin6_addr;
+		mreq.ipv6mr_interface = ifindex;
+		
+		return(setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)));
+	}
+	
+	return(0);
+}
+
+static int _open(const char *target, const char *iface)
+{
+	struct addrinfo hints, *res, *rp;
+	char host[256] = "";
+	const char *port = target;
+	const char *colon = strrchr(target, ':');
+	int sock = -1;
+	int rcvbuf = 8 << 20;
+	int reuse = 1;
+	
+	if(colon)
+	{
+		snprintf(host, sizeof(host), "%.*s", (int) (colon - target), target);
+		port = colon + 1;
+	}
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+	
+	if(getaddrinfo(host[0] ? host : NULL, port, &hints, &res) != 0)
+	{
+		fprintf(stderr, "Invalid address '%s'\n", target);
+		return(-1);
+	}
+	
+	for(rp = res; rp; rp = rp->ai_next)
+	{
+		sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+		if(sock < 0) continue;
+		
+		/* Several receivers on one host may share a multicast group */
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		
+		if(bind(sock, rp->ai_addr, rp->ai_addrlen) == 0 &&
+		   _join(sock, rp->ai_addr, iface) == 0) break;
+		
+		close(sock);
+		sock = -1;
+	}
+	
+	freeaddrinfo(res);
+	
+	if(sock < 0)
+	{
+		perror(target);
+		return(-1);
+	}
+	
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	
+	return(sock);
+}
+
+/* Write a packet's frame pairs at their place in the stream */
+static void _write_packet(dsrrx_t *s, const uint8_t *pkt, size_t len)
+{
+	static const uint8_t zero[RF_UDP_FRAME_BYTES];
+	uint64_t frame;
+	int count;
+	
+	frame = (uint64_t) ((uint32_t) pkt[12] << 24 | pkt[13] << 16 | pkt[14] << 8 | pkt[15]) * RF_UDP_BLOCK_FRAMES;
+	frame += pkt[16] << 8 | pkt[17];
+	count = pkt[18] << 8 | pkt[19];
+	
+	if(len < RF_UDP_RTP_HEADER + (size_t) count * RF_UDP_FRAME_BYTES)
+	{
+		return;
+	}
+	
+	if(!s->started || frame > s->pos + RX_MAX_GAP)
+	{
+		/* Start, or start again after a long gap */
+		s->started = 1;
+		s->pos = frame;
+	}
+	
+	if(frame < s->pos)
+	{
+		return;
+	}
+	
+	for(; s->pos < frame; s->pos++)
+	{
+		fwrite(zero, RF_UDP_FRAME_BYTES, 1, s->out);
+		s->concealed++;
+	}
+	
+	fwrite(pkt + RF_UDP_RTP_HEADER, RF_UDP_FRAME_BYTES, count, s->out);
+	s->pos += count;
+	s->frames += count;
+}
+
+static void _drain(dsrrx_t *s)
+{
+	const uint8_t *pkt;
+	size_t len;
+	int r;
+	
+	while((r = fec_dec_pop(&s->fec, &pkt, &len)) != 0)
+	{
+		if(r > 0) _write_packet(s, pkt, len);
+	}
+}
+
+static void _stats(dsrrx_t *s)
+{
+	fprintf(stderr, "Received %llu, recovered %llu, lost %llu packets (%llu parity, %llu dropped), %llu frame pairs concealed\n",
+		(unsigned long long) s->fec.received,
+		(unsigned long long) s->fec.recovered,
+		(unsigned long long) s->fec.lost,
+		(unsigned long long) s->fec.parity,
+		(unsigned long long) s->dropped,
+		(unsigned long long) s->concealed
+	);
+}
+
+int main(int argc, char *argv[])
+{
+	dsrrx_t s;
+	const char *output = "-";
+	const char *iface = NULL;
+	uint8_t *buf;
+	struct mmsghdr msgs[RX_BATCH];
+	struct iovec iov[RX_BATCH];
+	struct pollfd pfd;
+	time_t last;
+	int c, i, n, sock, option_index;
+	int delay = 256;
+	const struct option long_options[] = {
+		{ "output",    required_argument, 0, 'o' },
+		{ "delay",     required_argument, 0, 'd' },
+		{ "interface", required_argument, 0, 'i' },
+		{ "exit-idle", no_argument,       0, 'e' },
+		{ "loss",      required_argument, 0, 'l' },
+		{ "verbose",   no_argument,       0, 'V' },
+		{ 0, 0, 0, 0 }
+	};
+	
+	memset(&s, 0, sizeof(dsrrx_t));
+	
+	opterr = 0;
+	while((c = getopt_long(argc, argv, "o:d:i:el:V", long_options, &option_index)) != -1)
+	{
+		switch(c)
+		{
+		case 'o': /* -o, --output <file> */
+			output = optarg;
+			break;
+		
+		case 'd': /* -d, --delay <packets> */
+			delay = atoi(optarg);
+			break;
+		
+		case 'i': /* -i, --interface <name> */
+			iface = optarg;
+			break;
+		
+		case 'e': /* -e, --exit-idle */
+			s.exit_idle = 1;
+			break;
+		
+		case 'l': /* -l, --loss <n> */
+			s.drop = atoi(optarg);
+			break;
+		
+		case 'V': /* -V, --verbose */
+			s.verbose = 1;
+			break;
+		
+		case '?':
+			print_usage();
+			return(0);
+		}
+	}
+	
+	if(optind >= argc)
+	{
+		print_usage();
+		return(-1);
+	}
+	
+	sock = _open(argv[optind], iface);
+	if(sock < 0)
+	{
+		return(-1);
+	}
+	
+	s.out = strcmp(output, "-") == 0 ? stdout : fopen(output, "wb");
+	if(!s.out)
+	{
+		perror(output);
+		return(-1);
+	}
+	
+	buf = malloc(RX_SIZE * RX_BATCH);
+	if(delay < FEC_MAX_MATRIX)
+	{
+		fprintf(stderr, "Warning: A delay under %d packets can give up before the column parity of a large matrix arrives\n", FEC_MAX_MATRIX);
+	}
+	
+	if(!buf || fec_dec_init(&s.fec, RX_SIZE, delay) != 0)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return(-1);
+	}
+	
+	for(i = 0; i < RX_BATCH; i++)
+	{
+		iov[i].iov_base = buf + RX_SIZE * i;
+		iov[i].iov_len = RX_SIZE;
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	
+	signal(SIGINT, &_sigint_callback_handler);
+	signal(SIGTERM, &_sigint_callback_handler);
+	
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	last = time(NULL);
+	
+	while(!_abort)
+	{
+		if(poll(&pfd, 1, 1000) <= 0)
+		{
+			/* The stream has stopped, give up on anything missing */
+			if(s.fec.started)
+			{
+				fec_dec_flush(&s.fec);
+				_drain(&s);
+				s.fec.delay = delay;
+				fflush(s.out);
+				if(s.exit_idle) break;
+			}
+			continue;
+		}
+		
+		n = recvmmsg(sock, msgs, RX_BATCH, MSG_DONTWAIT, NULL);
+		
+		for(i = 0; i < n; i++)
+		{
+			if(s.drop > 0 && rand() % s.drop == 0)
+			{
+				s.dropped++;
+				continue;
+			}
+			
+			fec_dec_push(&s.fec, iov[i].iov_base, msgs[i].msg_len);
+		}
+		
+		_drain(&s);
+		
+		if(s.verbose && time(NULL) != last)
+		{
+			last = time(NULL);
+			_stats(&s);
+		}
+	}
+	
+	fec_dec_flush(&s.fec);
+	_drain(&s);
+	_stats(&s);
+	
+	if(s.out != stdout) fclose(s.out);
+	fec_dec_free(&s.fec);
+	free(buf);
+	close(sock);
+	
+	return(0);
+}
+
@@ -0,0 +1,220 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+/* dsrshm_cat - reads the shared memory ring written by dsrtx (type = shm)
+ * and copies each block to a file or stdout. The blocks are read in place
+ * from the ring, so nothing is copied until the output. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include "shmring.h"
+
+volatile int _abort = 0;
+
+static void _sigint_callback_handler(int signum)
+{
+	_abort = 1;
+}
+
+static void print_usage(void)
+{
+	printf(
+		"\n"
+		"Usage: dsrshm_cat [options] name\n"
+		"\n"
+		"  -o, --output <file>      Write the blocks here (default stdout).\n"
+		"  -n, --blocks <n>         Stop after n blocks.\n"
+		"  -f, --frames             Keep each block's 8-byte frame header.\n"
+		"  -z, --fill               Write zeros in place of blocks the writer\n"
+		"                           dropped, so everything after stays in place.\n"
+		"  -w, --wait               Wait for the ring to be created.\n"
+		"  -V, --verbose            Print statistics once a second.\n"
+		"\n"
+	);
+}
+
+static void _stats(shmring_t *ring, uint64_t blocks, uint64_t missing)
+{
+	fprintf(stderr, "Read %llu blocks, %llu missing, %d/%u queued, the writer waited %llu times, the reader %llu\n",
+		(unsigned long long) blocks,
+		(unsigned long long) missing,
+		shmring_used(ring), ring->h->slots,
+		(unsigned long long) ring->h->writer_waits,
+		(unsigned long long) ring->h->reader_waits
+	);
+}
+
+int main(int argc, char *argv[])
+{
+	shmring_t ring;
+	const char *output = "-";
+	const uint8_t *data;
+	uint8_t *zero;
+	uint8_t h[SHMRING_FRAME];
+	FILE *out;
+	size_t len;
+	uint32_t block, next = 0;
+	uint64_t blocks = 0, missing = 0, limit = 0;
+	time_t last;
+	int c, r, option_index;
+	int frames = 0, fill = 0, wait = 0, verbose = 0, started = 0;
+	const struct option long_options[] = {
+		{ "output",  required_argument, 0, 'o' },
+		{ "blocks",  required_argument, 0, 'n' },
+		{ "frames",  no_argument,       0, 'f' },
+		{ "fill",    no_argument,       0, 'z' },
+		{ "wait",    no_argument,       0, 'w' },
+		{ "verbose", no_argument,       0, 'V' },
+		{ 0, 0, 0, 0 }
+	};
+	
+	opterr = 0;
+	while((c = getopt_long(argc, argv, "o:n:fzwV", long_options, &option_index)) != -1)
+	{
+		switch(c)
+		{
+		case 'o': /* -o, --output <file> */
+			output = optarg;
+			break;
+		
+		case 'n': /* -n, --blocks <n> */
+			limit = strtoull(optarg, NULL, 10);
+			break;
+		
+		case 'f': /* -f, --frames */
+			frames = 1;
+			break;
+		
+		case 'z': /* -z, --fill */
+			fill = 1;
+			break;
+		
+		case 'w': /* -w, --wait */
+			wait = 1;
+			break;
+		
+		case 'V': /* -V, --verbose */
+			verbose = 1;
+			break;
+		
+		case '?':
+			print_usage();
+			return(0);
+		}
+	}
+	
+	if(optind >= argc)
+	{
+		print_usage();
+		return(-1);
+	}
+	
+	signal(SIGINT, &_sigint_callback_handler);
+	signal(SIGTERM, &_sigint_callback_handler);
+	
+	/* Waiting, the ring not being there yet is no error until we give up */
+	while((r = shmring_open(&ring, argv[optind], wait)) != 0)
+	{
+		if(r < 0 || !wait) return(-1);
+		
+		if(_abort)
+		{
+			fprintf(stderr, "%s: No DSR ring\n", argv[optind]);
+			return(-1);
+		}
+		
+		usleep(100000);
+	}
+	
+	if(verbose)
+	{
+		fprintf(stderr, "%s: %u slots of up to %llu bytes, data type %d, %u Hz\n",
+			argv[optind], ring.h->slots, (unsigned long long) ring.h->frame_size,
+			ring.h->type, ring.h->sample_rate);
+	}
+	
+	out = strcmp(output, "-") == 0 ? stdout : fopen(output, "wb");
+	zero = calloc(1, ring.h->frame_size);
+	if(!out || !zero)
+	{
+		perror(output);
+		shmring_close(&ring);
+		return(-1);
+	}
+	
+	last = time(NULL);
+	
+	while(!_abort && (limit == 0 || blocks < limit))
+	{
+		r = shmring_read(&ring, &data, &len, &block, 1000);
+		if(r < 0) break;
+		
+		if(r > 0)
+		{
+			/* Gaps in the block numbers are blocks the writer dropped */
+			if(started && block != next)
+			{
+				missing += block - next;
+				
+				for(; fill && next != block; next++)
+				{
+					fwrite(zero, 1, len, out);
+				}
+			}
+			
+			if(frames)
+			{
+				memcpy(h, data - SHMRING_FRAME, SHMRING_FRAME);
+				fwrite(h, 1, SHMRING_FRAME, out);
+			}
+			
+			fwrite(data, 1, len, out);
+			shmring_release(&ring);
+			
+			started = 1;
+			next = block + 1;
+			blocks++;
+		}
+		
+		if(verbose && time(NULL) != last)
+		{
+			last = time(NULL);
+			_stats(&ring, blocks, missing);
+		}
+	}
+	
+	if(verbose) _stats(&ring, blocks, missing);
+	
+	if(out != stdout) fclose(out);
+	else fflush(out);
+	
+	free(zero);
+	shmring_close(&ring);
+	
+	return(0);
+}
+
@@ -25,24 +25,54 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <signal.h>
+#include <math.h>
+#include <time.h>
 #include "dsr.h"
 #include "conf.h"
 #include "src.h"
 #include "rf.h"
+#include "rf_convert.h"
+#include "mux.h"
+#include "loop.h"
+#include "sigmf.h"
+#include "pace.h"
+
+/* Pipeline stages timed in offline mode */
+#define STAGE_ENCODE    0
+#define STAGE_MODULATE  1
+#define STAGE_MULTIPLEX 2
+#define STAGE_OUTPUT    3
+#define STAGES          4
 
 typedef struct {
 	
-	/* DSR bitstream encoder */
-	dsr_t dsr;
+	/* DSR multiplexes, each with its own encoder and modulator */
+	mux_t mux[MUX_MAX];
+	int nmux;
 	
 	/* RF output */
-	rf_qpsk_t qpsk;
 	rf_t rf;
 	
 	const char *output_type;
 	const char *output;
 	int data_type;
 	uint64_t frequency;
+	double if_offset;
+	double headroom;
+	int modulator_threads;
+	long loop;
+	const char *loop_cache;
+	double loop_memory;
+	rf_fileio_conf_t file;
+	rf_udp_conf_t udp;
+	rf_server_conf_t server;
+	rf_shm_conf_t shm;
+	int sigmf;
+	sigmf_t meta;
+	uint64_t segment_blocks;
+	int pace;
+	double pace_late;
+	pace_t pacer;
 	unsigned int sample_rate;
 	int gain;
 	int amp;
@@ -51,6 +81,19 @@ typedef struct {
 	/* Verbose flag */
 	int verbose;
 	
+	/* Print the output level once a second */
+	int stats;
+	
+	/* Stop after this many blocks, 0 to run until interrupted */
+	long limit;
+	
+	/* Render at full speed and report the time taken by each stage */
+	int offline;
+	double start;
+	double progress;
+	double stage[STAGES];
+	long blocks;
+	
 } dsrtx_t;
 
 volatile int _abort = 0;
@@ -74,11 +117,89 @@ static void print_usage(void)
 		"Usage: dsrtx [options]\n"
 		"\n"
 		"  -c, --config <file>      Load configuration from file.\n"
-		"  -v, --verbose            Enable verbose output.\n"
+		"  -V, --verbose            Enable verbose output.\n"
+		"  -d, --duration <secs>    Stop after this many seconds of output.\n"
+		"  -b, --blocks <n>         Stop after this many 2ms blocks.\n"
+		"  -o, --offline            Render at full speed, without pacing, and\n"
+		"                           report the time taken on exit.\n"
+		"  -v, --version            Print the version and exit.\n"
 		"\n"
 	);
 }
 
+static double _now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return(ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+static void _stage(dsrtx_t *s, int stage, double *t)
+{
+	double now;
+	
+	if(!s->offline) return;
+	
+	/* Charge the time since the last stage to this one */
+	now = _now();
+	s->stage[stage] += now - *t;
+	*t = now;
+}
+
+static void _progress(dsrtx_t *s, long n)
+{
+	double now = _now();
+	
+	/* At most once a second */
+	if(now - s->progress < 1.0) return;
+	s->progress = now;
+	
+	if(s->limit > 0)
+	{
+		fprintf(stderr, "Rendered %.1f of %.1f seconds (%.0f%%), %.1fx real time\n",
+			n / 500.0, s->limit / 500.0, 100.0 * n / s->limit,
+			n / 500.0 / (now - s->start)
+		);
+	}
+	else
+	{
+		fprintf(stderr, "Rendered %.1f seconds, %.1fx real time\n",
+			n / 500.0, n / 500.0 / (now - s->start)
+		);
+	}
+}
+
+static void _report(dsrtx_t *s)
+{
+	const char *names[STAGES] = { "encode", "modulate", "multiplex", "output" };
+	double total, other;
+	int i;
+	
+	total = _now() - s->start;
+	other = total;
+	
+	fprintf(stderr, "Rendered %ld blocks (%.3f seconds) in %.3f seconds, %.2fx real time\n",
+		s->blocks, s->blocks / 500.0, total,
+		total > 0 ? s->blocks / 500.0 / total : 0
+	);
+	
+	for(i = 0; i < STAGES; i++)
+	{
+		if(s->stage[i] == 0) continue;
+		
+		fprintf(stderr, "  %-10s %8.3f s %5.1f%% %8.1f us/block\n",
+			names[i], s->stage[i], 100.0 * s->stage[i] / total,
+			s->blocks > 0 ? s->stage[i] * 1e6 / s->blocks : 0
+		);
+		
+		other -= s->stage[i];
+	}
+	
+	fprintf(stderr, "  %-10s %8.3f s %5.1f%%\n", "other", other, 100.0 * other / total);
+}
+
 static void *_open_src(conf_t conf, int i)
 {
 	src_t *src;
@@ -167,6 +288,7 @@ const int _load_config(dsrtx_t *s, const char *filename)
 {
 	conf_t conf;
 	const char *v;
+	dsr_t *dsr;
 	int i;
 	int c;
 	
@@ -197,13 +319,164 @@ const int _load_config(dsrtx_t *s, const char *filename)
 	
 	s->sample_rate = conf_int(conf, "output", -1, "sample_rate", DSR_SYMBOL_RATE * 2);
 	s->frequency = conf_double(conf, "output", -1, "frequency", 0),
+	s->if_offset = conf_double(conf, "output", -1, "if_offset", 0);
 	s->gain = conf_int(conf, "output", -1, "gain", 0);
 	s->amp = conf_int(conf, "output", -1, "amp", 0);
 	s->antenna = conf_str(conf, "output", -1, "antenna", NULL);
+	s->modulator_threads = conf_int(conf, "output", -1, "modulator_threads", 1);
+	
+	/* Loop playback: auto, off, or a period in blocks */
+	v = conf_str(conf, "output", -1, "loop", "auto");
+	if(strcmp(v, "auto") == 0)     s->loop = 0;
+	else if(strcmp(v, "off") == 0) s->loop = -1;
+	else if((s->loop = atol(v)) <= 0)
+	{
+		fprintf(stderr, "Error: Invalid loop period '%s'.\n", v);
+		free(conf);
+		return(-1);
+	}
+	
+	v = conf_str(conf, "output", -1, "loop_cache", NULL);
+	s->loop_cache = v ? strdup(v) : NULL;
+	s->loop_memory = conf_double(conf, "output", -1, "loop_memory", 1024);
+	
+	/* File writer buffering */
+	s->file.buffers = conf_int(conf, "output", -1, "buffers", 0);
+	s->file.buffer_size = conf_double(conf, "output", -1, "buffer_size", 0) * 1024 * 1024;
+	s->file.direct = conf_bool(conf, "output", -1, "direct", 0);
+	
+	v = conf_str(conf, "output", -1, "io", "thread");
+	if(strcmp(v, "thread") == 0)     s->file.backend = RF_FILEIO_THREAD;
+	else if(strcmp(v, "uring") == 0) s->file.backend = RF_FILEIO_URING;
+	else if(strcmp(v, "mmap") == 0)  s->file.backend = RF_FILEIO_MMAP;
+	else
+	{
+		fprintf(stderr, "Error: Invalid io backend '%s'.\n", v);
+		free(conf);
+		return(-1);
+	}
+	
+	s->file.preallocate = conf_double(conf, "output", -1, "preallocate", 0) * 1024 * 1024;
+	s->file.pipe_size = conf_double(conf, "output", -1, "pipe_size", 0) * 1024 * 1024;
+	s->file.splice = conf_bool(conf, "output", -1, "splice", 1);
+	
+	/* UDP output */
+	s->udp.payload = conf_int(conf, "output", -1, "udp_payload", 1400);
+	s->udp.batch = conf_int(conf, "output", -1, "udp_batch", 1);
+	s->udp.gso = conf_bool(conf, "output", -1, "udp_gso", 1);
+	s->udp.bitrate = conf_double(conf, "output", -1, "udp_bitrate", 20.48e6);
+	s->udp.txtime = conf_bool(conf, "output", -1, "udp_txtime", 0);
+	
+	v = conf_str(conf, "output", -1, "udp_format", "raw");
+	if(strcmp(v, "raw") == 0)         s->udp.rtp = 0;
+	else if(strcmp(v, "rtp") == 0)    s->udp.rtp = 1;
+	else if(strcmp(v, "ts") == 0)     s->udp.ts = 1;
+	else if(strcmp(v, "ts-rtp") == 0) s->udp.ts = 2;
+	else
+	{
+		fprintf(stderr, "Error: Invalid udp_format '%s'.\n", v);
+		free(conf);
+		return(-1);
+	}
+	
+	/* Parity matrix, L columns by D rows */
+	v = conf_str(conf, "output", -1, "udp_fec", NULL);
+	if(v && (sscanf(v, "%dx%d", &s->udp.fec_cols, &s->udp.fec_rows) != 2 || !s->udp.rtp))
+	{
+		fprintf(stderr, "Error: udp_fec must be LxD, with udp_format = rtp.\n");
+		free(conf);
+		return(-1);
+	}
+	
+	s->udp.fec_row = conf_bool(conf, "output", -1, "udp_fec_row", 0);
+	
+	/* MPEG-TS mux rate, 0 for the least that fits, and the data PID */
+	s->udp.ts_rate = conf_double(conf, "output", -1, "ts_rate", 0);
+	s->udp.ts_pid = conf_int(conf, "output", -1, "ts_pid", 256);
+	
+	/* Multicast groups */
+	v = conf_str(conf, "output", -1, "udp_interface", NULL);
+	s->udp.interface = v ? strdup(v) : NULL;
+	s->udp.ttl = conf_int(conf, "output", -1, "udp_ttl", 1);
+	s->udp.loop = conf_bool(conf, "output", -1, "udp_loop", 1);
+	
+	/* Send ring, in blocks, and what to do when it's full */
+	s->udp.queue = conf_int(conf, "output", -1, "udp_queue", 50);
+	v = conf_str(conf, "output", -1, "udp_overflow", "block");
+	if(strcmp(v, "block") == 0)     s->udp.drop = 0;
+	else if(strcmp(v, "drop") == 0) s->udp.drop = 1;
+	else
+	{
+		fprintf(stderr, "Error: Invalid udp_overflow '%s'.\n", v);
+		free(conf);
+		return(-1);
+	}
+	
+	/* Stream server, blocks a client may fall behind and what happens then */
+	s->server.queue = conf_int(conf, "output", -1, "server_queue", 250);
+	s->server.max_clients = conf_int(conf, "output", -1, "server_clients", 16);
+	v = conf_str(conf, "output", -1, "server_overflow", "close");
+	if(strcmp(v, "close") == 0)     s->server.skip = 0;
+	else if(strcmp(v, "skip") == 0) s->server.skip = 1;
+	else
+	{
+		fprintf(stderr, "Error: Invalid server_overflow '%s'.\n", v);
+		free(conf);
+		return(-1);
+	}
+	
+	/* Shared memory ring, in blocks, and what to do when it's full */
+	s->shm.slots = conf_int(conf, "output", -1, "shm_slots", 64);
+	v = conf_str(conf, "output", -1, "shm_overflow", "block");
+	if(strcmp(v, "block") == 0)     s->shm.drop = 0;
+	else if(strcmp(v, "drop") == 0) s->shm.drop = 1;
+	else
+	{
+		fprintf(stderr, "Error: Invalid shm_overflow '%s'.\n", v);
+		free(conf);
+		return(-1);
+	}
+	
+	s->sigmf = conf_bool(conf, "output", -1, "sigmf", 0);
+	
+	/* Send blocks in real time, and how far behind (ms) to give up catching
+	 * up. A server has no reader to hold it back, so it paces by default */
+	s->pace = conf_bool(conf, "output", -1, "pace", strcmp(s->output_type, "server") == 0);
+	s->pace_late = conf_double(conf, "output", -1, "pace_late", 100);
+	
+	/* Segmented file output, split by size (MiB) or time (seconds) */
+	s->segment_blocks = conf_double(conf, "output", -1, "segment_time", 0) * 500;
+	s->file.segment = conf_double(conf, "output", -1, "segment_size", 0) * 1024 * 1024;
+	s->file.keep = conf_int(conf, "output", -1, "segment_keep", 0);
+	
+	/* Load each multiplex, a single one at the centre if none are defined */
+	for(s->nmux = 0; conf_section_exists(conf, "mux", s->nmux); s->nmux++)
+	{
+		if(s->nmux == MUX_MAX)
+		{
+			fprintf(stderr, "Warning: Only %d multiplexes are supported. Ignoring the rest\n", MUX_MAX);
+			break;
+		}
+		
+		s->mux[s->nmux].offset = conf_double(conf, "mux", s->nmux, "offset", 0);
+	}
+	
+	if(s->nmux == 0) s->nmux = 1;
+	
+	/* Default headroom keeps the sum of all multiplexes within range */
+	s->headroom = conf_double(conf, "output", -1, "headroom", 20.0 * log10(s->nmux));
 	
 	/* Load configuration for each channel */
 	for(i = 0; conf_section_exists(conf, "channel", i); i++)
 	{
+		c = conf_int(conf, "channel", i, "mux", 1);
+		if(c < 1 || c > s->nmux)
+		{
+			fprintf(stderr, "Warning: Invalid multiplex number %d. Skipping\n", c);
+			continue;
+		}
+		dsr = &s->mux[c - 1].dsr;
+		
 		c = conf_int(conf, "channel", i, "channel", 0);
 		if(c < 1 || c > 16)
 		{
@@ -218,24 +491,24 @@ const int _load_config(dsrtx_t *s, const char *filename)
 		if(strcasecmp(v, "s") == 0)
 		{
 			/* Stereo channel. Test if both L/R channels are free */
-			if(s->dsr.channels[c + 0].mode != 0 ||
-			   s->dsr.channels[c + 1].mode != 0)
+			if(dsr->channels[c + 0].mode != 0 ||
+			   dsr->channels[c + 1].mode != 0)
 			{
 				fprintf(stderr, "Warning: Channel %02d/S is already allocated. Skipping\n", (c >> 1) + 1);
 				continue;
 			}
 			
 			/* Set the L channel parameters */
-			dsr_encode_ps(s->dsr.channels[c].name, conf_str(conf, "channel", i, "name", ""));
-			s->dsr.channels[c].type = conf_int(conf, "channel", i, "program_type", 0);
-			s->dsr.channels[c].music = conf_bool(conf, "channel", i, "music", 0) ? 1 : 0;
-			s->dsr.channels[c].mode = 1;
+			dsr_encode_ps(dsr->channels[c].name, conf_str(conf, "channel", i, "name", ""));
+			dsr->channels[c].type = conf_int(conf, "channel", i, "program_type", 0);
+			dsr->channels[c].music = conf_bool(conf, "channel", i, "music", 0) ? 1 : 0;
+			dsr->channels[c].mode = 1;
 			
 			/* Set the R channel parameters */
-			dsr_encode_ps(s->dsr.channels[c + 1].name, conf_str(conf, "channel", i, "name", ""));
-			s->dsr.channels[c + 1].type = conf_int(conf, "channel", i, "secondary_type", conf_int(conf, "channel", i, "program_type", 0));
-			s->dsr.channels[c + 1].music = 0;
-			s->dsr.channels[c + 1].mode = 2;
+			dsr_encode_ps(dsr->channels[c + 1].name, conf_str(conf, "channel", i, "name", ""));
+			dsr->channels[c + 1].type = conf_int(conf, "channel", i, "secondary_type", conf_int(conf, "channel", i, "program_type", 0));
+			dsr->channels[c + 1].music = 0;
+			dsr->channels[c + 1].mode = 2;
 		}
 		else if(strcasecmp(v, "a") == 0 ||
 		        strcasecmp(v, "b") == 0)
@@ -244,17 +517,17 @@ const int _load_config(dsrtx_t *s, const char *filename)
 			if(*v == 'b' || *v == 'B') c++;
 			
 			/* Test if this channel is free */
-			if(s->dsr.channels[c].mode != 0)
+			if(dsr->channels[c].mode != 0)
 			{
 				fprintf(stderr, "Warning: Channel %02d/%c is already allocated. Skipping\n", (c >> 1) + 1, c & 1 ? 'B' : 'A');
 				continue;
 			}
 			
 			/* Set the channel parameters */
-			dsr_encode_ps(s->dsr.channels[c].name, conf_str(conf, "channel", i, "name", ""));
-			s->dsr.channels[c].type = conf_int(conf, "channel", i, "program_type", 0);
-			s->dsr.channels[c].music = conf_bool(conf, "channel", i, "music", 0) ? 1 : 0;
-			s->dsr.channels[c].mode = 1;
+			dsr_encode_ps(dsr->channels[c].name, conf_str(conf, "channel", i, "name", ""));
+			dsr->channels[c].type = conf_int(conf, "channel", i, "program_type", 0);
+			dsr->channels[c].music = conf_bool(conf, "channel", i, "music", 0) ? 1 : 0;
+			dsr->channels[c].mode = 1;
 		}
 		else
 		{
@@ -263,59 +536,414 @@ const int _load_config(dsrtx_t *s, const char *filename)
 		}
 		
 		/* Open the audio source */
-		s->dsr.channels[c].arg = _open_src(conf, i);
+		dsr->channels[c].arg = _open_src(conf, i);
 	}
 	
 	s->verbose = conf_bool(conf, NULL, -1, "verbose", s->verbose);
+	s->stats = conf_bool(conf, NULL, -1, "stats", 0);
 	
 	free(conf);
 	
 	return(0);
 }
 
+static void _print_stats(dsrtx_t *s, rf_level_t *level)
+{
+	double peak, rms;
+	
+	if(s->stats && level->samples > 0)
+	{
+		/* Relative to int16 full scale, which is also full scale
+		 * for the 8-bit formats after conversion */
+		peak = 20.0 * log10((double) level->peak / INT16_MAX + 1e-12);
+		rms = 10.0 * log10((double) level->power / level->samples / 2 / INT16_MAX / INT16_MAX + 1e-24);
+		
+		fprintf(stderr, "Level: peak %.1f dBFS, rms %.1f dBFS, clips %llu, wraps %llu\n",
+			peak, rms,
+			(unsigned long long) level->clips,
+			(unsigned long long) level->wraps
+		);
+	}
+	
+	if(s->stats)
+	{
+		rf_stats(&s->rf, stderr);
+	}
+	
+	if(s->stats && s->pace)
+	{
+		pace_stats(&s->pacer, stderr);
+	}
+	
+	memset(level, 0, sizeof(rf_level_t));
+}
+
+static long _loop_setup(dsrtx_t *s, loop_t *loop, loop_t *enc, int unmod, int *raw)
+{
+	const size_t iq_len = sizeof(int16_t) * 2 * (MUX_BLOCK_BITS / 2) * s->mux[0].qpsk.interpolation;
+	const size_t limit = s->loop_memory * 1024 * 1024;
+	long period;
+	size_t len;
+	uint32_t phase;
+	int i, periods;
+	
+	*raw = 0;
+	
+	if(s->loop < 0)
+	{
+		return(0);
+	}
+	
+	/* Use the configured period, or find one from the sources */
+	period = s->loop;
+	if(period == 0)
+	{
+		period = loop_period(s->mux, s->nmux, limit / MUX_BLOCK_BYTES);
+		if(period == 0) return(0);
+	}
+	
+	/* Keep the output itself if it fits, and the NCO phase
+	 * comes back round after one period */
+	len = unmod ? MUX_BLOCK_BYTES : iq_len;
+	
+	for(i = 0; !unmod && i < s->nmux; i++)
+	{
+		if(!s->mux[i].qpsk.nco) continue;
+		
+		phase = s->mux[i].nco.delta * (uint32_t) (MUX_BLOCK_BITS / 2 * s->mux[i].qpsk.interpolation);
+		phase *= (uint32_t) period;
+		
+		if(phase != 0) len = 0;
+	}
+	
+	/* Room for the periods the modulators may take to come back round */
+	periods = 1;
+	if(!unmod && len > 0)
+	{
+		periods = limit / len / period;
+		if(periods > LOOP_PERIODS) periods = LOOP_PERIODS;
+	}
+	
+	if(len == 0 || periods == 0 || period * len > limit)
+	{
+		/* Otherwise keep the encoded blocks and modulate those */
+		if(s->nmux > 1 || period * MUX_BLOCK_BYTES > limit)
+		{
+			if(s->verbose)
+			{
+				fprintf(stderr, "Loop of %ld blocks is too large to cache\n", period);
+			}
+			
+			return(0);
+		}
+		
+		len = MUX_BLOCK_BYTES;
+		periods = 1;
+		*raw = 1;
+	}
+	
+	if(loop_open(loop, period, periods, len, s->loop_cache) != 0)
+	{
+		return(0);
+	}
+	
+	/* A single multiplex keeps the encoded blocks too, to fall
+	 * back on if the modulator doesn't come back round in time */
+	if(!unmod && !*raw && s->nmux == 1)
+	{
+		loop_open(enc, period, 1, MUX_BLOCK_BYTES, NULL);
+	}
+	
+	if(s->verbose)
+	{
+		fprintf(stderr, "Loop: %ld blocks (%.3f seconds), caching %s, up to %.1f MiB\n",
+			period, period / 500.0,
+			*raw ? "the encoded stream" : "the output",
+			(double) period * periods * len / 1024 / 1024
+		);
+	}
+	
+	return(period);
+}
+
+static void _loop_check(dsrtx_t *s, loop_t *loop, loop_t *enc, int *raw, long n)
+{
+	rf_qpsk_state_t state[MUX_MAX];
+	int i;
+	
+	/* The modulator state after block n, from the worker
+	 * threads if the multiplexes have them */
+	for(i = 0; i < s->nmux; i++)
+	{
+		if(s->nmux > 1) state[i] = s->mux[i].state[n & 1];
+		else rf_qpsk_get_state(&s->mux[i].qpsk, &state[i]);
+	}
+	
+	if(loop_state(loop, n - LOOP_WARMUP, state, s->nmux) == 0)
+	{
+		if(loop_ready(loop))
+		{
+			loop_close(enc);
+			
+			if(s->verbose)
+			{
+				fprintf(stderr, "Loop: the modulator is back round after %ld periods\n",
+					loop->blocks / loop->period);
+			}
+		}
+		return;
+	}
+	
+	/* The output doesn't repeat in the room there is, modulate
+	 * the encoded blocks instead, or give up on the loop */
+	loop_close(loop);
+	
+	if(enc->data)
+	{
+		*loop = *enc;
+		memset(enc, 0, sizeof(loop_t));
+		*raw = 1;
+	}
+	
+	if(s->verbose)
+	{
+		fprintf(stderr, "Loop: the modulator doesn't come back round, %s\n",
+			*raw ? "caching the encoded stream" : "not caching");
+	}
+}
+
+static size_t _block_bytes(dsrtx_t *s)
+{
+	/* Bytes of file output per 2ms block */
+	if(s->data_type == RF_UNMOD_UINT8 || s->data_type == RF_UNMOD_UDP)
+	{
+		return(MUX_BLOCK_BYTES);
+	}
+	
+	return((size_t) MUX_BLOCK_BITS / 2 * (s->sample_rate / DSR_SYMBOL_RATE) * rf_convert_size(s->data_type));
+}
+
+static void _segment_done(void *arg, const char *filename, uint64_t index, uint64_t bytes)
+{
+	dsrtx_t *s = arg;
+	sigmf_t meta;
+	char name[4096];
+	
+	if(!s->sigmf) return;
+	
+	/* Each segment gets its own sidecar, indexed from its first block */
+	if(sigmf_open(&meta, filename, s->data_type, s->sample_rate,
+		s->mux[0].qpsk.interpolation, (s->mux[0].qpsk.ntaps - 1) / 2,
+		s->frequency - s->if_offset, index * s->segment_blocks) == 0)
+	{
+		meta.blocks = bytes / meta.block_bytes;
+		sigmf_close(&meta);
+	}
+	
+	if(s->file.keep > 0 && index >= s->file.keep)
+	{
+		rf_fileio_segment_name(name, sizeof(name), s->output, index - s->file.keep);
+		sigmf_remove(name);
+	}
+}
+
 static int testrun(dsrtx_t *s)
 {
-	uint8_t block[5120];
-	int16_t o2[40960 * 2 * 5];
-	int l;
-	int16_t audio[64 * 32];
+	uint8_t block[MUX_BLOCK_BYTES];
+	int16_t *o2, *out;
+	const int16_t *iq[MUX_MAX];
+	rf_level_t level;
+	loop_t loop, enc;
+	double t = 0;
+	long n;
+	int i, l, unmod, raw;
+	
+	memset(&level, 0, sizeof(rf_level_t));
+	
+	/* One block of complex samples at the modulator's interpolation */
+	o2 = malloc(sizeof(int16_t) * 2 * (MUX_BLOCK_BITS / 2) * s->mux[0].qpsk.interpolation);
+	if(!o2)
+	{
+		perror("malloc");
+		return(-1);
+	}
+	
+	/* New version with raw stream and raw_udp_stream */
+	unmod = (s->data_type == RF_UNMOD_UINT8 || s->data_type == RF_UNMOD_UDP) &&
+		(strcmp(s->output_type, "file") == 0 || strcmp(s->output_type, "server") == 0 ||
+		 strcmp(s->output_type, "shm") == 0);
+	
+	memset(&loop, 0, sizeof(loop_t));
+	memset(&enc, 0, sizeof(loop_t));
+	_loop_setup(s, &loop, &enc, unmod, &raw);
+	
+	if(s->nmux > 1)
+	{
+		/* Each multiplex renders on its own thread, the results are summed here */
+		for(i = 0; i < s->nmux; i++)
+		{
+			if(mux_start(&s->mux[i]) != 0)
+			{
+				while(i--) mux_stop(&s->mux[i]);
+				loop_close(&loop);
+				loop_close(&enc);
+				free(o2);
+				return(-1);
+			}
+		}
+	}
+	
+	if(s->pace)
+	{
+		/* 500 blocks a second */
+		pace_init(&s->pacer, 500, s->pace_late / 1000);
+	}
+	
+	s->start = s->progress = _now();
 	
-	while(!_abort)
+	for(n = 0; !_abort && (s->limit == 0 || n < s->limit); n++)
 	{
-		/* Update the audio block */
-		memset(audio, 0, 64 * 32 * sizeof(int16_t));
+		if(s->pace)
+		{
+			pace_wait(&s->pacer);
+		}
+		
+		if(s->offline)
+		{
+			if(n % 500 == 0) _progress(s, n);
+			t = _now();
+		}
 		
-		for(l = 0; l < 32; l++)
+		if(loop_ready(&loop))
 		{
-			if(s->dsr.channels[l & 30].mode == 1 &&
-			   s->dsr.channels[(l & 30) + 1].mode == 2)
+			/* Replay the recorded period */
+			if(raw)
+			{
+				out = rf_reserve(&s->rf, MUX_BLOCK_BITS / 2 * s->mux[0].qpsk.interpolation);
+				l = rf_qpsk_modulate(&s->mux[0].qpsk, out ? out : o2, loop_block(&loop, n - LOOP_WARMUP), MUX_BLOCK_BITS);
+				_stage(s, STAGE_MODULATE, &t);
+				
+				if(out) rf_commit(&s->rf, l);
+				else rf_write(&s->rf, o2, l);
+				_stage(s, STAGE_OUTPUT, &t);
+				
+				if(n % 500 == 499) _print_stats(s, &s->mux[0].qpsk.level);
+			}
+			else
+			{
+				rf_write(&s->rf, loop_block(&loop, n - LOOP_WARMUP), unmod ? MUX_BLOCK_BYTES : loop.block_len / sizeof(int16_t) / 2);
+				_stage(s, STAGE_OUTPUT, &t);
+				
+				if(n % 500 == 499) _print_stats(s, &level);
+			}
+			
+			continue;
+		}
+		
+		if(s->nmux > 1)
+		{
+			for(l = i = 0; i < s->nmux; i++)
+			{
+				iq[i] = mux_wait(&s->mux[i], n);
+				l = s->mux[i].samples;
+				
+				/* The summed output is measured below, only
+				 * keep the counts from each modulator */
+				level.clips += s->mux[i].level[n & 1].clips;
+				level.wraps += s->mux[i].level[n & 1].wraps;
+			}
+			
+			out = rf_reserve(&s->rf, l);
+			rf_iq_sum(out ? out : o2, iq, s->nmux, l, &level);
+			
+			if(loop.data && n >= LOOP_WARMUP)
+			{
+				memcpy(loop_block(&loop, n - LOOP_WARMUP), out ? out : o2, loop.block_len);
+			}
+			
+			if(loop.data && n >= LOOP_WARMUP - 1)
 			{
-				src_read_stereo(s->dsr.channels[l].arg, &audio[l * 64], 1, &audio[(l + 1) * 64], 1, 64);
-				l++;
+				_loop_check(s, &loop, &enc, &raw, n);
 			}
-			else if(s->dsr.channels[l].mode == 1)
+			
+			for(i = 0; i < s->nmux; i++)
 			{
-				src_read_mono(s->dsr.channels[l].arg, &audio[l * 64], 1, 64);
+				mux_release(&s->mux[i], n);
 			}
+			
+			/* Waiting for the multiplex threads and summing their output */
+			_stage(s, STAGE_MULTIPLEX, &t);
+			
+			if(out) rf_commit(&s->rf, l);
+			else rf_write(&s->rf, o2, l);
+			_stage(s, STAGE_OUTPUT, &t);
+			
+			if(n % 500 == 499) _print_stats(s, &level);
+			
+			continue;
 		}
 		
 		/* Encode the next audio block (2ms) */
-		dsr_encode(&s->dsr, block, audio);
-
+		mux_encode(&s->mux[0], block);
 		
-		/* New version with raw stream and raw_udp_stream */		
-		if ((s->data_type == RF_UNMOD_UINT8 && strcmp(s->output_type, "file") == 0)||(s->data_type == RF_UNMOD_UDP && strcmp(s->output_type, "file") == 0)) 
+		if(loop.data && n >= LOOP_WARMUP && (raw || unmod))
+		{
+			memcpy(loop_block(&loop, n - LOOP_WARMUP), block, MUX_BLOCK_BYTES);
+		}
+		
+		if(enc.data && n >= LOOP_WARMUP)
+		{
+			memcpy(loop_block(&enc, n - LOOP_WARMUP), block, MUX_BLOCK_BYTES);
+		}
+		
+		_stage(s, STAGE_ENCODE, &t);
+		
+		if(unmod)
 		{
 			/* block = 40960 Bits = 5120 Bytes; 1:1 push out */
 			rf_write(&s->rf, (int16_t*)block, 40960/8);  /* <-- 5120 */
+			_stage(s, STAGE_OUTPUT, &t);
+			
+			if(n % 500 == 499) _print_stats(s, &level);
 		} 
 		else 
 		{
-			l = rf_qpsk_modulate(&s->qpsk, o2, block, 40960);
-			rf_write(&s->rf, o2, l);
+			/* Modulate straight into the sink if it allows */
+			out = rf_reserve(&s->rf, MUX_BLOCK_BITS / 2 * s->mux[0].qpsk.interpolation);
+			
+			l = rf_qpsk_modulate(&s->mux[0].qpsk, out ? out : o2, block, MUX_BLOCK_BITS);
+			
+			if(loop.data && n >= LOOP_WARMUP && !raw)
+			{
+				memcpy(loop_block(&loop, n - LOOP_WARMUP), out ? out : o2, loop.block_len);
+			}
+			
+			if(loop.data && n >= LOOP_WARMUP - 1 && !raw)
+			{
+				_loop_check(s, &loop, &enc, &raw, n);
+			}
+			
+			_stage(s, STAGE_MODULATE, &t);
+			
+			if(out) rf_commit(&s->rf, l);
+			else rf_write(&s->rf, o2, l);
+			_stage(s, STAGE_OUTPUT, &t);
+			
+			if(n % 500 == 499) _print_stats(s, &s->mux[0].qpsk.level);
 		}
-
-}	
+	}
+	
+	for(i = 0; s->nmux > 1 && i < s->nmux; i++)
+	{
+		mux_stop(&s->mux[i]);
+	}
+	
+	s->meta.blocks = n;
+	s->blocks = n;
+	
+	loop_close(&loop);
+	loop_close(&enc);
+	free(o2);
 	return(0);
 }
 
@@ -323,11 +951,15 @@ int main(int argc, char *argv[])
 {
 	dsrtx_t s;
 	const char *conffile = NULL;
-	int c, option_index;
+	double t;
+	int c, i, option_index;
 	const struct option long_options[] = {
 		{ "version", no_argument,       0, 'v' },
 		{ "config",  required_argument, 0, 'c' },
 		{ "verbose", no_argument,       0, 'V' },
+		{ "duration", required_argument, 0, 'd' },
+		{ "blocks",  required_argument, 0, 'b' },
+		{ "offline", no_argument,       0, 'o' },
 		{ 0, 0, 0, 0 }
 	};
 	
@@ -336,10 +968,14 @@ int main(int argc, char *argv[])
 #endif
 	
 	memset(&s, 0, sizeof(dsrtx_t));
-	dsr_init(&s.dsr);
+	
+	for(c = 0; c < MUX_MAX; c++)
+	{
+		mux_init(&s.mux[c]);
+	}
 	
 	opterr = 0;
-	while((c = getopt_long(argc, argv, "vc:V", long_options, &option_index)) != -1)
+	while((c = getopt_long(argc, argv, "vc:Vd:b:o", long_options, &option_index)) != -1)
 	{
 		switch(c)
 		{
@@ -355,6 +991,18 @@ int main(int argc, char *argv[])
 			s.verbose = 1;
 			break;
 		
+		case 'd': /* -d, --duration <seconds> */
+			s.limit = lround(atof(optarg) * 500);
+			break;
+		
+		case 'b': /* -b, --blocks <n> */
+			s.limit = atol(optarg);
+			break;
+		
+		case 'o': /* -o, --offline */
+			s.offline = 1;
+			break;
+		
 		case '?':
 			print_usage();
 			return(0);
@@ -380,35 +1028,79 @@ int main(int argc, char *argv[])
 		return(-1);
 	}
 	
-	/* Rebuild SA data */
-	dsr_update_sa(&s.dsr);
+	if(s.data_type == RF_UNMOD_UINT8 || s.data_type == RF_UNMOD_UDP)
+	{
+		if(s.nmux > 1)
+		{
+			fprintf(stderr, "Unmodulated output can only carry one multiplex.\n");
+			return(-1);
+		}
+		
+		if(s.if_offset != 0)
+		{
+			fprintf(stderr, "Warning: if_offset has no effect on unmodulated output\n");
+			s.if_offset = 0;
+		}
+	}
+	
+	for(c = 0; c < s.nmux; c++)
+	{
+		/* Each multiplex is shifted by its own offset plus the IF offset */
+		double offset = s.mux[c].offset + s.if_offset;
+		
+		if(fabs(offset) >= s.sample_rate / 2)
+		{
+			fprintf(stderr, "Offset %.0f Hz is outside the sample rate of %d.\n", offset, s.sample_rate);
+			return(-1);
+		}
+		else if(offset != 0 && fabs(offset) + DSR_SYMBOL_RATE * 0.75 > s.sample_rate / 2)
+		{
+			/* The signal occupies roughly 1.5x the symbol rate. Only
+			 * a shift is warned about, an unshifted signal always fits
+			 * as well as the sample rate allows */
+			fprintf(stderr, "Warning: Offset %.0f Hz pushes the signal past the band edge\n", offset);
+		}
+		
+		/* Rebuild SA data */
+		dsr_update_sa(&s.mux[c].dsr);
+	}
 	
 	/* Dump channel configuration */
 	if(s.verbose)
 	{
-		fprintf(stderr, "Active channels:\n");
-		
-		for(c = 0; c < 32; c++)
+		for(i = 0; i < s.nmux; i++)
 		{
-			char name[8 * 4 + 1];
-			char mode;
+			dsr_t *dsr = &s.mux[i].dsr;
 			
-			if(s.dsr.channels[c & 30].mode == 1 &&
-			   s.dsr.channels[(c & 30) + 1].mode == 2)
+			if(s.nmux > 1)
 			{
-				mode = c & 1 ? 'R' : 'L';
+				fprintf(stderr, "Multiplex %d (%+.0f Hz):\n", i + 1, s.mux[i].offset);
 			}
-			else if(s.dsr.channels[c].mode == 1)
+			
+			fprintf(stderr, "Active channels:\n");
+			
+			for(c = 0; c < 32; c++)
 			{
-				mode = c & 1 ? 'B' : 'A';
+				char name[8 * 4 + 1];
+				char mode;
+				
+				if(dsr->channels[c & 30].mode == 1 &&
+				   dsr->channels[(c & 30) + 1].mode == 2)
+				{
+					mode = c & 1 ? 'R' : 'L';
+				}
+				else if(dsr->channels[c].mode == 1)
+				{
+					mode = c & 1 ? 'B' : 'A';
+				}
+				else continue;
+				
+				dsr_decode_ps(name, dsr->channels[c].name);
+				fprintf(stderr, "%02d/%c: \"%s\" (Type: %d, Music: %d)\n",
+					(c >> 1) + 1, mode, name,
+					dsr->channels[c].type,
+					dsr->channels[c].music);
 			}
-			else continue;
-			
-			dsr_decode_ps(name, s.dsr.channels[c].name);
-			fprintf(stderr, "%02d/%c: \"%s\" (Type: %d, Music: %d)\n",
-				(c >> 1) + 1, mode, name,
-				s.dsr.channels[c].type,
-				s.dsr.channels[c].music);
 		}
 	}
 	
@@ -420,18 +1112,104 @@ int main(int argc, char *argv[])
 	signal(SIGTERM, &_sigint_callback_handler);
 	signal(SIGABRT, &_sigint_callback_handler);
 	
+	if(strcmp(s.output_type, "file") == 0 && (s.segment_blocks > 0 || s.file.segment > 0))
+	{
+		/* Segments hold whole blocks, so each can be read on its own */
+		size_t block = _block_bytes(&s);
+		
+		if(s.segment_blocks == 0) s.segment_blocks = s.file.segment / block;
+		if(s.segment_blocks == 0) s.segment_blocks = 1;
+		
+		/* And start on a page for O_DIRECT */
+		while(s.file.direct && (s.segment_blocks * block) % RF_FILEIO_ALIGN != 0)
+		{
+			s.segment_blocks++;
+		}
+		
+		s.file.segment = s.segment_blocks * block;
+		s.file.segment_done = _segment_done;
+		s.file.arg = &s;
+		
+		if(s.verbose)
+		{
+			fprintf(stderr, "Segments: %llu blocks (%.3f seconds), %.1f MiB\n",
+				(unsigned long long) s.segment_blocks, s.segment_blocks / 500.0,
+				s.file.segment / 1024.0 / 1024.0
+			);
+		}
+	}
+	
+	if(s.offline)
+	{
+		/* Nothing waits on the clock */
+		s.pace = 0;
+		s.udp.bitrate = 0;
+	}
+	
+	if(s.limit > 0 && s.file.backend == RF_FILEIO_MMAP && s.file.preallocate == 0 && s.file.segment == 0)
+	{
+		/* The size of the file is known up front */
+		s.file.preallocate = (uint64_t) s.limit * _block_bytes(&s);
+	}
+	
+	if(s.pace && strcmp(s.output_type, "hackrf") == 0)
+	{
+		/* The radio already takes samples at its own rate */
+		fprintf(stderr, "Warning: pace has no effect on hackrf output\n");
+		s.pace = 0;
+	}
+	
+	if(s.data_type == RF_UNMOD_UDP && s.udp.bitrate > 0)
+	{
+		/* The UDP sink paces each datagram itself, and holds the
+		 * encoder back too unless it drops blocks when it's full */
+		s.pace = s.udp.queue > 0 && s.udp.drop;
+	}
+	
+	s.udp.max_late = s.pace_late / 1000;
+	
+	/* Preview the first converted block of each output format */
+	if(s.verbose)
+	{
+		rf_debug = rf_convert_preview;
+	}
+
 	/* Start the radio */
 	if(strcmp(s.output_type, "hackrf") == 0)
 	{
-		if(rf_hackrf_open(&s.rf, s.output, s.sample_rate, s.frequency, s.gain, s.amp) != 0)
+		if(rf_hackrf_open(&s.rf, s.output, s.sample_rate, s.frequency - s.if_offset, s.gain, s.amp) != 0)
 		{
 			//vid_free(&s.vid);
 			return(-1);
 		}
 	}
+	else if(strcmp(s.output_type, "file") == 0 && s.data_type == RF_UNMOD_UDP)
+	{
+		if(rf_file_open_udp(&s.rf, s.output, &s.udp) != 0)
+		{
+			return(-1);
+		}
+	}
+	else if(strcmp(s.output_type, "server") == 0)
+	{
+		if(rf_server_open(&s.rf, s.output, s.data_type, &s.server) != 0)
+		{
+			return(-1);
+		}
+	}
+	else if(strcmp(s.output_type, "shm") == 0)
+	{
+		s.shm.frame_size = _block_bytes(&s);
+		s.shm.sample_rate = s.sample_rate;
+		
+		if(rf_shm_open(&s.rf, s.output, s.data_type, &s.shm) != 0)
+		{
+			return(-1);
+		}
+	}
 	else if(strcmp(s.output_type, "file") == 0)
 	{
-		if(rf_file_open(&s.rf, s.output, s.data_type) != 0)
+		if(rf_file_open_conf(&s.rf, s.output, s.data_type, &s.file) != 0)
 		{
 			//vid_free(&s.vid);
 			return(-1);
@@ -440,31 +1218,77 @@ int main(int argc, char *argv[])
 #ifdef HAVE_SOAPYSDR
 	else if(strcmp(s.output_type, "soapysdr") == 0)
 	{
-		if(rf_soapysdr_open(&s.rf, s.output, s.sample_rate, s.frequency, s.gain, s.antenna) != 0)
+		if(rf_soapysdr_open(&s.rf, s.output, s.sample_rate, s.frequency - s.if_offset, s.gain, s.antenna) != 0)
 		{
 			return(-1);
 		}
 	}
 #endif
 	
-	/* Initalise the modem */
-	rf_qpsk_init(&s.qpsk, s.sample_rate / DSR_SYMBOL_RATE, 0.8 * rf_scale(&s.rf));
+	/* Initalise the modem for each multiplex */
+	for(c = 0; c < s.nmux; c++)
+	{
+		mux_t *m = &s.mux[c];
+		double offset = m->offset + s.if_offset;
+		
+		rf_qpsk_init(&m->qpsk, s.sample_rate / DSR_SYMBOL_RATE, 0.8 * rf_scale(&s.rf) * pow(10, -s.headroom / 20));
+		
+		if(rf_qpsk_set_threads(&m->qpsk, s.modulator_threads) != 0)
+		{
+			fprintf(stderr, "Warning: Failed to start all modulator threads\n");
+		}
+		
+		if(offset != 0)
+		{
+			/* Shift the signal up by its offset, the tuner has been moved down by if_offset to match */
+			rf_nco_init(&m->nco, offset, s.sample_rate);
+			rf_qpsk_set_nco(&m->qpsk, &m->nco);
+		}
+	}
+	
+	memset(&s.meta, 0, sizeof(sigmf_t));
+	
+	if(s.sigmf && strcmp(s.output_type, "file") == 0 && s.data_type != RF_UNMOD_UDP && s.file.segment == 0)
+	{
+		/* The filter delays each symbol by half its length */
+		sigmf_open(&s.meta, s.output, s.data_type, s.sample_rate,
+			s.mux[0].qpsk.interpolation, (s.mux[0].qpsk.ntaps - 1) / 2,
+			s.frequency - s.if_offset, 0
+		);
+	}
+	
+	if(s.verbose && s.if_offset != 0)
+	{
+		fprintf(stderr, "IF offset: %.0f Hz\n", s.if_offset);
+	}
+	
+	if(s.verbose && s.nmux > 1)
+	{
+		fprintf(stderr, "Summing %d multiplexes with %.1f dB headroom\n", s.nmux, s.headroom);
+	}
 	
 	testrun(&s);
 	
+	t = _now();
 	rf_close(&s.rf);
+	sigmf_close(&s.meta);
 	
-	/* Close each source */
-	for(c = 0; c < 32; c++)
+	if(s.offline)
 	{
-		if(s.dsr.channels[c].arg)
-		{
-			src_close(s.dsr.channels[c].arg);
-			free(s.dsr.channels[c].arg);
-		}
+		/* Include writing out whatever was still buffered */
+		s.stage[STAGE_OUTPUT] += _now() - t;
+		_report(&s);
 	}
 	
+	/* Close each multiplex and its sources */
+	for(c = 0; c < MUX_MAX; c++)
+	{
+		mux_free(&s.mux[c]);
+	}
+	
+#ifdef HAVE_FFMPEG
 	src_ffmpeg_deinit();
+#endif
 
 	
 	return(0);
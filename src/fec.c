@@ -0,0 +1,441 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rf.h"
+#include "fec.h"
+
+static inline uint16_t _get16(const uint8_t *p)
+{
+	return(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t _get32(const uint8_t *p)
+{
+	return((uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+}
+
+static inline void _put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static inline void _put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* XOR len bytes of src into an accumulator holding used bytes so far */
+static size_t _xor(uint8_t *acc, size_t used, const uint8_t *src, size_t len)
+{
+	size_t i;
+	
+	if(len > used)
+	{
+		memset(acc + used, 0, len - used);
+		used = len;
+	}
+	
+	for(i = 0; i < len; i++)
+	{
+		acc[i] ^= src[i];
+	}
+	
+	return(used);
+}
+
+int fec_enc_init(fec_enc_t *s, int cols, int rows, int row_parity, size_t size, uint32_t ssrc)
+{
+	memset(s, 0, sizeof(fec_enc_t));
+	
+	if(cols < 1 || cols > FEC_MAX_COLS || rows < 1 || rows > FEC_MAX_ROWS ||
+	   cols * rows > FEC_MAX_MATRIX || size <= 12)
+	{
+		return(-1);
+	}
+	
+	s->cols = cols;
+	s->rows = rows;
+	s->row_parity = row_parity;
+	s->size = size - 12;
+	s->ssrc = ssrc;
+	
+	s->parity = malloc(s->size * (cols + 1));
+	s->length = calloc(cols + 1, sizeof(uint16_t));
+	s->used = calloc(cols + 1, sizeof(size_t));
+	s->base = calloc(cols + 1, sizeof(uint16_t));
+	s->timestamp = calloc(cols + 1, sizeof(uint32_t));
+	
+	if(!s->parity || !s->length || !s->used || !s->base || !s->timestamp)
+	{
+		fec_enc_free(s);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+static void _enc_acc(fec_enc_t *s, int a, const uint8_t *pkt, size_t len, int first)
+{
+	if(first)
+	{
+		s->used[a] = 0;
+		s->length[a] = 0;
+		s->base[a] = _get16(pkt + 2);
+		s->timestamp[a] = _get32(pkt + 4);
+	}
+	
+	s->used[a] = _xor(s->parity + s->size * a, s->used[a], pkt + 12, len - 12);
+	s->length[a] ^= len - 12;
+}
+
+void fec_enc_add(fec_enc_t *s, const uint8_t *pkt, size_t len)
+{
+	int r = s->index / s->cols;
+	int c = s->index % s->cols;
+	
+	if(len <= 12 || len - 12 > s->size) return;
+	
+	/* XOR straight from the packet, it is never copied */
+	_enc_acc(s, c, pkt, len, r == 0);
+	
+	if(s->row_parity)
+	{
+		_enc_acc(s, s->cols, pkt, len, c == 0);
+		if(c == s->cols - 1) s->row_ready = 1;
+	}
+	
+	if(++s->index == s->cols * s->rows)
+	{
+		s->index = 0;
+		s->cols_ready = s->cols;
+		s->col_next = 0;
+	}
+}
+
+static size_t _enc_packet(fec_enc_t *s, int a, uint8_t *out)
+{
+	int row = a == s->cols;
+	
+	out[0] = 0x80;
+	out[1] = row ? FEC_ROW_TYPE : FEC_COLUMN_TYPE;
+	_put16(out + 2, s->seq++);
+	_put32(out + 4, s->timestamp[a]);
+	_put32(out + 8, s->ssrc);
+	_put16(out + 12, s->base[a]);
+	_put16(out + 14, s->length[a]);
+	out[16] = row ? 1 : s->cols;
+	out[17] = row ? s->cols : s->rows;
+	out[18] = 0;
+	out[19] = 0;
+	memcpy(out + FEC_HEADER, s->parity + s->size * a, s->used[a]);
+	
+	return(FEC_HEADER + s->used[a]);
+}
+
+size_t fec_enc_next(fec_enc_t *s, uint8_t *out)
+{
+	if(s->row_ready)
+	{
+		s->row_ready = 0;
+		return(_enc_packet(s, s->cols, out));
+	}
+	
+	if(s->col_next < s->cols_ready)
+	{
+		return(_enc_packet(s, s->col_next++, out));
+	}
+	
+	s->cols_ready = 0;
+	
+	return(0);
+}
+
+void fec_enc_free(fec_enc_t *s)
+{
+	free(s->parity);
+	free(s->length);
+	free(s->used);
+	free(s->base);
+	free(s->timestamp);
+	memset(s, 0, sizeof(fec_enc_t));
+}
+
+int fec_dec_init(fec_dec_t *s, size_t size, int delay)
+{
+	int i;
+	
+	memset(s, 0, sizeof(fec_dec_t));
+	
+	s->size = size;
+	s->delay = delay < FEC_WINDOW / 2 ? delay : FEC_WINDOW / 2;
+	s->data = malloc(size * FEC_WINDOW);
+	s->len = calloc(FEC_WINDOW, sizeof(size_t));
+	s->seq = calloc(FEC_WINDOW, sizeof(uint16_t));
+	
+	for(i = 0; i < FEC_PARITY; i++)
+	{
+		s->par[i].data = malloc(size + 8);
+		if(!s->par[i].data) break;
+	}
+	
+	if(!s->data || !s->len || !s->seq || i < FEC_PARITY)
+	{
+		fec_dec_free(s);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+static int _dec_have(fec_dec_t *s, uint16_t seq)
+{
+	int i = seq % FEC_WINDOW;
+	
+	return(s->len[i] > 0 && s->seq[i] == seq);
+}
+
+static void _dec_store(fec_dec_t *s, uint16_t seq, const uint8_t *pkt, size_t len)
+{
+	int i = seq % FEC_WINDOW;
+	
+	memcpy(s->data + s->size * i, pkt, len);
+	s->len[i] = len;
+	s->seq[i] = seq;
+}
+
+/* Rebuild the one packet parity p is missing */
+static void _dec_rebuild(fec_dec_t *s, fec_parity_t *p, uint16_t seq)
+{
+	uint8_t *out = s->data + s->size * (seq % FEC_WINDOW);
+	size_t used = p->len;
+	uint16_t length = p->length;
+	uint16_t q;
+	int i, frame;
+	
+	if(p->len > s->size - 12) return;
+	
+	memcpy(out + 12, p->data, p->len);
+	
+	for(i = 0; i < p->count; i++)
+	{
+		q = p->base + i * p->offset;
+		if(q == seq) continue;
+		
+		const uint8_t *o = s->data + s->size * (q % FEC_WINDOW);
+		size_t olen = s->len[q % FEC_WINDOW] - 12;
+		
+		used = _xor(out + 12, used, o + 12, olen);
+		length ^= olen;
+	}
+	
+	if(length == 0 || 12 + (size_t) length > s->size || length > used) return;
+	
+	/* The DSR header gives the RTP fields back */
+	frame = _get16(out + 16);
+	out[0] = 0x80;
+	out[1] = (frame == 0 ? 0x80 : 0x00) | RF_UDP_RTP_TYPE;
+	_put16(out + 2, seq);
+	_put32(out + 4, (_get32(out + 12) * (uint32_t) RF_UDP_BLOCK_FRAMES + frame) * RF_UDP_FRAME_TICKS);
+	_put32(out + 8, p->ssrc);
+	
+	s->len[seq % FEC_WINDOW] = 12 + length;
+	s->seq[seq % FEC_WINDOW] = seq;
+	s->recovered++;
+}
+
+/* Use every parity packet that is now missing just one of its packets,
+ * until none can do any more */
+static void _dec_recover(fec_dec_t *s)
+{
+	int i, j, missing, changed;
+	uint16_t q, lost = 0;
+	
+	do
+	{
+		changed = 0;
+		
+		for(i = 0; i < s->npar; i++)
+		{
+			fec_parity_t *p = &s->par[i];
+			int done = 0;
+			
+			missing = 0;
+			for(j = 0; j < p->count; j++)
+			{
+				q = p->base + j * p->offset;
+				if(_dec_have(s, q)) continue;
+				
+				/* Already given up on, this parity is no more use */
+				if((int16_t) (q - s->next) < 0) done = 1;
+				
+				missing++;
+				lost = q;
+			}
+			
+			if(missing == 1 && !done)
+			{
+				_dec_rebuild(s, p, lost);
+				changed = 1;
+			}
+			
+			if(missing <= 1 || done)
+			{
+				/* Swap in the last one */
+				fec_parity_t t = *p;
+				*p = s->par[--s->npar];
+				s->par[s->npar] = t;
+				i--;
+			}
+		}
+	}
+	while(changed);
+}
+
+int fec_dec_push(fec_dec_t *s, const uint8_t *pkt, size_t len)
+{
+	int type;
+	uint16_t seq;
+	
+	if(len < FEC_HEADER || len > s->size + 8 || (pkt[0] & 0xC0) != 0x80)
+	{
+		return(-1);
+	}
+	
+	type = pkt[1] & 0x7F;
+	seq = _get16(pkt + 2);
+	
+	if(type == RF_UDP_RTP_TYPE)
+	{
+		if(len > s->size) return(-1);
+		
+		if(!s->started)
+		{
+			s->started = 1;
+			s->next = seq;
+			s->newest = seq;
+		}
+		
+		/* Too late, or seen already */
+		if((int16_t) (seq - s->next) < 0 || _dec_have(s, seq))
+		{
+			return(0);
+		}
+		
+		if((int16_t) (seq - s->newest) > 0) s->newest = seq;
+		
+		/* A jump too big for the window: start again from here */
+		if((uint16_t) (s->newest - s->next) >= FEC_WINDOW - s->delay)
+		{
+			s->lost += (uint16_t) (s->newest - s->next) - s->delay;
+			s->next = s->newest - s->delay;
+		}
+		
+		_dec_store(s, seq, pkt, len);
+		s->received++;
+	}
+	else if(type == FEC_COLUMN_TYPE || type == FEC_ROW_TYPE)
+	{
+		fec_parity_t *p;
+		
+		if(pkt[17] == 0 || pkt[16] == 0) return(-1);
+		
+		/* Make room by dropping the oldest */
+		if(s->npar == FEC_PARITY)
+		{
+			uint8_t *d = s->par[0].data;
+			memmove(&s->par[0], &s->par[1], sizeof(fec_parity_t) * (FEC_PARITY - 1));
+			s->par[--s->npar].data = d;
+		}
+		
+		p = &s->par[s->npar++];
+		p->base = _get16(pkt + 12);
+		p->length = _get16(pkt + 14);
+		p->offset = pkt[16];
+		p->count = pkt[17];
+		p->ssrc = _get32(pkt + 8);
+		p->len = len - FEC_HEADER;
+		memcpy(p->data, pkt + FEC_HEADER, p->len);
+		s->parity++;
+	}
+	else
+	{
+		return(-1);
+	}
+	
+	_dec_recover(s);
+	
+	return(0);
+}
+
+int fec_dec_pop(fec_dec_t *s, const uint8_t **pkt, size_t *len)
+{
+	int i = s->next % FEC_WINDOW;
+	
+	if(!s->started) return(0);
+	
+	if(_dec_have(s, s->next))
+	{
+		*pkt = s->data + s->size * i;
+		*len = s->len[i];
+		s->next++;
+		return(1);
+	}
+	
+	/* Give up once the newest packet is far enough ahead */
+	if((int16_t) (s->newest - s->next) > s->delay)
+	{
+		s->next++;
+		s->lost++;
+		_dec_recover(s);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+void fec_dec_flush(fec_dec_t *s)
+{
+	s->delay = 0;
+}
+
+void fec_dec_free(fec_dec_t *s)
+{
+	int i;
+	
+	free(s->data);
+	free(s->len);
+	free(s->seq);
+	
+	for(i = 0; i < FEC_PARITY; i++)
+	{
+		free(s->par[i].data);
+	}
+	
+	memset(s, 0, sizeof(fec_dec_t));
+}
+
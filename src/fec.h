@@ -0,0 +1,142 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+#ifndef _FEC_H
+#define _FEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Row/column XOR parity for the sequenced UDP stream, after SMPTE 2022-1.
+ * Media packets are laid out L to a row, D rows to a matrix. Each column
+ * parity packet protects D packets L apart, so a burst of up to L losses
+ * is recovered; row parity protects L packets in a row. Parity packets
+ * go to the same destination with their own payload type and sequence:
+ *
+ *   0   RTP: V=2, PT 97 (column) or 98 (row), sequence, timestamp of
+ *       the first protected packet, SSRC
+ *   12  sequence number of the first protected packet      (16 bits)
+ *   14  XOR of the protected packet lengths, less 12 bytes  (16 bits)
+ *   16  offset between protected packets, L or 1           (8 bits)
+ *   17  number of protected packets, D or L                 (8 bits)
+ *   18  reserved                                            (16 bits)
+ *   20  XOR of the protected packets from byte 12, zero padded
+ *
+ * Only the RTP header is left out of the parity. The DSR header behind
+ * it gives the receiver everything needed to rebuild one. */
+
+#define FEC_HEADER       20
+#define FEC_COLUMN_TYPE  97
+#define FEC_ROW_TYPE     98
+#define FEC_WINDOW       1024  /* Media packets a receiver keeps */
+#define FEC_PARITY       256   /* Parity packets a receiver keeps */
+
+/* Matrix limits, as SMPTE 2022-1. Column parity goes out once its whole
+ * matrix has, so a receiver must wait L x D packets for it: FEC_MAX_MATRIX
+ * keeps that well inside its delay (dsrrx waits 256) and FEC_WINDOW */
+#define FEC_MAX_COLS     20
+#define FEC_MAX_ROWS     20
+#define FEC_MAX_MATRIX   100
+
+typedef struct {
+	
+	int cols;
+	int rows;
+	int row_parity;
+	size_t size;
+	uint32_t ssrc;
+	
+	/* Accumulators, one for each column then the row. Each holds the
+	 * XOR so far, its length recovery, and the longest packet in it */
+	uint8_t *parity;
+	uint16_t *length;
+	size_t *used;
+	uint16_t *base;
+	uint32_t *timestamp;
+	
+	/* Position of the next packet in the matrix, and parity waiting */
+	int index;
+	int row_ready;
+	int cols_ready;
+	int col_next;
+	
+	uint16_t seq;
+	
+} fec_enc_t;
+
+typedef struct {
+	uint16_t base;
+	uint16_t length;
+	int offset;
+	int count;
+	uint32_t ssrc;
+	size_t len;
+	uint8_t *data;
+} fec_parity_t;
+
+typedef struct {
+	
+	/* Media packets by sequence number, kept after they're handed
+	 * out so they can still help recover a neighbour */
+	size_t size;
+	uint8_t *data;
+	size_t *len;
+	uint16_t *seq;
+	
+	fec_parity_t par[FEC_PARITY];
+	int npar;
+	
+	/* Next packet to hand out, the newest seen, and how many packets
+	 * to wait for a missing one */
+	int started;
+	uint16_t next;
+	uint16_t newest;
+	int delay;
+	
+	uint64_t received;
+	uint64_t recovered;
+	uint64_t lost;
+	uint64_t parity;
+	
+} fec_dec_t;
+
+/* Sender. size is the largest media packet. After each fec_enc_add(),
+ * call fec_enc_next() until it returns 0 to collect the parity packets
+ * that are ready, each up to size + 8 bytes long */
+extern int fec_enc_init(fec_enc_t *s, int cols, int rows, int row_parity, size_t size, uint32_t ssrc);
+extern void fec_enc_add(fec_enc_t *s, const uint8_t *pkt, size_t len);
+extern size_t fec_enc_next(fec_enc_t *s, uint8_t *out);
+extern void fec_enc_free(fec_enc_t *s);
+
+/* Receiver. fec_dec_push() takes media and parity packets in any order.
+ * fec_dec_pop() returns 1 with the next media packet in sequence, -1 if
+ * the next one is lost for good, or 0 if it is still waiting. The packet
+ * stays valid until the next push. After fec_dec_flush(), nothing waits
+ * beyond the newest packet, for the end of a stream */
+extern int fec_dec_init(fec_dec_t *s, size_t size, int delay);
+extern int fec_dec_push(fec_dec_t *s, const uint8_t *pkt, size_t len);
+extern int fec_dec_pop(fec_dec_t *s, const uint8_t **pkt, size_t *len);
+extern void fec_dec_flush(fec_dec_t *s);
+extern void fec_dec_free(fec_dec_t *s);
+
+#endif
+
@@ -0,0 +1,199 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+/* Loop playback. When every source of the output repeats, the encoded
+ * stream repeats too. One period is recorded while it is first sent,
+ * either to anonymous memory or to a mapped cache file, and replayed
+ * from then on without encoding or modulating anything. Modulated
+ * output is recorded for as many periods as the modulators take to
+ * come back to the state they started in. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "loop.h"
+#include "src.h"
+
+static long _gcd(long a, long b)
+{
+	long t;
+	
+	while(b)
+	{
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	
+	return(a);
+}
+
+static long _lcm(long a, long b, long limit)
+{
+	a = a / _gcd(a, b);
+	
+	/* Periods beyond the limit are treated as not repeating */
+	if(a > limit / b) return(0);
+	
+	return(a * b);
+}
+
+long loop_period(const mux_t *mux, int nmux, long limit)
+{
+	const src_t *src;
+	long p, b;
+	int i, c;
+	
+	/* The service information repeats every 128 blocks, which
+	 * is also a multiple of the 4 block audio delay line */
+	p = 128;
+	
+	for(i = 0; i < nmux; i++)
+	{
+		for(c = 0; c < 32; c++)
+		{
+			src = mux[i].dsr.channels[c].arg;
+			if(!src) continue;
+			
+			if(src->period <= 0)
+			{
+				return(0);
+			}
+			
+			/* Blocks until the source period lines up
+			 * with the 64 samples taken each block */
+			b = _lcm(src->period, 64, limit * 64);
+			if(b == 0) return(0);
+			
+			p = _lcm(p, b / 64, limit);
+			if(p == 0) return(0);
+		}
+	}
+	
+	return(p);
+}
+
+int loop_open(loop_t *s, long period, int periods, size_t block_len, const char *cache)
+{
+	int fd = -1;
+	
+	memset(s, 0, sizeof(loop_t));
+	
+	s->block_len = block_len;
+	s->period = period;
+	s->blocks = period * periods;
+	s->len = block_len * s->blocks;
+	
+	if(cache && *cache)
+	{
+		fd = open(cache, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0)
+		{
+			perror(cache);
+			return(-1);
+		}
+		
+		if(ftruncate(fd, s->len) != 0)
+		{
+			perror(cache);
+			close(fd);
+			return(-1);
+		}
+		
+		s->data = mmap(NULL, s->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		
+		/* The mapping keeps the file open */
+		close(fd);
+	}
+	else
+	{
+		s->data = mmap(NULL, s->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	
+	if(s->data == MAP_FAILED)
+	{
+		perror("mmap");
+		s->data = NULL;
+		return(-1);
+	}
+	
+	return(0);
+}
+
+void *loop_block(loop_t *s, long n)
+{
+	/* Returns the slot for block n of the period. Blocks are
+	 * recorded in order, the loop is ready after the last one */
+	n %= s->blocks;
+	
+	if(s->recorded <= n)
+	{
+		s->recorded = n + 1;
+	}
+	
+	return(s->data + s->block_len * n);
+}
+
+int loop_state(loop_t *s, long n, const rf_qpsk_state_t *state, int nstate)
+{
+	/* Returns -1 once the room is full and the modulator states after
+	 * block n have never matched those before block 0 (n = -1) at the
+	 * end of a period. The recording can't be replayed then */
+	if(n < 0)
+	{
+		memcpy(s->start, state, sizeof(rf_qpsk_state_t) * nstate);
+		return(0);
+	}
+	
+	if((n + 1) % s->period != 0)
+	{
+		return(0);
+	}
+	
+	if(memcmp(s->start, state, sizeof(rf_qpsk_state_t) * nstate) == 0)
+	{
+		/* Back round, the loop ends here */
+		s->blocks = n + 1;
+		return(0);
+	}
+	
+	return(n + 1 < s->blocks ? 0 : -1);
+}
+
+int loop_ready(loop_t *s)
+{
+	return(s->data && s->recorded == s->blocks);
+}
+
+void loop_close(loop_t *s)
+{
+	if(s->data)
+	{
+		munmap(s->data, s->len);
+	}
+	
+	memset(s, 0, sizeof(loop_t));
+}
+
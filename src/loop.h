@@ -0,0 +1,66 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+#ifndef _LOOP_H
+#define _LOOP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mux.h"
+
+/* Blocks rendered before recording starts, so the audio delay line and
+ * the modulator's symbol history are already in their periodic state */
+#define LOOP_WARMUP 4
+
+/* The differential modulator can turn the carrier by 90, 180 or 270
+ * degrees over a period, modulated output repeats after 4 at most */
+#define LOOP_PERIODS 4
+
+typedef struct {
+	
+	/* Cached blocks, up to the room for whole periods. blocks is cut
+	 * to the periods recorded once the modulators come back round */
+	uint8_t *data;
+	size_t block_len;
+	long blocks;
+	long period;
+	
+	/* Modulator states at the start of the recording */
+	rf_qpsk_state_t start[MUX_MAX];
+	
+	/* Blocks recorded so far */
+	long recorded;
+	
+	/* Size of the mapping */
+	size_t len;
+	
+} loop_t;
+
+extern long loop_period(const mux_t *mux, int nmux, long limit);
+extern int loop_open(loop_t *s, long period, int periods, size_t block_len, const char *cache);
+extern void *loop_block(loop_t *s, long n);
+extern int loop_state(loop_t *s, long n, const rf_qpsk_state_t *state, int nstate);
+extern int loop_ready(loop_t *s);
+extern void loop_close(loop_t *s);
+
+#endif
+
@@ -0,0 +1,208 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+/* A single DSR multiplex: its channels, encoder and modulator. When more
+ * than one multiplex shares an output each runs on its own worker thread,
+ * rendering up to two blocks ahead of the thread that sums the output. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "src.h"
+
+void mux_init(mux_t *m)
+{
+	memset(m, 0, sizeof(mux_t));
+	dsr_init(&m->dsr);
+}
+
+void mux_encode(mux_t *m, uint8_t *block)
+{
+	int16_t audio[64 * 32];
+	int l;
+	
+	/* Update the audio block */
+	memset(audio, 0, 64 * 32 * sizeof(int16_t));
+	
+	for(l = 0; l < 32; l++)
+	{
+		if(m->dsr.channels[l & 30].mode == 1 &&
+		   m->dsr.channels[(l & 30) + 1].mode == 2)
+		{
+			src_read_stereo(m->dsr.channels[l].arg, &audio[l * 64], 1, &audio[(l + 1) * 64], 1, 64);
+			l++;
+		}
+		else if(m->dsr.channels[l].mode == 1)
+		{
+			src_read_mono(m->dsr.channels[l].arg, &audio[l * 64], 1, 64);
+		}
+	}
+	
+	/* Encode the next audio block (2ms) */
+	dsr_encode(&m->dsr, block, audio);
+}
+
+int mux_render(mux_t *m, int16_t *iq)
+{
+	mux_encode(m, m->block);
+	return(rf_qpsk_modulate(&m->qpsk, iq, m->block, MUX_BLOCK_BITS));
+}
+
+static void *_mux_thread(void *arg)
+{
+	mux_t *m = arg;
+	long n;
+	int l;
+	
+	pthread_mutex_lock(&m->mutex);
+	
+	while(!m->abort)
+	{
+		if(m->done == m->requested)
+		{
+			pthread_cond_wait(&m->cond, &m->mutex);
+			continue;
+		}
+		
+		n = m->done;
+		pthread_mutex_unlock(&m->mutex);
+		
+		l = mux_render(m, m->iq[n & 1]);
+		
+		/* Hand the level of this block over with the samples,
+		 * and the modulator state it leaves behind */
+		m->level[n & 1] = m->qpsk.level;
+		memset(&m->qpsk.level, 0, sizeof(rf_level_t));
+		rf_qpsk_get_state(&m->qpsk, &m->state[n & 1]);
+		
+		pthread_mutex_lock(&m->mutex);
+		m->samples = l;
+		m->done++;
+		pthread_cond_broadcast(&m->cond);
+	}
+	
+	pthread_mutex_unlock(&m->mutex);
+	
+	return(NULL);
+}
+
+int mux_start(mux_t *m)
+{
+	size_t l;
+	int i;
+	
+	/* One block of complex samples at the modulator's interpolation */
+	l = sizeof(int16_t) * 2 * (MUX_BLOCK_BITS / 2) * m->qpsk.interpolation;
+	
+	for(i = 0; i < 2; i++)
+	{
+		m->iq[i] = malloc(l);
+		if(!m->iq[i])
+		{
+			perror("malloc");
+			return(-1);
+		}
+	}
+	
+	pthread_mutex_init(&m->mutex, NULL);
+	pthread_cond_init(&m->cond, NULL);
+	
+	/* Let the worker fill both buffers straight away */
+	m->abort = 0;
+	m->done = 0;
+	m->requested = 2;
+	
+	if(pthread_create(&m->thread, NULL, _mux_thread, m) != 0)
+	{
+		perror("pthread_create");
+		pthread_cond_destroy(&m->cond);
+		pthread_mutex_destroy(&m->mutex);
+		return(-1);
+	}
+	
+	m->running = 1;
+	
+	return(0);
+}
+
+const int16_t *mux_wait(mux_t *m, long n)
+{
+	pthread_mutex_lock(&m->mutex);
+	
+	while(m->done <= n)
+	{
+		pthread_cond_wait(&m->cond, &m->mutex);
+	}
+	
+	pthread_mutex_unlock(&m->mutex);
+	
+	return(m->iq[n & 1]);
+}
+
+void mux_release(mux_t *m, long n)
+{
+	/* Block n has been consumed, its buffer can take block n + 2 */
+	pthread_mutex_lock(&m->mutex);
+	m->requested = n + 3;
+	pthread_cond_broadcast(&m->cond);
+	pthread_mutex_unlock(&m->mutex);
+}
+
+void mux_stop(mux_t *m)
+{
+	if(!m->running) return;
+	
+	pthread_mutex_lock(&m->mutex);
+	m->abort = 1;
+	pthread_cond_broadcast(&m->cond);
+	pthread_mutex_unlock(&m->mutex);
+	
+	pthread_join(m->thread, NULL);
+	pthread_cond_destroy(&m->cond);
+	pthread_mutex_destroy(&m->mutex);
+	
+	m->running = 0;
+}
+
+void mux_free(mux_t *m)
+{
+	int c;
+	
+	mux_stop(m);
+	
+	/* Close each source */
+	for(c = 0; c < 32; c++)
+	{
+		if(m->dsr.channels[c].arg)
+		{
+			src_close(m->dsr.channels[c].arg);
+			free(m->dsr.channels[c].arg);
+			m->dsr.channels[c].arg = NULL;
+		}
+	}
+	
+	rf_qpsk_free(&m->qpsk);
+	free(m->iq[0]);
+	free(m->iq[1]);
+	m->iq[0] = m->iq[1] = NULL;
+}
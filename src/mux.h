@@ -0,0 +1,72 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+#ifndef _MUX_H
+#define _MUX_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "dsr.h"
+#include "rf.h"
+
+#define MUX_MAX 8
+
+/* Bits and bytes in one 2ms DSR block */
+#define MUX_BLOCK_BITS  40960
+#define MUX_BLOCK_BYTES (MUX_BLOCK_BITS / 8)
+
+typedef struct {
+	
+	/* DSR bitstream encoder and its channels */
+	dsr_t dsr;
+	
+	/* Modulator and frequency offset from the output centre */
+	rf_qpsk_t qpsk;
+	rf_nco_t nco;
+	double offset;
+	
+	/* Worker thread, renders blocks ahead of the output */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int running;
+	int abort;
+	long requested;
+	long done;
+	uint8_t block[MUX_BLOCK_BYTES];
+	int16_t *iq[2];
+	rf_level_t level[2];
+	rf_qpsk_state_t state[2];
+	int samples;
+	
+} mux_t;
+
+extern void mux_init(mux_t *m);
+extern void mux_encode(mux_t *m, uint8_t *block);
+extern int mux_render(mux_t *m, int16_t *iq);
+extern int mux_start(mux_t *m);
+extern const int16_t *mux_wait(mux_t *m, long n);
+extern void mux_release(mux_t *m, long n);
+extern void mux_stop(mux_t *m);
+extern void mux_free(mux_t *m);
+
+#endif
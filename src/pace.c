@@ -0,0 +1,99 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "pace.h"
+
+static uint64_t _now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+void pace_init(pace_t *s, double rate, double max_late)
+{
+	memset(s, 0, sizeof(pace_t));
+	
+	s->period = 1e9 / rate;
+	s->max_late = max_late * 1e9;
+	s->start = _now();
+}
+
+void pace_wait(pace_t *s)
+{
+	struct timespec ts;
+	uint64_t due, now, late;
+	
+	/* Each deadline is worked out from the start, never from the last one */
+	due = s->start + s->block * s->period;
+	now = _now();
+	s->block++;
+	
+	if(now < due)
+	{
+		ts.tv_sec = due / 1000000000;
+		ts.tv_nsec = due % 1000000000;
+		
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+		
+		return;
+	}
+	
+	late = now - due;
+	
+	/* A block that's due now isn't late */
+	if(late < s->period) return;
+	
+	s->late++;
+	s->late_total++;
+	if(late > s->late_max) s->late_max = late;
+	
+	if(late > s->max_late)
+	{
+		/* Too far behind to catch up, start again from now */
+		s->start += late;
+		s->resyncs++;
+		s->resyncs_total++;
+	}
+}
+
+void pace_stats(pace_t *s, FILE *f)
+{
+	fprintf(f, "Pace: %llu late blocks (worst %.1f ms), %llu resyncs, since start %llu late, %llu resyncs\n",
+		(unsigned long long) s->late,
+		s->late_max / 1e6,
+		(unsigned long long) s->resyncs,
+		(unsigned long long) s->late_total,
+		(unsigned long long) s->resyncs_total
+	);
+	
+	s->late = 0;
+	s->late_max = 0;
+	s->resyncs = 0;
+}
+
@@ -0,0 +1,64 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+#ifndef _PACE_H
+#define _PACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Real-time pacing. Block n is due at start + n * period on the
+ * CLOCK_MONOTONIC timeline, and the caller sleeps until then with an
+ * absolute deadline, so no error builds up from one block to the next.
+ * Blocks that are already due go out at once to catch up, unless the
+ * output has fallen more than max_late behind, when the timeline is
+ * moved forward instead of sending a burst. */
+
+typedef struct {
+	
+	/* Time block 0 was due, and the block period, in ns */
+	uint64_t start;
+	uint64_t period;
+	uint64_t max_late;
+	
+	/* Next block to schedule */
+	uint64_t block;
+	
+	/* Since the last report: blocks sent late, the worst of them,
+	 * and the times the timeline was moved */
+	uint64_t late;
+	uint64_t late_max;
+	uint64_t resyncs;
+	
+	/* Totals */
+	uint64_t late_total;
+	uint64_t resyncs_total;
+	
+} pace_t;
+
+extern void pace_init(pace_t *s, double rate, double max_late);
+extern void pace_wait(pace_t *s);
+extern void pace_stats(pace_t *s, FILE *f);
+
+#endif
+
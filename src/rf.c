@@ -25,8 +25,17 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "rf.h"
 
+/* NCO lookup table. Each entry holds { cos, -sin, sin, cos } in Q15 so
+ * a single multiply-add produces both rotated components of a sample */
+static int16_t _nco_table[1 << RF_NCO_BITS][4] __attribute__((aligned(16)));
+static int _nco_table_ready = 0;
+
 /* RF sink interface */
 extern double rf_scale(rf_t *s)
 {
@@ -59,6 +68,277 @@ int rf_close(rf_t *s)
 	return(0);
 }
 
+int rf_stats(rf_t *s, FILE *f)
+{
+	if(s->stats)
+	{
+		return(s->stats(s->private, f));
+	}
+	
+	return(0);
+}
+
+int16_t *rf_reserve(rf_t *s, int samples)
+{
+	/* Space for samples of int16 IQ in the sink itself, or
+	 * NULL if the caller has to use rf_write() instead */
+	if(s->reserve)
+	{
+		return(s->reserve(s->private, samples));
+	}
+	
+	return(NULL);
+}
+
+int rf_commit(rf_t *s, int samples)
+{
+	if(s->commit)
+	{
+		return(s->commit(s->private, samples));
+	}
+	
+	return(-1);
+}
+
+int rf_nco_init(rf_nco_t *s, double frequency, unsigned int sample_rate)
+{
+	double r;
+	int i;
+	
+	if(!_nco_table_ready)
+	{
+		for(i = 0; i < (1 << RF_NCO_BITS); i++)
+		{
+			r = 2.0 * M_PI * i / (1 << RF_NCO_BITS);
+			_nco_table[i][0] = lround(cos(r) * INT16_MAX);
+			_nco_table[i][1] = lround(-sin(r) * INT16_MAX);
+			_nco_table[i][2] = lround(sin(r) * INT16_MAX);
+			_nco_table[i][3] = lround(cos(r) * INT16_MAX);
+		}
+		
+		_nco_table_ready = 1;
+	}
+	
+	memset(s, 0, sizeof(rf_nco_t));
+	
+	if(sample_rate == 0 || fabs(frequency) >= sample_rate / 2.0)
+	{
+		return(-1);
+	}
+	
+	/* Negative frequencies wrap around to the top of the phase range */
+	r = frequency / sample_rate;
+	if(r < 0) r += 1.0;
+	s->delta = (uint32_t) llround(r * 4294967296.0);
+	s->phase = 0;
+	
+	return(0);
+}
+
+static inline int16_t _sat16(int32_t v)
+{
+	if(v > INT16_MAX) return(INT16_MAX);
+	if(v < INT16_MIN) return(INT16_MIN);
+	return(v);
+}
+
+/* Rotate a run of samples starting at phase, returns the phase following
+ * the last sample. Values saturated to the int16 range are counted in clips */
+static uint32_t _nco_mix(uint32_t phase, uint32_t delta, int16_t *iq_data, int samples, uint64_t *clips)
+{
+	const int shift = 32 - RF_NCO_BITS;
+	const int16_t *t;
+	int32_t v;
+	int i = 0;
+	
+#ifdef __SSE2__
+	const __m128i round = _mm_set1_epi32(1 << 14);
+	const __m128i max = _mm_set1_epi32(INT16_MAX);
+	const __m128i min = _mm_set1_epi32(INT16_MIN);
+	
+	/* Four samples per iteration. The samples are duplicated into I,Q,I,Q
+	 * pairs and multiplied against { c, -s, s, c } with pmaddwd, giving
+	 * the rotated I and Q of each sample already interleaved */
+	for(; i + 4 <= samples; i += 4, iq_data += 8)
+	{
+		__m128i x = _mm_loadu_si128((__m128i *) iq_data);
+		__m128i c01, c23, lo, hi;
+		
+		c01 = _mm_unpacklo_epi64(
+			_mm_loadl_epi64((__m128i *) _nco_table[phase >> shift]),
+			_mm_loadl_epi64((__m128i *) _nco_table[(phase + delta) >> shift])
+		);
+		phase += delta * 2;
+		
+		c23 = _mm_unpacklo_epi64(
+			_mm_loadl_epi64((__m128i *) _nco_table[phase >> shift]),
+			_mm_loadl_epi64((__m128i *) _nco_table[(phase + delta) >> shift])
+		);
+		phase += delta * 2;
+		
+		lo = _mm_madd_epi16(_mm_unpacklo_epi32(x, x), c01);
+		hi = _mm_madd_epi16(_mm_unpackhi_epi32(x, x), c23);
+		
+		lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 15);
+		hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 15);
+		
+		/* Rotation keeps the magnitude, so only values near full scale
+		 * on both axes can leave the int16 range */
+		x = _mm_packs_epi16(
+			_mm_or_si128(_mm_cmpgt_epi32(lo, max), _mm_cmplt_epi32(lo, min)),
+			_mm_or_si128(_mm_cmpgt_epi32(hi, max), _mm_cmplt_epi32(hi, min))
+		);
+		*clips += __builtin_popcount(_mm_movemask_epi8(x)) >> 1;
+		
+		_mm_storeu_si128((__m128i *) iq_data, _mm_packs_epi32(lo, hi));
+	}
+#endif
+	
+	/* Scalar tail, rounding and saturating the same way as the SIMD path */
+	for(; i < samples; i++, iq_data += 2)
+	{
+		int32_t x = iq_data[0];
+		int32_t y = iq_data[1];
+		
+		t = _nco_table[phase >> shift];
+		phase += delta;
+		
+		v = (x * t[0] + y * t[1] + (1 << 14)) >> 15;
+		*clips += (v != _sat16(v));
+		iq_data[0] = _sat16(v);
+		
+		v = (x * t[2] + y * t[3] + (1 << 14)) >> 15;
+		*clips += (v != _sat16(v));
+		iq_data[1] = _sat16(v);
+	}
+	
+	return(phase);
+}
+
+void rf_nco_mix(rf_nco_t *s, int16_t *iq_data, int samples)
+{
+	uint64_t clips = 0;
+	s->phase = _nco_mix(s->phase, s->delta, iq_data, samples, &clips);
+}
+
+void rf_level_update(rf_level_t *l, const int16_t *iq_data, int samples)
+{
+	int i = 0;
+	int peak = l->peak;
+	uint64_t power = 0;
+	int32_t v;
+	
+	l->samples += samples;
+	samples *= 2;
+	
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	__m128i vmax = _mm_setzero_si128();
+	__m128i vpow = _mm_setzero_si128();
+	uint64_t p[2];
+	int16_t m[8];
+	
+	for(; i + 8 <= samples; i += 8)
+	{
+		__m128i x = _mm_loadu_si128((__m128i *) &iq_data[i]);
+		
+		/* Peak of |x|, -32768 saturates to 32767 */
+		vmax = _mm_max_epi16(vmax, _mm_max_epi16(x, _mm_subs_epi16(zero, x)));
+		
+		/* Each pair of squares fits an unsigned 32-bit lane, widen before summing */
+		x = _mm_madd_epi16(x, x);
+		vpow = _mm_add_epi64(vpow, _mm_unpacklo_epi32(x, zero));
+		vpow = _mm_add_epi64(vpow, _mm_unpackhi_epi32(x, zero));
+	}
+	
+	_mm_storeu_si128((__m128i *) m, vmax);
+	_mm_storeu_si128((__m128i *) p, vpow);
+	power = p[0] + p[1];
+	
+	for(v = 0; v < 8; v++)
+	{
+		if(m[v] > peak) peak = m[v];
+	}
+#endif
+	
+	for(; i < samples; i++)
+	{
+		v = iq_data[i];
+		power += v * v;
+		if(v < 0) v = -v;
+		if(v > peak) peak = v;
+	}
+	
+	if(peak > INT16_MAX) peak = INT16_MAX;
+	
+	l->peak = peak;
+	l->power += power;
+}
+
+void rf_level_add(rf_level_t *dst, const rf_level_t *src)
+{
+	dst->samples += src->samples;
+	dst->power += src->power;
+	dst->clips += src->clips;
+	dst->wraps += src->wraps;
+	if(src->peak > dst->peak) dst->peak = src->peak;
+}
+
+void rf_iq_sum(int16_t *dst, const int16_t **src, int n, int samples, rf_level_t *level)
+{
+	uint64_t clips = 0;
+	int32_t v;
+	int i = 0;
+	int j;
+	
+	samples *= 2;
+	
+#ifdef __SSE2__
+	const __m128i max = _mm_set1_epi32(INT16_MAX);
+	const __m128i min = _mm_set1_epi32(INT16_MIN);
+	
+	/* Sum in 32-bit and saturate once at the end */
+	for(; i + 8 <= samples; i += 8)
+	{
+		__m128i lo = _mm_setzero_si128();
+		__m128i hi = _mm_setzero_si128();
+		__m128i x;
+		
+		for(j = 0; j < n; j++)
+		{
+			x = _mm_loadu_si128((__m128i *) &src[j][i]);
+			lo = _mm_add_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+			hi = _mm_add_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+		}
+		
+		x = _mm_packs_epi16(
+			_mm_or_si128(_mm_cmpgt_epi32(lo, max), _mm_cmplt_epi32(lo, min)),
+			_mm_or_si128(_mm_cmpgt_epi32(hi, max), _mm_cmplt_epi32(hi, min))
+		);
+		clips += __builtin_popcount(_mm_movemask_epi8(x)) >> 1;
+		
+		_mm_storeu_si128((__m128i *) &dst[i], _mm_packs_epi32(lo, hi));
+	}
+#endif
+	
+	for(; i < samples; i++)
+	{
+		for(v = j = 0; j < n; j++)
+		{
+			v += src[j][i];
+		}
+		
+		clips += (v != _sat16(v));
+		dst[i] = _sat16(v);
+	}
+	
+	if(level)
+	{
+		level->clips += clips;
+		rf_level_update(level, dst, samples / 2);
+	}
+}
+
 static double _hamming(double x)
 {
 	if(x < -1 || x > 1) return(0);
@@ -91,68 +371,406 @@ static double _rrc(double x, double b, double t)
 	return(r);
 }
 
+/* Worker pool for the modulator. Each block is split into one segment
+ * per thread, the calling thread renders the first segment itself */
+typedef struct {
+	
+	pthread_t thread;
+	struct _rf_qpsk_pool_t *pool;
+	
+	/* The segment to render */
+	int16_t *dst;
+	const uint8_t *syms;
+	int nsym;
+	uint32_t phase;
+	rf_level_t level;
+	
+} _rf_qpsk_worker_t;
+
+struct _rf_qpsk_pool_t {
+	
+	rf_qpsk_t *s;
+	
+	pthread_mutex_t mutex;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	
+	long gen;
+	int pending;
+	int abort;
+	
+	int nworkers;
+	_rf_qpsk_worker_t workers[];
+	
+};
+
+/* Symbols modulated between each pass of the NCO */
+#define RF_QPSK_MIX_CHUNK 256
+
+/* The taps of ((10 * interpolation) | 1) cover 11 symbol periods at any interpolation */
+#define RF_QPSK_SPAN 11
+
+/* Generic kernel, for any interpolation */
+static void _rf_qpsk_kernel(const rf_qpsk_t *s, int16_t *dst, const uint8_t *syms, int nsym, rf_level_t *level)
+{
+	const int n = s->interpolation * 2;
+	const int16_t *taps;
+	int k, j, p;
+	
+	/* Direct form: each output symbol period is the sum of the matching
+	 * phase of the taps of the last span symbols. syms[-1] back to
+	 * syms[-(span - 1)] hold the symbols preceding this run */
+	for(k = 0; k < nsym; k++, dst += n)
+	{
+		taps = s->taps[syms[k]];
+		for(p = 0; p < n; p++)
+		{
+			dst[p] = taps[p];
+		}
+		
+		for(j = 1; j < s->span; j++)
+		{
+			taps = s->taps[syms[k - j]] + j * n;
+			for(p = 0; p < n; p++)
+			{
+				dst[p] += taps[p];
+			}
+		}
+	}
+}
+
+/* Generic kernel summing in 32-bit, used when the level is high enough
+ * for the 16-bit sums to wrap around. The output is identical, but each
+ * wrapped value is counted */
+static void _rf_qpsk_kernel_checked(const rf_qpsk_t *s, int16_t *dst, const uint8_t *syms, int nsym, rf_level_t *level)
+{
+	const int n = s->interpolation * 2;
+	int32_t v;
+	int k, j, p;
+	
+	for(k = 0; k < nsym; k++, dst += n)
+	{
+		for(p = 0; p < n; p++)
+		{
+			for(v = j = 0; j < s->span; j++)
+			{
+				v += s->taps[syms[k - j]][j * n + p];
+			}
+			
+			level->wraps += (v != (int16_t) v);
+			dst[p] = v;
+		}
+	}
+	
+}
+
+/* Kernels specialised for one interpolation. With the output width and
+ * span fixed at compile time the tap loops unroll completely and the
+ * accumulator stays in registers */
+#define RF_QPSK_KERNEL(I) \
+static void _rf_qpsk_kernel_##I(const rf_qpsk_t *s, int16_t *dst, const uint8_t *syms, int nsym, rf_level_t *level) \
+{ \
+	const int16_t *taps; \
+	int16_t acc[(I) * 2]; \
+	int k, j, p; \
+	\
+	for(k = 0; k < nsym; k++, dst += (I) * 2) \
+	{ \
+		taps = s->taps[syms[k]]; \
+		for(p = 0; p < (I) * 2; p++) \
+		{ \
+			acc[p] = taps[p]; \
+		} \
+		\
+		_Pragma("GCC unroll 16") \
+		for(j = 1; j < RF_QPSK_SPAN; j++) \
+		{ \
+			taps = s->taps[syms[k - j]] + j * (I) * 2; \
+			for(p = 0; p < (I) * 2; p++) \
+			{ \
+				acc[p] += taps[p]; \
+			} \
+		} \
+		\
+		memcpy(dst, acc, sizeof(acc)); \
+	} \
+}
+
+RF_QPSK_KERNEL(1)
+RF_QPSK_KERNEL(2)
+RF_QPSK_KERNEL(4)
+RF_QPSK_KERNEL(8)
+
+static void _rf_qpsk_segment(const rf_qpsk_t *s, int16_t *dst, const uint8_t *syms, int nsym, uint32_t phase, rf_level_t *level)
+{
+	int i, n;
+	
+	for(i = 0; i < nsym; i += n)
+	{
+		n = nsym - i;
+		if(n > RF_QPSK_MIX_CHUNK) n = RF_QPSK_MIX_CHUNK;
+		
+		s->kernel(s, dst, syms + i, n, level);
+		
+		/* Mix and measure each chunk while it is still in the cache */
+		if(s->nco)
+		{
+			phase = _nco_mix(phase, s->nco->delta, dst, n * s->interpolation, &level->clips);
+		}
+		
+		rf_level_update(level, dst, n * s->interpolation);
+		
+		dst += n * s->interpolation * 2;
+	}
+}
+
+static void *_rf_qpsk_thread(void *arg)
+{
+	_rf_qpsk_worker_t *w = arg;
+	struct _rf_qpsk_pool_t *pool = w->pool;
+	long gen = 0;
+	
+	pthread_mutex_lock(&pool->mutex);
+	
+	while(1)
+	{
+		while(!pool->abort && pool->gen == gen)
+		{
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		}
+		
+		if(pool->abort) break;
+		
+		gen = pool->gen;
+		pthread_mutex_unlock(&pool->mutex);
+		
+		_rf_qpsk_segment(pool->s, w->dst, w->syms, w->nsym, w->phase, &w->level);
+		
+		pthread_mutex_lock(&pool->mutex);
+		if(--pool->pending == 0)
+		{
+			pthread_cond_signal(&pool->done);
+		}
+	}
+	
+	pthread_mutex_unlock(&pool->mutex);
+	
+	return(NULL);
+}
+
+static void _rf_qpsk_pool_free(struct _rf_qpsk_pool_t *pool)
+{
+	int i;
+	
+	if(!pool) return;
+	
+	pthread_mutex_lock(&pool->mutex);
+	pool->abort = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+	
+	for(i = 0; i < pool->nworkers; i++)
+	{
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+	
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
 void rf_qpsk_free(rf_qpsk_t *s)
 {
 	int i;
-	for(i = 0; i < 4; i++)
+	
+	_rf_qpsk_pool_free(s->pool);
+	s->pool = NULL;
+	
+	for(i = 0; i < 5; i++)
 	{
 		free(s->taps[i]);
+		s->taps[i] = NULL;
 	}
-	free(s->win);
+	
+	free(s->syms);
+	s->syms = NULL;
 }
 
-int rf_qpsk_init(rf_qpsk_t *s, int interpolation, double level)
+/* Generate the symbol shape at level, then pick the kernel for it */
+static void _rf_qpsk_shape(rf_qpsk_t *s, double level)
 {
 	const double sym[4][2] = { { -1, -1 }, { -1, 1 }, { 1, 1 }, { 1, -1 } };
 	int i, x, n;
-	double r, t;
+	double r, t, peak;
+	
+	for(i = 0; i < 4; i++)
+	{
+		n = s->ntaps / 2;
+		for(x = 0; x < s->ntaps; x++)
+		{
+			t = ((double) x - n) / s->interpolation;
+			r = _rrc(t, 0.5, 1.0) * _hamming(((double) x - n) / n);
+			s->taps[i][x * 2 + 0] = lround(r * sym[i][0] * M_SQRT1_2 * INT16_MAX * level);
+			s->taps[i][x * 2 + 1] = lround(r * sym[i][1] * M_SQRT1_2 * INT16_MAX * level);
+		}
+	}
+	
+	/* Find the largest value the sum of taps can reach for any sequence
+	 * of symbols. Above INT16_MAX the output can wrap around */
+	s->peak = 0;
+	for(x = 0; x < s->interpolation * 2; x++)
+	{
+		for(r = i = 0; i < s->span; i++)
+		{
+			for(t = n = 0; n < 4; n++)
+			{
+				if(abs(s->taps[n][i * s->interpolation * 2 + x]) > t)
+				{
+					t = abs(s->taps[n][i * s->interpolation * 2 + x]);
+				}
+			}
+			
+			r += t;
+		}
+		
+		if(r > s->peak) s->peak = r;
+	}
+	
+	/* An NCO can turn the whole I/Q vector onto one axis, up to
+	 * sqrt(2) of the largest I or Q value */
+	peak = s->nco ? s->peak * M_SQRT2 : s->peak;
+	
+	if(peak > INT16_MAX)
+	{
+		fprintf(stderr, "Warning: Modulator level %.2f can exceed full scale by %.1f dB\n",
+			s->amplitude, 20.0 * log10(peak / INT16_MAX));
+	}
+	
+	/* Select a kernel, falling back to the generic one */
+	s->kernel = _rf_qpsk_kernel;
+	
+	if(s->peak > INT16_MAX)
+	{
+		/* Wrapping is possible, count it at the cost of a slower kernel */
+		s->kernel = _rf_qpsk_kernel_checked;
+	}
+	else if(s->span == RF_QPSK_SPAN)
+	{
+		switch(s->interpolation)
+		{
+		case 1: s->kernel = _rf_qpsk_kernel_1; break;
+		case 2: s->kernel = _rf_qpsk_kernel_2; break;
+		case 4: s->kernel = _rf_qpsk_kernel_4; break;
+		case 8: s->kernel = _rf_qpsk_kernel_8; break;
+		}
+	}
+}
+
+int rf_qpsk_init(rf_qpsk_t *s, int interpolation, double level)
+{
+	int i;
+	
 	fprintf(stderr, "MODULATOR INIT: Interpolation = %d, Level = %f\n", interpolation, level);
 	memset(s, 0, sizeof(rf_qpsk_t));
 	
-	/* Generate the symbol shape */
 	s->interpolation = interpolation;
 	s->ntaps = (10 * s->interpolation) | 1;
+	s->amplitude = level;
 	
-	for(i = 0; i < 4; i++)
+	/* Number of symbols overlapping each output sample. The taps are
+	 * zero padded to a whole number of symbol periods */
+	s->span = (s->ntaps + s->interpolation - 1) / s->interpolation;
+	
+	/* The fifth set is left empty, it stands in for the
+	 * symbols before the start of the stream */
+	for(i = 0; i < 5; i++)
 	{
-		s->taps[i] = malloc(sizeof(int16_t) * 2 * s->ntaps);
+		s->taps[i] = calloc(sizeof(int16_t) * 2, s->span * s->interpolation);
 		if(!s->taps[i])
 		{
 			rf_qpsk_free(s);
 			return(-1);
 		}
-		
-		n = s->ntaps / 2;
-		for(x = 0; x < s->ntaps; x++)
-		{
-			t = ((double) x - n) / s->interpolation;
-			r = _rrc(t, 0.5, 1.0) * _hamming(((double) x - n) / n);
-			s->taps[i][x * 2 + 0] = lround(r * sym[i][0] * M_SQRT1_2 * INT16_MAX * level);
-			s->taps[i][x * 2 + 1] = lround(r * sym[i][1] * M_SQRT1_2 * INT16_MAX * level);
-		}
 	}
 	
-	/* Allocate memory for the output window */
-	s->winx = 0;
-	s->win = calloc(sizeof(int16_t) * 2, s->ntaps);
-	if(!s->win)
+	_rf_qpsk_shape(s, level);
+	
+	/* Symbol history, grown to fit each block as needed */
+	s->syms_len = s->span - 1;
+	s->syms = malloc(s->syms_len);
+	if(!s->syms)
 	{
 		rf_qpsk_free(s);
 		return(-1);
 	}
 	
+	memset(s->syms, 4, s->syms_len);
+	
 	/* Starting symbol */
 	s->sym = 0;
 	
 	return(0);
 }
 
+void rf_qpsk_set_nco(rf_qpsk_t *s, rf_nco_t *nco)
+{
+	/* Rotating the output can take either axis up to sqrt(2) times
+	 * higher, so the taps drop by as much to stay within full scale */
+	s->nco = nco;
+	_rf_qpsk_shape(s, nco ? s->amplitude * M_SQRT1_2 : s->amplitude);
+}
+
+int rf_qpsk_set_threads(rf_qpsk_t *s, int threads)
+{
+	struct _rf_qpsk_pool_t *pool;
+	int i;
+	
+	_rf_qpsk_pool_free(s->pool);
+	s->pool = NULL;
+	
+	if(threads <= 1)
+	{
+		return(0);
+	}
+	
+	pool = calloc(1, sizeof(struct _rf_qpsk_pool_t) + sizeof(_rf_qpsk_worker_t) * (threads - 1));
+	if(!pool)
+	{
+		return(-1);
+	}
+	
+	pool->s = s;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	
+	for(i = 0; i < threads - 1; i++)
+	{
+		pool->workers[i].pool = pool;
+		
+		if(pthread_create(&pool->workers[i].thread, NULL, _rf_qpsk_thread, &pool->workers[i]) != 0)
+		{
+			perror("pthread_create");
+			break;
+		}
+		
+		pool->nworkers++;
+	}
+	
+	s->pool = pool;
+	
+	return(pool->nworkers == threads - 1 ? 0 : -1);
+}
+
 int rf_qpsk_modulate(rf_qpsk_t *s, int16_t *dst, const uint8_t *src, int bits)
 {
 	const uint8_t map[4] = { 0, 3, 1, 2 };
-	const int16_t *taps;
-	int16_t *win;
-	int x, i;
+	struct _rf_qpsk_pool_t *pool = s->pool;
+	const int h = s->span - 1;
+	uint32_t phase, delta;
+	uint8_t *syms;
+	int nsym, x, i, a, b;
 	
 // Innerhalb der rf_qpsk_modulate Funktion, wo die static int once = 0; Logik ist:
 static int once = 0;
@@ -169,41 +787,93 @@ if (!once) {
     
     once = 1;
 }
-    
-	for(x = 0; x < bits; x += 2)
+	
+	nsym = bits / 2;
+	
+	if(h + nsym > s->syms_len)
 	{
-		/* Read out the next 2-bit symbol, MSB first */
-		s->sym = (s->sym + map[(src[x >> 3] >> (6 - (x & 0x07))) & 0x03]) & 3;
+		syms = realloc(s->syms, h + nsym);
+		if(!syms) return(-1);
 		
-		/* Update the output window with the new symbol */
-		taps = s->taps[s->sym];
+		s->syms = syms;
+		s->syms_len = h + nsym;
+	}
+	
+	/* Read out the 2-bit symbols, MSB first, following the history */
+	syms = s->syms + h;
+	for(x = 0; x < nsym; x++)
+	{
+		s->sym = (s->sym + map[(src[x >> 2] >> (6 - ((x & 3) << 1))) & 0x03]) & 3;
+		syms[x] = s->sym;
+	}
+	
+	phase = s->nco ? s->nco->phase : 0;
+	delta = s->nco ? s->nco->delta : 0;
+	
+	if(pool && nsym >= (pool->nworkers + 1) * s->span)
+	{
+		/* Hand a segment to each worker. Every segment can read back
+		 * span - 1 symbols, so its output matches a single pass */
+		pthread_mutex_lock(&pool->mutex);
 		
-		win = &s->win[s->winx * 2];
-		for(i = 0; i < (s->ntaps - s->winx); i++)
+		for(i = 0; i < pool->nworkers; i++)
 		{
-			*(win++) += *(taps++);
-			*(win++) += *(taps++);
+			_rf_qpsk_worker_t *w = &pool->workers[i];
+			
+			a = (long) nsym * (i + 1) / (pool->nworkers + 1);
+			b = (long) nsym * (i + 2) / (pool->nworkers + 1);
+			
+			w->dst = dst + a * s->interpolation * 2;
+			w->syms = syms + a;
+			w->nsym = b - a;
+			w->phase = phase + delta * (uint32_t) (a * s->interpolation);
 		}
 		
-		win = &s->win[0];
-		for(; i < s->ntaps; i++)
+		pool->pending = pool->nworkers;
+		pool->gen++;
+		pthread_cond_broadcast(&pool->start);
+		pthread_mutex_unlock(&pool->mutex);
+		
+		_rf_qpsk_segment(s, dst, syms, nsym / (pool->nworkers + 1), phase, &s->level);
+		
+		pthread_mutex_lock(&pool->mutex);
+		while(pool->pending > 0)
 		{
-			*(win++) += *(taps++);
-			*(win++) += *(taps++);
+			pthread_cond_wait(&pool->done, &pool->mutex);
 		}
+		pthread_mutex_unlock(&pool->mutex);
 		
-		for(i = 0; i < s->interpolation; i++)
+		/* Collect the level of each segment */
+		for(i = 0; i < pool->nworkers; i++)
 		{
-			*(dst++) = s->win[s->winx * 2 + 0];
-			*(dst++) = s->win[s->winx * 2 + 1];
-			
-			s->win[s->winx * 2 + 0] = 0;
-			s->win[s->winx * 2 + 1] = 0;
-			
-			if(++s->winx == s->ntaps) s->winx = 0;
+			rf_level_add(&s->level, &pool->workers[i].level);
+			memset(&pool->workers[i].level, 0, sizeof(rf_level_t));
 		}
 	}
+	else
+	{
+		_rf_qpsk_segment(s, dst, syms, nsym, phase, &s->level);
+	}
+	
+	if(s->nco)
+	{
+		s->nco->phase = phase + delta * (uint32_t) (nsym * s->interpolation);
+	}
+	
+	/* Keep the last span - 1 symbols for the next block */
+	memmove(s->syms, s->syms + nsym, h);
 	
-	return(bits / 2 * s->interpolation);
+	return(nsym * s->interpolation);
 }
 
+void rf_qpsk_get_state(const rf_qpsk_t *s, rf_qpsk_state_t *state)
+{
+	int h = s->span - 1;
+	
+	/* RF_QPSK_SPAN - 1 at every interpolation, well within the room */
+	if(h > RF_QPSK_HISTORY) h = RF_QPSK_HISTORY;
+	
+	memset(state, 0, sizeof(rf_qpsk_state_t));
+	state->sym = s->sym;
+	memcpy(state->syms, s->syms + s->span - 1 - h, h);
+}
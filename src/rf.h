@@ -28,6 +28,9 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <pthread.h>
+#include "fec.h"
+#include "ts.h"
 
 #ifndef _RF_H
 #define _RF_H
@@ -51,6 +54,9 @@
 /* Callback prototypes */
 typedef int (*rf_write_t)(void *private, int16_t *iq_data, int samples);
 typedef int (*rf_close_t)(void *private);
+typedef int (*rf_stats_t)(void *private, FILE *f);
+typedef int16_t *(*rf_reserve_t)(void *private, int samples);
+typedef int (*rf_commit_t)(void *private, int samples);
 
 typedef struct {
 	
@@ -58,58 +64,293 @@ typedef struct {
 	rf_write_t write;
 	rf_close_t close;
 	
+	/* Optional, prints a line of sink counters */
+	rf_stats_t stats;
+	
+	/* Optional, lets samples be rendered straight into the sink */
+	rf_reserve_t reserve;
+	rf_commit_t commit;
+	
 	double scale;
 	
 } rf_t;
 
+/* Sequenced packet format for the unmodulated UDP stream. Each datagram
+ * holds whole frame pairs from a single block, after a 20-byte header:
+ *
+ *   0   RTP: V=2, marker on the first packet of a block, PT 96,
+ *       sequence, timestamp on the 10.24 MHz symbol clock, SSRC
+ *   12  block number since the start of the stream        (32 bits)
+ *   16  first frame pair in the packet, 0-63               (16 bits)
+ *   18  frame pairs in the packet                         (16 bits)
+ *   20  frame pairs, 80 bytes each
+ *
+ * All fields are big-endian. The timestamp is the absolute frame pair
+ * number times 320. */
+#define RF_UDP_RTP_HEADER   20
+#define RF_UDP_RTP_TYPE     96
+#define RF_UDP_FRAME_BYTES  80
+#define RF_UDP_BLOCK_FRAMES 64
+#define RF_UDP_FRAME_TICKS  320
+
+/* MPEG-TS formats (see ts.h): 7 TS packets to a datagram, optionally
+ * behind a plain RTP header (RFC 2250: PT 33, 90 kHz timestamp of the
+ * first packet's PCR). A datagram is never short but for the last */
+#define RF_UDP_TS_PACKETS    7
+#define RF_UDP_TS_RTP_HEADER 12
+#define RF_UDP_TS_RTP_TYPE   33
+
+/* UDP sink options, zero for the defaults */
+typedef struct {
+    size_t   payload;                /* Bytes per datagram (1400) */
+    int      batch;                  /* Writes sent per sendmmsg() call (1) */
+    int      gso;                    /* Non-zero to try UDP_SEGMENT offload */
+    uint64_t bitrate;                /* Payload bit rate to pace at, 0 sends at once */
+    double   max_late;               /* Seconds behind before pacing gives up (0.1) */
+    int      txtime;                 /* Non-zero to let the kernel launch packets (SO_TXTIME) */
+    int      rtp;                    /* Non-zero for the sequenced packet format */
+    int      ts;                     /* 1 for MPEG-TS, 2 for MPEG-TS over RTP */
+    uint64_t ts_rate;                /* TS mux rate in bits per second, 0 for the least */
+    int      ts_pid;                 /* TS data PID (0x100) */
+    int      fec_cols;               /* Parity matrix for the sequenced format, */
+    int      fec_rows;               /* L columns by D rows, 0 for none */
+    int      fec_row;                /* Non-zero to add row parity to column */
+    const char *interface;           /* Multicast interface, by name or IPv4 address */
+    int      ttl;                    /* Multicast TTL or hop limit (1) */
+    int      loop;                   /* Non-zero to loop multicast back to this host */
+    int      queue;                  /* Writes the send ring holds, 0 sends from the caller */
+    int      drop;                   /* Non-zero to drop the oldest write when the ring is
+                                      * full, rather than wait for room */
+} rf_udp_conf_t;
+
 typedef struct {
     int      sock;
     size_t   payload;
     int      preview_done;
 
-    /* Target address for sendto() */
-    struct sockaddr_storage addr;
-    socklen_t addrlen;
+    /* Destinations, each sent every datagram, all of the same family */
+    struct sockaddr_storage *dest;
+    socklen_t *dest_len;
+    int      ndest;
+    int      family;
+
+    /* Multicast options, applied when a destination is a group */
+    unsigned int mcast_ifindex;
+    struct in_addr mcast_if;
+    int      mcast_ttl;
+    int      mcast_loop;
+    int      mcast_set;
 
-    /* Pacing */
-     /* --- NEU: Pacing --- */
+    /* Pacing: the datagram starting at byte b of the stream is due at
+     * start + b * 8 / bitrate on the clock's timeline */
     unsigned long long bitrate_bps;  /* 0 => Pacing aus */
-    double   tokens_bytes;           /* Token-Bucket in Bytes */
-    struct timespec last;            /* letzte Auffüllzeit */
+    clockid_t clock;
+    uint64_t start;
+    uint64_t sent_bytes;
+    uint64_t max_late;
+    uint64_t *due;
+    int      txtime;
+
+    /* Send time minus due time of each datagram since the last
+     * report, the timeline moves, and launch times the kernel missed */
+    uint64_t jitter_n;
+    double   jitter_sum;
+    double   jitter_sq;
+    int64_t  jitter_max;
+    uint64_t resyncs;
+    uint64_t txtime_missed;
+
+    /* Datagrams queued for the next sendmmsg(). With batch > 1 the
+     * data is copied into buf, otherwise it points at the caller's */
+    struct mmsghdr *msgs;
+    struct iovec   *iov;
+    int      nmsgs;
+    int      max_msgs;
+    int      max_sends;
+    int      batch;
+    int      writes;
+    uint8_t *buf;
+    size_t   buf_len;
+    size_t   buf_size;
+
+    /* UDP_SEGMENT: one control message per mmsghdr, and the most
+     * datagrams the kernel will split a single send into */
+    int      gso;
+    int      gso_segs;
+    uint8_t *ctrl;
+
+    /* Sequenced format: frame pairs per full packet, and the next
+     * sequence number and frame pair */
+    int      rtp;
+    int      rtp_frames;
+    uint16_t rtp_seq;
+    uint32_t rtp_ssrc;
+    uint64_t rtp_frame;
+
+    /* Parity for the sequenced format, see fec.h */
+    int      use_fec;
+    fec_enc_t fec;
+
+    /* MPEG-TS formats: the packetiser, and a datagram left part full by
+     * the last block, with ts_count packets in it */
+    int      ts;
+    ts_mux_t tsm;
+    int      ts_count;
+    uint8_t  ts_hold[RF_UDP_TS_RTP_HEADER + RF_UDP_TS_PACKETS * TS_PACKET];
+    uint64_t ts_packets[3];          /* Data, null and PAT/PMT packets, for the stats */
+    uint64_t ts_queued;              /* TS packets put in the ring and dropped from it, */
+    uint64_t ts_dropped;             /* under ring_lock, to count their datagrams */
+
+    /* Send ring: rf_udp_send() queues a copy of each write, and a sender
+     * thread takes them from head. buf is the write being sent */
+    int      ring_depth;
+    int      ring_drop;
+    int      ring_head;
+    int      ring_count;
+    int      ring_max;
+    uint8_t **ring_data;
+    size_t  *ring_len;
+    size_t  *ring_cap;
+    uint8_t *ring_buf;
+    size_t   ring_buf_cap;
+    uint64_t ring_skip;
+    int      ring_stop;
+    pthread_t ring_thread;
+    pthread_mutex_t ring_lock;
+    pthread_cond_t ring_ready;
+    pthread_cond_t ring_room;
+
+    /* Ring counters: writes queued, dropped when full, and the times the
+     * caller waited for room; packets are counted as they would be sent */
+    uint64_t queued_packets;
+    uint64_t queued_bytes;
+    uint64_t ring_dropped_packets;
+    uint64_t ring_dropped_bytes;
+    uint64_t ring_waits;
+
+    /* Bytes sent and dropped by the socket, and waits for it to drain */
+    uint64_t sent_bytes_total;
+    uint64_t dropped_bytes;
+    uint64_t socket_waits;
+
+    /* Counters: datagrams sent, dropped with a full socket buffer,
+     * failed otherwise, and send calls. These, the jitter and the bytes
+     * above are written under ring_lock when the send ring is on */
+    uint64_t packets;
+    uint64_t dropped;
+    uint64_t errors;
+    uint64_t syscalls;
+    uint64_t gso_sends;
+    uint64_t fec_packets;
+    int      last_error;
 } rf_udp_t;
 
 
 extern double rf_scale(rf_t *s);
 extern int rf_write(rf_t *s, int16_t *iq_data, int samples);
 extern int rf_close(rf_t *s);
+extern int rf_stats(rf_t *s, FILE *f);
+extern int16_t *rf_reserve(rf_t *s, int samples);
+extern int rf_commit(rf_t *s, int samples);
 
 int rf_udp_open(void **out_private, const char *host, const char *port, size_t payload_bytes);
+int rf_udp_open_conf(void **out_private, const char *host, const char *port, const rf_udp_conf_t *conf);
+int rf_udp_add_dest(void *priv, const char *host, const char *port);
+int rf_udp_flush(void *priv);
 void rf_udp_set_bitrate(void *priv, uint64_t bps);
+void rf_udp_pace_stats(void *priv, FILE *f);
 int rf_udp_send(void *priv, const uint8_t *data, size_t len);
 int rf_udp_close(void *priv);
 
+/* Numerically controlled oscillator, shifts IQ samples by a fixed frequency */
+#define RF_NCO_BITS 11
+
 typedef struct {
 	
+	/* Phase accumulator and increment, 2^32 = one cycle */
+	uint32_t phase;
+	uint32_t delta;
+	
+} rf_nco_t;
+
+extern int rf_nco_init(rf_nco_t *s, double frequency, unsigned int sample_rate);
+extern void rf_nco_mix(rf_nco_t *s, int16_t *iq_data, int samples);
+
+/* Output level accumulator */
+typedef struct {
+	
+	/* Complex samples measured, and the sum of I^2 + Q^2 over them */
+	uint64_t samples;
+	uint64_t power;
+	
+	/* Largest absolute I or Q value */
+	int peak;
+	
+	/* Values saturated to the int16 range, or wrapped around in the modulator */
+	uint64_t clips;
+	uint64_t wraps;
+	
+} rf_level_t;
+
+extern void rf_level_update(rf_level_t *l, const int16_t *iq_data, int samples);
+extern void rf_level_add(rf_level_t *dst, const rf_level_t *src);
+
+extern void rf_iq_sum(int16_t *dst, const int16_t **src, int n, int samples, rf_level_t *level);
+
+typedef struct _rf_qpsk_t {
+	
 	int interpolation;
 	int ntaps;
-	int16_t *taps[4];
+	int span;
+	int16_t *taps[5];
 	
-	/* Output window */
-	int winx;
-	int16_t *win;
+	/* Level asked for, and the largest value the filter can reach */
+	double amplitude;
+	double peak;
+	
+	/* Renders nsym symbols, reading back span - 1 symbols before syms */
+	void (*kernel)(const struct _rf_qpsk_t *s, int16_t *dst, const uint8_t *syms, int nsym, rf_level_t *level);
+	
+	/* Symbol history followed by the current block */
+	uint8_t *syms;
+	int syms_len;
 	
 	/* Differential state */
 	int sym;
 	
+	/* Optional frequency shift applied to the output, see rf_qpsk_set_nco() */
+	rf_nco_t *nco;
+	
+	/* Optional worker threads */
+	struct _rf_qpsk_pool_t *pool;
+	
+	/* Level of the output since it was last reset */
+	rf_level_t level;
+	
 } rf_qpsk_t;
 
+/* What one block leaves for the next: the differential state and the
+ * symbol history. Two points in a stream with equal states and equal
+ * blocks following give equal output */
+#define RF_QPSK_HISTORY 16
+
+typedef struct {
+	int sym;
+	uint8_t syms[RF_QPSK_HISTORY];
+} rf_qpsk_state_t;
+
 
 extern void rf_qpsk_free(rf_qpsk_t *s);
 extern int rf_qpsk_init(rf_qpsk_t *s, int interpolation, double level);
+extern int rf_qpsk_set_threads(rf_qpsk_t *s, int threads);
+extern void rf_qpsk_set_nco(rf_qpsk_t *s, rf_nco_t *nco);
 extern int rf_qpsk_modulate(rf_qpsk_t *s, int16_t *dst, const uint8_t *src, int bits);
+extern void rf_qpsk_get_state(const rf_qpsk_t *s, rf_qpsk_state_t *state);
 
 #include "rf_file.h"
 #include "rf_hackrf.h"
+#include "rf_server.h"
+#include "rf_shm.h"
 
 #endif
 
@@ -0,0 +1,412 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+#include "rf.h"
+#include "rf_convert.h"
+
+rf_debug_t rf_debug = NULL;
+
+/* Scalar kernels, also the reference for the others */
+
+static void _uint8_scalar(void *dst, const int16_t *src, int samples)
+{
+	uint8_t *d = dst;
+	int i;
+	
+	for(i = 0; i < samples * 2; i++)
+	{
+		d[i] = ((int32_t) src[i] - INT16_MIN) >> 8;
+	}
+}
+
+static void _int8_scalar(void *dst, const int16_t *src, int samples)
+{
+	int8_t *d = dst;
+	int i;
+	
+	for(i = 0; i < samples * 2; i++)
+	{
+		d[i] = src[i] >> 8;
+	}
+}
+
+static void _uint16_scalar(void *dst, const int16_t *src, int samples)
+{
+	uint16_t *d = dst;
+	int i;
+	
+	for(i = 0; i < samples * 2; i++)
+	{
+		d[i] = (int32_t) src[i] - INT16_MIN;
+	}
+}
+
+static void _int16_scalar(void *dst, const int16_t *src, int samples)
+{
+	memcpy(dst, src, sizeof(int16_t) * 2 * samples);
+}
+
+static void _int32_scalar(void *dst, const int16_t *src, int samples)
+{
+	int32_t *d = dst;
+	int i;
+	
+	/* Repeat the 16 bits to reach full scale */
+	for(i = 0; i < samples * 2; i++)
+	{
+		d[i] = ((uint32_t) src[i] << 16) + (uint32_t) src[i];
+	}
+}
+
+static void _float_scalar(void *dst, const int16_t *src, int samples)
+{
+	float *d = dst;
+	int i;
+	
+	for(i = 0; i < samples * 2; i++)
+	{
+		d[i] = (float) src[i] * (1.0f / 32767.0f);
+	}
+}
+
+#ifdef __x86_64__
+
+/* SSE2 kernels, 8 values at a time. SSE2 is always there on x86-64 */
+
+static void _uint8_sse2(void *dst, const int16_t *src, int samples)
+{
+	const __m128i bias = _mm_set1_epi8(0x80);
+	uint8_t *d = dst;
+	int i, n = samples * 2;
+	
+	for(i = 0; i + 16 <= n; i += 16)
+	{
+		__m128i a = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) &src[i + 0]), 8);
+		__m128i b = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) &src[i + 8]), 8);
+		_mm_storeu_si128((__m128i *) &d[i], _mm_xor_si128(_mm_packs_epi16(a, b), bias));
+	}
+	
+	_uint8_scalar(&d[i], &src[i], (n - i) / 2);
+}
+
+static void _int8_sse2(void *dst, const int16_t *src, int samples)
+{
+	int8_t *d = dst;
+	int i, n = samples * 2;
+	
+	for(i = 0; i + 16 <= n; i += 16)
+	{
+		__m128i a = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) &src[i + 0]), 8);
+		__m128i b = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) &src[i + 8]), 8);
+		_mm_storeu_si128((__m128i *) &d[i], _mm_packs_epi16(a, b));
+	}
+	
+	_int8_scalar(&d[i], &src[i], (n - i) / 2);
+}
+
+static void _uint16_sse2(void *dst, const int16_t *src, int samples)
+{
+	const __m128i bias = _mm_set1_epi16(0x8000);
+	uint16_t *d = dst;
+	int i, n = samples * 2;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *) &src[i]);
+		_mm_storeu_si128((__m128i *) &d[i], _mm_xor_si128(a, bias));
+	}
+	
+	_uint16_scalar(&d[i], &src[i], (n - i) / 2);
+}
+
+static void _int32_sse2(void *dst, const int16_t *src, int samples)
+{
+	int32_t *d = dst;
+	int i, n = samples * 2;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *) &src[i]);
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16);
+		_mm_storeu_si128((__m128i *) &d[i + 0], _mm_add_epi32(_mm_slli_epi32(lo, 16), lo));
+		_mm_storeu_si128((__m128i *) &d[i + 4], _mm_add_epi32(_mm_slli_epi32(hi, 16), hi));
+	}
+	
+	_int32_scalar(&d[i], &src[i], (n - i) / 2);
+}
+
+static void _float_sse2(void *dst, const int16_t *src, int samples)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 32767.0f);
+	float *d = dst;
+	int i, n = samples * 2;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *) &src[i]);
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16);
+		_mm_storeu_ps(&d[i + 0], _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(&d[i + 4], _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	
+	_float_scalar(&d[i], &src[i], (n - i) / 2);
+}
+
+/* AVX2 kernels, 16 values at a time. Packing works within each 128-bit
+ * lane, so the 64-bit quarters are put back in order afterwards */
+
+__attribute__((target("avx2")))
+static void _uint8_avx2(void *dst, const int16_t *src, int samples)
+{
+	const __m256i bias = _mm256_set1_epi8(0x80);
+	uint8_t *d = dst;
+	int i, n = samples * 2;
+	
+	for(i = 0; i + 32 <= n; i += 32)
+	{
+		__m256i a = _mm256_srai_epi16(_mm256_loadu_si256((const __m256i *) &src[i + 0]), 8);
+		__m256i b = _mm256_srai_epi16(_mm256_loadu_si256((const __m256i *) &src[i + 16]), 8);
+		a = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+		_mm256_storeu_si256((__m256i *) &d[i], _mm256_xor_si256(a, bias));
+	}
+	
+	_uint8_sse2(&d[i], &src[i], (n - i) / 2);
+}
+
+__attribute__((target("avx2")))
+static void _int8_avx2(void *dst, const int16_t *src, int samples)
+{
+	int8_t *d = dst;
+	int i, n = samples * 2;
+	
+	for(i = 0; i + 32 <= n; i += 32)
+	{
+		__m256i a = _mm256_srai_epi16(_mm256_loadu_si256((const __m256i *) &src[i + 0]), 8);
+		__m256i b = _mm256_srai_epi16(_mm256_loadu_si256((const __m256i *) &src[i + 16]), 8);
+		a = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+		_mm256_storeu_si256((__m256i *) &d[i], a);
+	}
+	
+	_int8_sse2(&d[i], &src[i], (n - i) / 2);
+}
+
+__attribute__((target("avx2")))
+static void _uint16_avx2(void *dst, const int16_t *src, int samples)
+{
+	const __m256i bias = _mm256_set1_epi16(0x8000);
+	uint16_t *d = dst;
+	int i, n = samples * 2;
+	
+	for(i = 0; i + 16 <= n; i += 16)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i *) &src[i]);
+		_mm256_storeu_si256((__m256i *) &d[i], _mm256_xor_si256(a, bias));
+	}
+	
+	_uint16_sse2(&d[i], &src[i], (n - i) / 2);
+}
+
+__attribute__((target("avx2")))
+static void _int32_avx2(void *dst, const int16_t *src, int samples)
+{
+	int32_t *d = dst;
+	int i, n = samples * 2;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		__m256i a = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &src[i]));
+		_mm256_storeu_si256((__m256i *) &d[i], _mm256_add_epi32(_mm256_slli_epi32(a, 16), a));
+	}
+	
+	_int32_scalar(&d[i], &src[i], (n - i) / 2);
+}
+
+__attribute__((target("avx2")))
+static void _float_avx2(void *dst, const int16_t *src, int samples)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 32767.0f);
+	float *d = dst;
+	int i, n = samples * 2;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		__m256i a = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &src[i]));
+		_mm256_storeu_ps(&d[i], _mm256_mul_ps(_mm256_cvtepi32_ps(a), scale));
+	}
+	
+	_float_scalar(&d[i], &src[i], (n - i) / 2);
+}
+
+#endif
+
+static const struct {
+	int type;
+	size_t size;
+	rf_convert_t kernel[3];
+} _formats[] = {
+#ifdef __x86_64__
+	{ RF_UINT8,  2 * sizeof(uint8_t),  { _uint8_scalar,  _uint8_sse2,   _uint8_avx2  } },
+	{ RF_INT8,   2 * sizeof(int8_t),   { _int8_scalar,   _int8_sse2,    _int8_avx2   } },
+	{ RF_UINT16, 2 * sizeof(uint16_t), { _uint16_scalar, _uint16_sse2,  _uint16_avx2 } },
+	{ RF_INT16,  2 * sizeof(int16_t),  { _int16_scalar,  _int16_scalar, _int16_scalar } },
+	{ RF_INT32,  2 * sizeof(int32_t),  { _int32_scalar,  _int32_sse2,   _int32_avx2  } },
+	{ RF_FLOAT,  2 * sizeof(float),    { _float_scalar,  _float_sse2,   _float_avx2  } },
+#else
+	{ RF_UINT8,  2 * sizeof(uint8_t),  { _uint8_scalar } },
+	{ RF_INT8,   2 * sizeof(int8_t),   { _int8_scalar } },
+	{ RF_UINT16, 2 * sizeof(uint16_t), { _uint16_scalar } },
+	{ RF_INT16,  2 * sizeof(int16_t),  { _int16_scalar } },
+	{ RF_INT32,  2 * sizeof(int32_t),  { _int32_scalar } },
+	{ RF_FLOAT,  2 * sizeof(float),    { _float_scalar } },
+#endif
+	{ -1 }
+};
+
+int rf_convert_isa(void)
+{
+	static int isa = -1;
+	
+	if(isa < 0)
+	{
+		isa = RF_CONVERT_SCALAR;
+#ifdef __x86_64__
+		__builtin_cpu_init();
+		isa = __builtin_cpu_supports("avx2") ? RF_CONVERT_AVX2 : RF_CONVERT_SSE2;
+#endif
+	}
+	
+	return(isa);
+}
+
+rf_convert_t rf_convert_get_isa(int type, int isa)
+{
+	int i;
+	
+	if(isa < RF_CONVERT_SCALAR || isa > rf_convert_isa())
+	{
+		return(NULL);
+	}
+	
+	for(i = 0; _formats[i].type >= 0; i++)
+	{
+		if(_formats[i].type == type)
+		{
+			return(_formats[i].kernel[isa]);
+		}
+	}
+	
+	return(NULL);
+}
+
+rf_convert_t rf_convert_get(int type)
+{
+	return(rf_convert_get_isa(type, rf_convert_isa()));
+}
+
+size_t rf_convert_size(int type)
+{
+	int i;
+	
+	for(i = 0; _formats[i].type >= 0; i++)
+	{
+		if(_formats[i].type == type)
+		{
+			return(_formats[i].size);
+		}
+	}
+	
+	return(0);
+}
+
+void rf_convert_preview(int type, const void *data, size_t bytes)
+{
+	static uint32_t shown = 0;
+	const uint8_t *p = data;
+	size_t i, n;
+	
+	/* Only the first block of each format */
+	if(type < 0 || type > 31 || (shown & (1 << type))) return;
+	shown |= 1 << type;
+	
+	n = bytes < 128 ? bytes : 128;
+	fprintf(stderr, "Preview of the first %zu bytes of output (type %d):\n", n, type);
+	
+	if(type == RF_UNMOD_UINT8 || type == RF_UNMOD_UDP)
+	{
+		/* Raw bytes, with the A9 59 sync pattern highlighted */
+		for(i = 0; i < n; i++)
+		{
+			if(i > 0 && p[i - 1] == 0xA9 && p[i] == 0x59)
+			{
+				fprintf(stderr, COLOR_BLUE "%02X" COLOR_RESET " ", p[i]);
+			}
+			else if(i + 1 < n && p[i] == 0xA9 && p[i + 1] == 0x59)
+			{
+				fprintf(stderr, COLOR_AMBER "%02X" COLOR_RESET " ", p[i]);
+			}
+			else
+			{
+				fprintf(stderr, "%02X ", p[i]);
+			}
+			
+			if((i % 16) == 15) fprintf(stderr, "\n");
+		}
+	}
+	else
+	{
+		/* I/Q pairs */
+		size_t size = rf_convert_size(type);
+		
+		for(i = 0; size && i + size <= n; i += size)
+		{
+			if(type == RF_FLOAT)
+			{
+				const float *f = (const float *) &p[i];
+				fprintf(stderr, COLOR_AMBER "I:% .6f" COLOR_RESET " " COLOR_BLUE "Q:% .6f" COLOR_RESET "   ", f[0], f[1]);
+			}
+			else
+			{
+				/* Hex, most significant byte first */
+				int j, w = size / 2;
+				
+				fprintf(stderr, COLOR_AMBER "I:0x");
+				for(j = w - 1; j >= 0; j--) fprintf(stderr, "%02X", p[i + j]);
+				fprintf(stderr, COLOR_RESET " " COLOR_BLUE "Q:0x");
+				for(j = w - 1; j >= 0; j--) fprintf(stderr, "%02X", p[i + w + j]);
+				fprintf(stderr, COLOR_RESET "   ");
+			}
+			
+			if(((i / size) % 4) == 3) fprintf(stderr, "\n");
+		}
+	}
+	
+	fprintf(stderr, "\n");
+}
+
@@ -0,0 +1,54 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+#ifndef _RF_CONVERT_H
+#define _RF_CONVERT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Conversion of int16 IQ samples to each output format. Kernels are
+ * chosen for the CPU the first time they are asked for */
+
+#define RF_CONVERT_SCALAR 0
+#define RF_CONVERT_SSE2   1
+#define RF_CONVERT_AVX2   2
+
+/* Converts samples complex int16 samples from src into dst */
+typedef void (*rf_convert_t)(void *dst, const int16_t *src, int samples);
+
+extern int rf_convert_isa(void);
+extern rf_convert_t rf_convert_get(int type);
+extern rf_convert_t rf_convert_get_isa(int type, int isa);
+extern size_t rf_convert_size(int type);
+
+/* Optional debug hook, called by the sinks with each block of output
+ * in its final format. rf_convert_preview() prints the first one of
+ * each format */
+typedef void (*rf_debug_t)(int type, const void *data, size_t bytes);
+
+extern rf_debug_t rf_debug;
+extern void rf_convert_preview(int type, const void *data, size_t bytes);
+
+#endif
+
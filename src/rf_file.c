@@ -25,359 +25,123 @@
 #include <stdlib.h>
 #include <string.h>
 #include "rf.h"
+#include "rf_convert.h"
 
 
 /* File sink */
 typedef struct {
-	FILE *f;
-	void *data;
+	rf_fileio_t *io;
+	rf_convert_t convert;
 	size_t data_size;
-	int samples;
 	int type;
 } rf_file_t;
 
 
 
-static int _rf_file_write_uint8(void *private, int16_t *iq_data, int samples)
+/* Reserve room for up to *n samples in the output, *n is reduced to what fits */
+static void *_rf_file_reserve(rf_file_t *rf, int *n)
 {
-    rf_file_t *rf = private;
-    uint8_t *u8 = rf->data;
-    static int once_printed = 0;
-
-    const int MAX_BYTES_TO_SHOW = 128;  /* Reduced for test output - only show first few blocks */
-    const int BYTES_PER_PAIR   = 2 * (int)sizeof(uint8_t);   // I + Q
-    const int MAX_PAIRS_TO_SHOW = MAX_BYTES_TO_SHOW / BYTES_PER_PAIR;
-
-    while (samples) {
-        int n = (rf->samples < samples) ? rf->samples : samples;
-        int i;
-
-        // signed 16-bit -> unsigned 8-bit (shift to [0..255], MSB)
-        for (i = 0; i < n; i++, iq_data += 2) {
-            u8[2*i + 0] = (uint8_t)(((int32_t)iq_data[0] - INT16_MIN) >> 8); // I
-            u8[2*i + 1] = (uint8_t)(((int32_t)iq_data[1] - INT16_MIN) >> 8); // Q
-        }
-
-        // One-time preview (max. 128 bytes)
-        if (!once_printed) {
-            int pairs_to_show   = (n < MAX_PAIRS_TO_SHOW) ? n : MAX_PAIRS_TO_SHOW;
-            int bytes_in_preview = pairs_to_show * BYTES_PER_PAIR;
-
-            printf("Writing %d bytes to file (uint8, hex) – preview first block (max. %d bytes):\n",
-                   bytes_in_preview, MAX_BYTES_TO_SHOW);
-
-            for (int j = 0; j < pairs_to_show; ++j) {
-                unsigned int I = u8[2*j + 0];
-                unsigned int Q = u8[2*j + 1];
-                printf("%sI:0x%02X%s %sQ:0x%02X%s   ",
-                       COLOR_AMBER, I, COLOR_RESET,
-                       COLOR_BLUE,  Q, COLOR_RESET);
-                if (((j + 1) % 4) == 0) printf("\n");
-            }
-            printf("\n");
-            once_printed = 1;
-        }
-
-        // Write: rf->data_size should be 2*sizeof(uint8_t)
-        fwrite(rf->data, rf->data_size, i, rf->f);
-        samples -= i;
-    }
-
-    return 0;
+	size_t len = (size_t) *n * rf->data_size;
+	void *p;
+	
+	p = rf_fileio_reserve(rf->io, &len);
+	*n = len / rf->data_size;
+	
+	return(p);
 }
 
-
-static int _rf_file_write_int8(void *private, int16_t *iq_data, int total_input_samples)
+static int _rf_file_write(void *private, int16_t *iq_data, int samples)
 {
-    rf_file_t *rf = private;
-    int8_t *i8 = rf->data;
-    int once_printed = 0;                // static? -> If function is called multiple times per process lifetime,
-    static int s_once_printed = 0;       //      better to keep it static:
-    once_printed = s_once_printed;
-
-    const int MAX_BYTES_TO_SHOW = 128;  /* Reduced for test output - only show first few blocks */
-    const int BYTES_PER_PAIR = 2 * (int)sizeof(int8_t); // I+Q
-    const int MAX_PAIRS_TO_SHOW = MAX_BYTES_TO_SHOW / BYTES_PER_PAIR;
-
-    int samples = total_input_samples;
-
-    while (samples) {
-        int n = rf->samples < samples ? rf->samples : samples;  // #IQ pairs in this block
-        int i;
-
-        // Convert: 16-bit -> 8-bit (MSB), interleaved I/Q
-        for (i = 0; i < n; i++, iq_data += 2) {
-            i8[2*i + 0] = (int8_t)(iq_data[0] >> 8);
-            i8[2*i + 1] = (int8_t)(iq_data[1] >> 8);
-        }
-
-        // One-time preview (max. 128 bytes)
-        if (!once_printed) {
-            int pairs_to_show = n < MAX_PAIRS_TO_SHOW ? n : MAX_PAIRS_TO_SHOW;
-            int bytes_in_preview = pairs_to_show * BYTES_PER_PAIR;
-
-            printf("Writing %d bytes to file (int8) – preview first block (max. %d bytes):\n",
-                   bytes_in_preview, MAX_BYTES_TO_SHOW);
-
-            for (int j = 0; j < pairs_to_show; ++j) {
-                uint8_t I = (uint8_t)i8[2*j + 0];
-                uint8_t Q = (uint8_t)i8[2*j + 1];
-                printf("%sI:0x%02X%s %sQ:0x%02X%s   ",
-                       COLOR_AMBER, I, COLOR_RESET,
-                       COLOR_BLUE,  Q, COLOR_RESET);
-                if (((j + 1) % 4) == 0) printf("\n");
-            }
-            printf("\n");
-            once_printed = 1;
-            s_once_printed = 1;
-        }
-
-        fwrite(rf->data, rf->data_size, i, rf->f); // rf->data_size = 2 * sizeof(int8_t)
-        samples -= i;
-    }
-
-    return 0;
+	rf_file_t *rf = private;
+	void *dst;
+	int n;
+	
+	while(samples > 0)
+	{
+		/* Convert straight into the output buffer */
+		n = samples;
+		dst = _rf_file_reserve(rf, &n);
+		if(!dst) return(-1);
+		
+		rf->convert(dst, iq_data, n);
+		
+		if(rf_debug) rf_debug(rf->type, dst, n * rf->data_size);
+		
+		if(rf_fileio_commit(rf->io, n * rf->data_size) != 0)
+		{
+			return(-1);
+		}
+		
+		iq_data += n * 2;
+		samples -= n;
+	}
+	
+	return(0);
 }
 
-
-static int _rf_file_write_uint16(void *private, int16_t *iq_data, int samples)
+static int _rf_file_write_unmod_uint8(void *private, int16_t *iq_data, int bytes)
 {
     rf_file_t *rf = private;
-    uint16_t *u16 = rf->data;
-    static int once_printed = 0;
-
-    const int MAX_BYTES_TO_SHOW = 128;  /* Reduced for test output - only show first few blocks */
-    const int BYTES_PER_PAIR = 2 * (int)sizeof(uint16_t); // I+Q
-    const int MAX_PAIRS_TO_SHOW = MAX_BYTES_TO_SHOW / BYTES_PER_PAIR;
-
-    while (samples) {
-        int n = rf->samples < samples ? rf->samples : samples; // #IQ pairs in this block
-        int i;
-
-        // Convert: signed 16-bit -> unsigned 16-bit (offset to [0..65535])
-        for (i = 0; i < n; i++, iq_data += 2) {
-            u16[2*i + 0] = (uint16_t)((int32_t)iq_data[0] - INT16_MIN);
-            u16[2*i + 1] = (uint16_t)((int32_t)iq_data[1] - INT16_MIN);
-        }
-
-        if (!once_printed) {
-            int pairs_to_show = n < MAX_PAIRS_TO_SHOW ? n : MAX_PAIRS_TO_SHOW;
-            int bytes_in_preview = pairs_to_show * BYTES_PER_PAIR;
-
-            printf("Writing %d bytes to file (uint16, hex) – preview first block (max. %d bytes):\n",
-                   bytes_in_preview, MAX_BYTES_TO_SHOW);
-
-            for (int j = 0; j < pairs_to_show; ++j) {
-                uint16_t I = u16[2*j + 0];
-                uint16_t Q = u16[2*j + 1];
-                printf("%sI:0x%04X%s %sQ:0x%04X%s   ",
-                       COLOR_AMBER, (unsigned)I, COLOR_RESET,
-                       COLOR_BLUE,  (unsigned)Q, COLOR_RESET);
-                if (((j + 1) % 4) == 0) printf("\n");
-            }
-            printf("\n");
-            once_printed = 1;
-        }
+    const uint8_t *p = (const uint8_t*)iq_data; // unmodulated raw bytes
+    size_t total = (bytes < 0) ? 0 : (size_t)bytes;
 
-        fwrite(rf->data, rf->data_size, i, rf->f); // rf->data_size = 2 * sizeof(uint16_t)
-        samples -= i;
-    }
+    if (rf_debug) rf_debug(RF_UNMOD_UINT8, p, total);
 
-    return 0;
+    return rf_fileio_write(rf->io, p, total);
 }
-
-
-static int _rf_file_write_int16(void *private, int16_t *iq_data, int samples)
+static int _rf_file_close(void *private)
 {
-    rf_file_t *rf = private;
-    static int once_printed = 0;
-
-    const int MAX_BYTES_TO_SHOW = 128;  /* Reduced for test output - only show first few blocks */
-    const int BYTES_PER_PAIR = 2 * (int)sizeof(int16_t); // I+Q
-    const int MAX_PAIRS_TO_SHOW = MAX_BYTES_TO_SHOW / BYTES_PER_PAIR;
-
-    int remaining = samples;
-
-    while (remaining) {
-        int n = rf->samples < remaining ? rf->samples : remaining;
-
-        if (!once_printed) {
-            int pairs_to_show = n < MAX_PAIRS_TO_SHOW ? n : MAX_PAIRS_TO_SHOW;
-            int bytes_in_preview = pairs_to_show * BYTES_PER_PAIR;
-
-            printf("Writing %d bytes to file (int16, hex) – preview first block (max. %d bytes):\n",
-                   bytes_in_preview, MAX_BYTES_TO_SHOW);
-
-            for (int j = 0; j < pairs_to_show; ++j) {
-                uint16_t I = (uint16_t)iq_data[2*j + 0];
-                uint16_t Q = (uint16_t)iq_data[2*j + 1];
-                printf("%sI:0x%04X%s %sQ:0x%04X%s   ",
-                       COLOR_AMBER, (unsigned)I, COLOR_RESET,
-                       COLOR_BLUE,  (unsigned)Q, COLOR_RESET);
-                if (((j + 1) % 4) == 0) printf("\n");
-            }
-            printf("\n");
-            once_printed = 1;
-        }
-
-        // Direct write from input buffer
-        fwrite(iq_data, sizeof(int16_t) * 2, n, rf->f);
-
-        iq_data   += 2 * n;
-        remaining -= n;
-    }
-
-    return 0;
+	rf_file_t *rf = private;
+	int r;
+	
+	r = rf_fileio_close(rf->io);
+	free(rf);
+	
+	return(r);
 }
 
-static int _rf_file_write_int32(void *private, int16_t *iq_data, int samples)
+static int16_t *_rf_file_reserve_int16(void *private, int samples)
 {
-    rf_file_t *rf = private;
-    int32_t *i32 = rf->data;
-    static int once_printed = 0;
-
-    const int MAX_BYTES_TO_SHOW = 128;  /* Reduced for test output - only show first few blocks */
-    const int BYTES_PER_PAIR = 2 * (int)sizeof(int32_t); // I+Q
-    const int MAX_PAIRS_TO_SHOW = MAX_BYTES_TO_SHOW / BYTES_PER_PAIR;
-
-    while (samples) {
-        int n = rf->samples < samples ? rf->samples : samples;
-        int i;
-
-        for (i = 0; i < n; i++, iq_data += 2) {
-            i32[2*i + 0] = ((int32_t)iq_data[0] << 16) + (int32_t)iq_data[0];
-            i32[2*i + 1] = ((int32_t)iq_data[1] << 16) + (int32_t)iq_data[1];
-        }
-
-        if (!once_printed) {
-            int pairs_to_show = n < MAX_PAIRS_TO_SHOW ? n : MAX_PAIRS_TO_SHOW;
-            int bytes_in_preview = pairs_to_show * BYTES_PER_PAIR;
-
-            printf("Writing %d bytes to file (int32, hex) – preview first block (max. %d bytes):\n",
-                   bytes_in_preview, MAX_BYTES_TO_SHOW);
-
-            for (int j = 0; j < pairs_to_show; ++j) {
-                uint32_t I = (uint32_t)i32[2*j + 0];
-                uint32_t Q = (uint32_t)i32[2*j + 1];
-                printf("%sI:0x%08X%s %sQ:0x%08X%s   ",
-                       COLOR_AMBER, I, COLOR_RESET,
-                       COLOR_BLUE,  Q, COLOR_RESET);
-                if (((j + 1) % 4) == 0) printf("\n");
-            }
-            printf("\n");
-            once_printed = 1;
-        }
-
-        fwrite(rf->data, rf->data_size, i, rf->f); // rf->data_size = 2 * sizeof(int32_t)
-        samples -= i;
-    }
-
-    return 0;
+	rf_file_t *rf = private;
+	size_t len = (size_t) samples * rf->data_size;
+	int16_t *p;
+	
+	/* Only whole blocks, the caller writes them any other way */
+	p = rf_fileio_reserve(rf->io, &len);
+	if(len < (size_t) samples * rf->data_size) return(NULL);
+	
+	return(p);
 }
 
-static int _rf_file_write_float(void *private, int16_t *iq_data, int samples)
+static int _rf_file_commit_int16(void *private, int samples)
 {
-    rf_file_t *rf = private;
-    float *f32 = rf->data;
-    static int once_printed = 0;
-
-    const int MAX_BYTES_TO_SHOW = 128;  /* Reduced for test output - only show first few blocks */
-    const int BYTES_PER_PAIR = 2 * (int)sizeof(float); // I+Q
-    const int MAX_PAIRS_TO_SHOW = MAX_BYTES_TO_SHOW / BYTES_PER_PAIR;
-    const float scale = 1.0f / 32767.0f;
-
-    while (samples) {
-        int n = rf->samples < samples ? rf->samples : samples;
-        int i;
-
-        for (i = 0; i < n; i++, iq_data += 2) {
-            f32[2*i + 0] = (float)iq_data[0] * scale;
-            f32[2*i + 1] = (float)iq_data[1] * scale;
-        }
-
-        if (!once_printed) {
-            int pairs_to_show = n < MAX_PAIRS_TO_SHOW ? n : MAX_PAIRS_TO_SHOW;
-            int bytes_in_preview = pairs_to_show * BYTES_PER_PAIR;
-
-            printf("Writing %d bytes to file (float, ±1.0) – preview first block (max. %d bytes):\n",
-                   bytes_in_preview, MAX_BYTES_TO_SHOW);
-
-            for (int j = 0; j < pairs_to_show; ++j) {
-                float I = f32[2*j + 0];
-                float Q = f32[2*j + 1];
-                printf("%sI:% .6f%s %sQ:% .6f%s   ",
-                       COLOR_AMBER, I, COLOR_RESET,
-                       COLOR_BLUE,  Q, COLOR_RESET);
-                if (((j + 1) % 4) == 0) printf("\n");
-            }
-            printf("\n");
-            once_printed = 1;
-        }
-
-        fwrite(rf->data, rf->data_size, i, rf->f); // rf->data_size = 2 * sizeof(float)
-        samples -= i;
-    }
-
-    return 0;
+	rf_file_t *rf = private;
+	
+	return(rf_fileio_commit(rf->io, (size_t) samples * rf->data_size));
 }
 
-
-static int _rf_file_write_unmod_uint8(void *private, int16_t *iq_data, int bytes)
-{
-    rf_file_t *rf = private;
-    const uint8_t *p = (const uint8_t*)iq_data; // unmodulated raw bytes
-    size_t n;
-    static int once_printed = 0;
-
-    const int MAX_BYTES_TO_SHOW = 128;  /* Reduced for test output - only show first few blocks */
-    size_t total = (bytes < 0) ? 0 : (size_t)bytes;
-    size_t bytes_to_show = (total < MAX_BYTES_TO_SHOW) ? total : MAX_BYTES_TO_SHOW;
-
-    if (!once_printed) {
-        printf("Writing %zu unmodulated raw bytes (hex, without 0x) – preview first block (max. %d bytes):\n", 
-               total, MAX_BYTES_TO_SHOW);
-
-        size_t count = 0;          // Number of bytes already printed (for line breaks)
-        size_t k = 0;
-
-        while (k < bytes_to_show) {
-            // Match: sequence A9 59 at position k?
-            if (k + 1 < bytes_to_show && p[k] == 0xA9 && p[k + 1] == 0x59) {
-                // A9 (Amber)
-                printf(COLOR_AMBER "%02X" COLOR_RESET " ", p[k]);
-                count++;
-                if ((count % 16) == 0) printf("\n");
-
-                // 59 (Blue)
-                printf(COLOR_BLUE "%02X" COLOR_RESET " ", p[k + 1]);
-                count++;
-                if ((count % 16) == 0) printf("\n");
-
-                k += 2;
-                continue;
-            }
-
-            // Normal bytes without highlighting
-            printf("%02X ", p[k]);
-            count++;
-            if ((count % 16) == 0) printf("\n");
-            k++;
-        }
-
-        if ((count % 16) != 0) printf("\n"); // Final line
-        once_printed = 1;
-    }
-
-    n = fwrite(p, 1, total, rf->f);
-    return (n == total) ? 0 : -1;
-}
-static int _rf_file_close(void *private)
+static int _rf_file_stats(void *private, FILE *f)
 {
 	rf_file_t *rf = private;
+	rf_fileio_stats_t st;
 	
-	if(rf->f && rf->f != stdout) fclose(rf->f);
-	if(rf->data) free(rf->data);
-	free(rf);
+	rf_fileio_stats(rf->io, &st);
+	
+	fprintf(f, "File: %.1f MB written, buffers %d/%d (max %d), stalls %llu (%.1f ms)\n",
+		st.bytes / 1e6, st.queued, st.buffers, st.queued_max,
+		(unsigned long long) st.stalls, st.stall_time * 1e3);
+	
+	if(st.pipe_size > 0)
+	{
+		fprintf(f, "Pipe: %zu KiB, %s\n", st.pipe_size / 1024, st.splice ? "vmsplice" : "write");
+	}
+	
+	if(st.segment > 0 || st.segment_waits > 0)
+	{
+		fprintf(f, "Segment: %llu, waited for the next file %llu times\n",
+			(unsigned long long) st.segment,
+			(unsigned long long) st.segment_waits);
+	}
 	
 	return(0);
 }
@@ -392,45 +156,69 @@ static int _rf_udp_write_unmod_uint8(void *private, int16_t *iq_data, int bytes)
 
     const uint8_t *p = (const uint8_t*)iq_data;   // unmodulated raw bytes
     size_t total = (size_t)bytes;
-    size_t off = 0;
-
-    const size_t UDP_PREVIEW_BYTES = 154;  /* Max 2 frames (154 bytes) */
-
-    // (One-time) colored preview without "0x", highlight A9 59
-    if (!u->preview_done) {
-        size_t show = total < UDP_PREVIEW_BYTES ? total : UDP_PREVIEW_BYTES;
-        printf("UDP: Sending %zu unmodulated raw bytes (hex, without 0x):\n", show);
-
-        size_t count = 0;
-        for (size_t k = 0; k < show; ) {
-            if (k + 1 < show && p[k] == 0xA9 && p[k+1] == 0x59) {
-                printf(COLOR_AMBER "%02X" COLOR_RESET " ", p[k]);   count++; if ((count % 16) == 0) printf("\n");
-                printf(COLOR_BLUE  "%02X" COLOR_RESET " ", p[k+1]); count++; if ((count % 16) == 0) printf("\n");
-                k += 2;
-            } else {
-                printf("%02X ", p[k]); count++; if ((count % 16) == 0) printf("\n");
-                k += 1;
-            }
-        }
-        if ((count % 16) != 0) printf("\n");
-        u->preview_done = 1;
+
+    if (rf_debug) rf_debug(RF_UNMOD_UDP, p, total);
+
+    // Chunked into datagrams and sent in batches with sendmmsg().
+    // Failures are counted per datagram and shown by the stats
+    return rf_udp_send(u, p, total);
+}
+
+static int _rf_udp_stats(void *private, FILE *f)
+{
+    rf_udp_t *u = (rf_udp_t*)private;
+
+    // The sender thread, if there is one, counts under the ring lock
+    if (u->ring_depth > 0) pthread_mutex_lock(&u->ring_lock);
+
+    fprintf(f, "UDP: %llu packets", (unsigned long long)u->packets);
+
+    if (u->ndest > 1) {
+        fprintf(f, " to %d destinations", u->ndest);
     }
 
-    // Chunking into UDP packets
-    while (off < total) {
-        size_t chunk = total - off;
-        if (chunk > u->payload) chunk = u->payload;
+    fprintf(f, ", %llu dropped (%.1f KB), %llu failed%s%s, %.1f packets per call",
+        (unsigned long long)u->dropped,
+        u->dropped_bytes / 1e3,
+        (unsigned long long)u->errors,
+        u->errors ? " last: " : "",
+        u->errors ? strerror(u->last_error) : "",
+        u->syscalls ? (double)u->packets / u->syscalls : 0.0);
 
-        ssize_t sent = sendto(u->sock, p + off, chunk, 0,
-                             (struct sockaddr *)&u->addr, u->addrlen);
-        if (sent < 0) {
-            // Error message suppressed to avoid spam when UDP receiver is not available
-            // fprintf(stderr, "UDP sendto() failed: %s\n", strerror(errno));
-            return -1;
-        }
-        off += (size_t)sent;
+    if (u->gso_sends) {
+        fprintf(f, ", %llu segmented sends", (unsigned long long)u->gso_sends);
+    }
+
+    if (u->use_fec) {
+        fprintf(f, ", %llu parity", (unsigned long long)u->fec_packets);
+    }
+
+    fprintf(f, "\n");
+
+    if (u->ring_depth > 0) {
+        fprintf(f, "UDP ring: %d/%d (max %d), queued %llu packets %.1f MB, sent %.1f MB, "
+            "dropped %llu packets %.1f MB when full, %llu waits for room, %llu for the socket\n",
+            u->ring_count, u->ring_depth, u->ring_max,
+            (unsigned long long)u->queued_packets, u->queued_bytes / 1e6,
+            u->sent_bytes_total / 1e6,
+            (unsigned long long)u->ring_dropped_packets, u->ring_dropped_bytes / 1e6,
+            (unsigned long long)u->ring_waits,
+            (unsigned long long)u->socket_waits);
+        u->ring_max = u->ring_count;
+    }
+
+    if (u->ts) {
+        fprintf(f, "UDP TS: %.3f Mbit/s, %d packets per block, %llu data, %llu null, %llu PAT/PMT\n",
+            u->tsm.rate / 1e6, u->tsm.packets,
+            (unsigned long long)u->ts_packets[0],
+            (unsigned long long)u->ts_packets[1],
+            (unsigned long long)u->ts_packets[2]);
     }
 
+    if (u->ring_depth > 0) pthread_mutex_unlock(&u->ring_lock);
+
+    rf_udp_pace_stats(u, f);
+
     return 0;
 }
 
@@ -474,28 +262,64 @@ static int parse_udp_target(const char *spec_in, char *host, size_t host_sz, cha
 
 int rf_file_open(rf_t *s, const char *filename, int type)
 {
-    // --- Special case: UDP sink ------------------------------------------------
-    if (type == RF_UNMOD_UDP) {
-        if (!filename) {
-            fprintf(stderr, "RF_UNMOD_UDP: Target missing (expected e.g. udp://127.0.0.1:5000)\n");
-            return -1;
-        }
+    return rf_file_open_conf(s, filename, type, NULL);
+}
+
+// Targets are one "udp://host:port", or several separated by commas
+int rf_file_open_udp(rf_t *s, const char *filename, const rf_udp_conf_t *conf)
+{
+    if (!filename) {
+        fprintf(stderr, "RF_UNMOD_UDP: Target missing (expected e.g. udp://127.0.0.1:5000)\n");
+        return -1;
+    }
+
+    void *udp_priv = NULL;
+    char target[300];
+    const char *p = filename;
+
+    while (*p) {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+
         char host[256], port[32];
-        if (parse_udp_target(filename, host, sizeof(host), port, sizeof(port)) != 0) {
-            fprintf(stderr, "RF_UNMOD_UDP: Target string invalid: '%s'\n", filename);
+        snprintf(target, sizeof(target), "%.*s", (int)len, p);
+        if (parse_udp_target(target, host, sizeof(host), port, sizeof(port)) != 0) {
+            fprintf(stderr, "RF_UNMOD_UDP: Target string invalid: '%s'\n", target);
+            if (udp_priv) rf_udp_close(udp_priv);
             return -1;
         }
 
-        void *udp_priv = NULL;
-        if (rf_udp_open(&udp_priv, host, port, 1400) != 0) {
+        int r = udp_priv ? rf_udp_add_dest(udp_priv, host, port)
+                         : rf_udp_open_conf(&udp_priv, host, port, conf);
+        if (r != 0) {
             fprintf(stderr, "RF_UNMOD_UDP: Could not open UDP %s:%s.\n", host, port);
+            if (udp_priv) rf_udp_close(udp_priv);
             return -1;
         }
 
-        s->private = udp_priv;
-        s->write   = _rf_udp_write_unmod_uint8;
-        s->close   = rf_udp_close;
-        return 0;
+        p += len;
+        if (*p == ',') p++;
+    }
+
+    if (!udp_priv) {
+        fprintf(stderr, "RF_UNMOD_UDP: Target missing (expected e.g. udp://127.0.0.1:5000)\n");
+        return -1;
+    }
+
+    s->private = udp_priv;
+    s->write   = _rf_udp_write_unmod_uint8;
+    s->close   = rf_udp_close;
+    s->stats   = _rf_udp_stats;
+    s->reserve = NULL;
+    s->commit  = NULL;
+    return 0;
+}
+
+int rf_file_open_conf(rf_t *s, const char *filename, int type, const rf_fileio_conf_t *conf)
+{
+    // --- Special case: UDP sink ------------------------------------------------
+    if (type == RF_UNMOD_UDP) {
+        return rf_file_open_udp(s, filename, NULL);
     }
 
     // --- File sink for all other types ------------------------------------
@@ -510,68 +334,44 @@ int rf_file_open(rf_t *s, const char *filename, int type)
         fprintf(stderr, "No output filename provided.\n");
         _rf_file_close(rf);
         return -1;
-    } else if (strcmp(filename, "-") == 0) {
-        rf->f = stdout;
-    } else {
-        rf->f = fopen(filename, "wb");
-        if (!rf->f) {
-            perror("fopen");
-            _rf_file_close(rf);
-            return -1;
-        }
     }
 
-    // Data type base size (per sample value, without complex)
-    switch (type)
-    {
-    case RF_UINT8:        rf->data_size = sizeof(uint8_t);  break;
-    case RF_INT8:         rf->data_size = sizeof(int8_t);   break;
-    case RF_UINT16:       rf->data_size = sizeof(uint16_t); break;
-    case RF_INT16:        rf->data_size = sizeof(int16_t);  break;
-    case RF_INT32:        rf->data_size = sizeof(int32_t);  break;
-    case RF_FLOAT:        rf->data_size = sizeof(float);    break;
-    case RF_UNMOD_UINT8:  rf->data_size = sizeof(uint8_t);  break;
-    default:
-        fprintf(stderr, "%s: Unrecognised data type %d\n", __func__, type);
+    // Buffered writer thread, "-" writes to stdout
+    rf->io = rf_fileio_open(filename, conf);
+    if (!rf->io) {
         _rf_file_close(rf);
         return -1;
     }
 
-    // Only double for complex IQ formats (I+Q). NOT for unmodulated raw bytes.
-    if (rf->type != RF_UNMOD_UINT8 /* && rf->type != RF_UNMOD_UDP (not in file path) */)
-        rf->data_size *= 2;
-
-    rf->samples = 1024;
+    // Bytes per complex sample, or per byte for unmodulated raw bytes
+    if (type == RF_UNMOD_UINT8) {
+        rf->data_size = sizeof(uint8_t);
+    } else {
+        rf->convert = rf_convert_get(type);
+        rf->data_size = rf_convert_size(type);
+    }
 
-    // Buffer only for types that don't write directly from input
-    if (rf->type != RF_INT16) {
-        rf->data = malloc(rf->data_size * rf->samples);
-        if (!rf->data) {
-            perror("malloc");
-            _rf_file_close(rf);
-            return -1;
-        }
+    if (rf->data_size == 0) {
+        fprintf(stderr, "%s: Unrecognised data type %d\n", __func__, type);
+        _rf_file_close(rf);
+        return -1;
     }
 
     // Register callback
     s->private = rf;
     s->close   = _rf_file_close;
-
-    switch (type)
-    {
-    case RF_UINT8:        s->write = _rf_file_write_uint8;       break;
-    case RF_INT8:         s->write = _rf_file_write_int8;        break;
-    case RF_UINT16:       s->write = _rf_file_write_uint16;      break;
-    case RF_INT16:        s->write = _rf_file_write_int16;       break;
-    case RF_INT32:        s->write = _rf_file_write_int32;       break;
-    case RF_FLOAT:        s->write = _rf_file_write_float;       break;
-    case RF_UNMOD_UINT8:  s->write = _rf_file_write_unmod_uint8; break;
-    default:
-        fprintf(stderr, "rf_file_open: Unrecognised data type %d\n", rf->type);
-        _rf_file_close(rf);
-        return -1;
+    s->stats   = _rf_file_stats;
+    s->reserve = NULL;
+    s->commit  = NULL;
+
+    // Raw int16 can be rendered straight into the output
+    if (type == RF_INT16) {
+        s->reserve = _rf_file_reserve_int16;
+        s->commit  = _rf_file_commit_int16;
     }
 
+    s->write   = (type == RF_UNMOD_UINT8) ? _rf_file_write_unmod_uint8 : _rf_file_write;
+
     return 0;
 }
 
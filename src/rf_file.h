@@ -18,7 +18,11 @@
 #ifndef _RF_FILE_H
 #define _RF_FILE_H
 
+#include "rf_fileio.h"
+
 extern int rf_file_open(rf_t *s, const char *filename, int type);
+extern int rf_file_open_conf(rf_t *s, const char *filename, int type, const rf_fileio_conf_t *conf);
+extern int rf_file_open_udp(rf_t *s, const char *target, const rf_udp_conf_t *conf);
 
 #endif
 
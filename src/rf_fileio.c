@@ -0,0 +1,1493 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef HAVE_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#include "rf_fileio.h"
+
+#define RF_FILEIO_BUFFERS     16
+#define RF_FILEIO_BUFFER_SIZE (4 * 1024 * 1024)
+#define RF_FILEIO_PIPE_SIZE   (1024 * 1024)
+
+#ifdef HAVE_IO_URING
+typedef struct {
+	
+	int fd;
+	
+	/* Submission and completion rings, mapped from the kernel */
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_len;
+	size_t cq_len;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	
+	/* Registered buffers and file, if the kernel accepted them */
+	int fixed_buffers;
+	int fixed_file;
+	
+	/* Writes in flight, and the most allowed at once. The last pending
+	 * of them are queued but not yet taken by the kernel */
+	int inflight;
+	int depth;
+	unsigned pending;
+	
+	/* Buffers issued to the ring, and the file offset of the next one */
+	long issued;
+	uint64_t offset;
+	int seekable;
+	
+	/* Per buffer: file offset, bytes written so far and completion */
+	uint64_t *off;
+	size_t *done;
+	uint8_t *complete;
+	
+} _rf_fileio_uring_t;
+#endif
+
+struct _rf_fileio_t {
+	
+	int fd;
+	int close_fd;
+	int direct;
+	
+	/* Buffer pool. Buffers are filled and written in turn,
+	 * head counts those passed to the writer, tail those written */
+	uint8_t **buf;
+	size_t *len;
+	int nbuf;
+	size_t size;
+	long head;
+	long tail;
+	size_t fill;
+	
+	/* Writer backend: queue buffer b, or wait for
+	 * buffers to be written if wait is set */
+	void (*queue)(rf_fileio_t *s, int b);
+	void (*reap)(rf_fileio_t *s, int wait);
+	
+	/* Writer thread */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int running;
+	int closing;
+	int error;
+	
+#ifdef HAVE_IO_URING
+	_rf_fileio_uring_t *uring;
+#endif
+	
+	/* mmap backend: the current window, where it sits in the file,
+	 * the write position and how far the file has been allocated */
+	int mapped;
+	uint8_t *map;
+	uint64_t map_off;
+	size_t map_len;
+	size_t window;
+	uint64_t pos;
+	uint64_t allocated;
+	uint64_t synced;
+	
+	/* Segments: the output name, segment size and retention, the
+	 * index and fill of the current file, the next one opened ahead
+	 * and the last one waiting to be closed */
+	char *filename;
+	uint64_t segment;
+	int keep;
+	int want_direct;
+	rf_fileio_segment_t segment_done;
+	void *arg;
+	uint64_t seg_index;
+	uint64_t seg_pos;
+	int next_fd;
+	int next_direct;
+	int done_fd;
+	uint64_t done_index;
+	pthread_t seg_thread;
+	pthread_cond_t seg_cond;
+	int seg_running;
+	int seg_closing;
+	int seg_failed;
+	
+	/* Pipe output: buffers written so far, and whether they are gifted
+	 * to the pipe by vmsplice. A gifted buffer is only free again once
+	 * the reader has taken it, so the stream offset where each one ends
+	 * is kept to compare with what is still in the pipe */
+	int pipe;
+	int splice;
+	size_t pipe_size;
+	long written;
+	uint64_t *pipe_end;
+	
+	/* Counters */
+	uint64_t bytes;
+	int queued_max;
+	uint64_t stalls;
+	double stall_time;
+	uint64_t segment_waits;
+};
+
+static double _now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return(ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+static void _clear_direct(rf_fileio_t *s, size_t len)
+{
+	/* O_DIRECT needs whole blocks. Only the last buffer can be
+	 * short, so finish the file through the page cache */
+	if(s->direct && (len & (RF_FILEIO_ALIGN - 1)) != 0)
+	{
+		fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) & ~O_DIRECT);
+		s->direct = 0;
+	}
+}
+
+static int _write_all(rf_fileio_t *s, const uint8_t *data, size_t len)
+{
+	ssize_t r;
+	
+	_clear_direct(s, len);
+	
+	while(len > 0)
+	{
+		r = write(s->fd, data, len);
+		
+		if(r < 0)
+		{
+			if(errno == EINTR) continue;
+			return(-1);
+		}
+		
+		data += r;
+		len -= r;
+	}
+	
+	return(0);
+}
+
+static int _open_fd(const char *filename, int flags, int *direct)
+{
+	int fd = -1;
+	
+	if(*direct)
+	{
+		fd = open(filename, flags | O_DIRECT, 0644);
+		if(fd < 0 && errno == EINVAL)
+		{
+			fprintf(stderr, "Warning: O_DIRECT is not supported for '%s'\n", filename);
+			*direct = 0;
+		}
+	}
+	
+	if(fd < 0)
+	{
+		fd = open(filename, flags, 0644);
+	}
+	
+	if(fd < 0)
+	{
+		perror(filename);
+	}
+	
+	return(fd);
+}
+
+/* Segmented output. The writer thread only swaps file descriptors,
+ * everything that can block is done on the segment thread */
+
+void rf_fileio_segment_name(char *dst, size_t len, const char *filename, uint64_t index)
+{
+	const char *ext = strrchr(filename, '.');
+	
+	/* The number goes before the extension, if there is one */
+	if(!ext || strchr(ext, '/'))
+	{
+		ext = filename + strlen(filename);
+	}
+	
+	snprintf(dst, len, "%.*s-%06llu%s", (int) (ext - filename), filename, (unsigned long long) index, ext);
+}
+
+static int _segment_open(rf_fileio_t *s, uint64_t index, int *direct)
+{
+	char name[4096];
+	int fd;
+	
+	rf_fileio_segment_name(name, sizeof(name), s->filename, index);
+	
+	*direct = s->want_direct;
+	fd = _open_fd(name, O_WRONLY | O_CREAT | O_TRUNC, direct);
+	
+	/* Allocate the whole file now rather than as it is written */
+	if(fd >= 0)
+	{
+		fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, s->segment);
+	}
+	
+	return(fd);
+}
+
+static void _segment_finish(rf_fileio_t *s, int fd, uint64_t index, uint64_t bytes)
+{
+	char name[4096];
+	
+	/* Release what was allocated past a short last segment */
+	if(bytes < s->segment && ftruncate(fd, bytes) != 0)
+	{
+		perror("ftruncate");
+	}
+	
+	close(fd);
+	
+	rf_fileio_segment_name(name, sizeof(name), s->filename, index);
+	
+	if(s->segment_done)
+	{
+		s->segment_done(s->arg, name, index, bytes);
+	}
+	
+	if(s->keep > 0 && index >= s->keep)
+	{
+		rf_fileio_segment_name(name, sizeof(name), s->filename, index - s->keep);
+		
+		if(unlink(name) != 0 && errno != ENOENT)
+		{
+			perror(name);
+		}
+	}
+}
+
+static void *_rf_fileio_segment_thread(void *arg)
+{
+	rf_fileio_t *s = arg;
+	uint64_t index;
+	int fd, direct;
+	
+	pthread_mutex_lock(&s->mutex);
+	
+	while(1)
+	{
+		if(s->done_fd >= 0)
+		{
+			/* Close the finished segment */
+			fd = s->done_fd;
+			index = s->done_index;
+			s->done_fd = -1;
+			
+			pthread_mutex_unlock(&s->mutex);
+			_segment_finish(s, fd, index, s->segment);
+			pthread_mutex_lock(&s->mutex);
+		}
+		else if(s->next_fd < 0 && !s->seg_failed && !s->seg_closing)
+		{
+			/* Open the one after the current segment */
+			index = s->seg_index + 1;
+			
+			pthread_mutex_unlock(&s->mutex);
+			fd = _segment_open(s, index, &direct);
+			pthread_mutex_lock(&s->mutex);
+			
+			if(fd < 0)
+			{
+				s->seg_failed = 1;
+				if(s->error == 0) s->error = errno;
+			}
+			
+			s->next_fd = fd;
+			s->next_direct = direct;
+			pthread_cond_broadcast(&s->seg_cond);
+		}
+		else if(s->seg_closing)
+		{
+			break;
+		}
+		else
+		{
+			pthread_cond_wait(&s->seg_cond, &s->mutex);
+		}
+	}
+	
+	pthread_mutex_unlock(&s->mutex);
+	
+	return(NULL);
+}
+
+static int _segment_next(rf_fileio_t *s)
+{
+	pthread_mutex_lock(&s->mutex);
+	
+	/* The next file should be open already */
+	if(s->next_fd < 0 && !s->seg_failed)
+	{
+		s->segment_waits++;
+		
+		while(s->next_fd < 0 && !s->seg_failed)
+		{
+			pthread_cond_wait(&s->seg_cond, &s->mutex);
+		}
+	}
+	
+	if(s->next_fd < 0)
+	{
+		pthread_mutex_unlock(&s->mutex);
+		return(-1);
+	}
+	
+	s->done_fd = s->fd;
+	s->done_index = s->seg_index;
+	s->fd = s->next_fd;
+	s->direct = s->next_direct;
+	s->next_fd = -1;
+	s->seg_index++;
+	s->seg_pos = 0;
+	
+	pthread_cond_broadcast(&s->seg_cond);
+	pthread_mutex_unlock(&s->mutex);
+	
+	return(0);
+}
+
+static int _write_segmented(rf_fileio_t *s, const uint8_t *data, size_t len)
+{
+	size_t n;
+	
+	if(s->segment == 0)
+	{
+		return(_write_all(s, data, len));
+	}
+	
+	while(len > 0)
+	{
+		/* Move on once the current file is full */
+		if(s->seg_pos == s->segment && _segment_next(s) != 0)
+		{
+			return(-1);
+		}
+		
+		n = s->segment - s->seg_pos;
+		if(n > len) n = len;
+		
+		if(_write_all(s, data, n) != 0)
+		{
+			return(-1);
+		}
+		
+		data += n;
+		len -= n;
+		s->seg_pos += n;
+	}
+	
+	return(0);
+}
+
+static int _segment_start(rf_fileio_t *s)
+{
+	if(pthread_create(&s->seg_thread, NULL, _rf_fileio_segment_thread, s) != 0)
+	{
+		perror("pthread_create");
+		return(-1);
+	}
+	
+	s->seg_running = 1;
+	
+	return(0);
+}
+
+static void _segment_stop(rf_fileio_t *s)
+{
+	char name[4096];
+	
+	if(s->seg_running)
+	{
+		pthread_mutex_lock(&s->mutex);
+		s->seg_closing = 1;
+		pthread_cond_broadcast(&s->seg_cond);
+		pthread_mutex_unlock(&s->mutex);
+		
+		pthread_join(s->seg_thread, NULL);
+		s->seg_running = 0;
+	}
+	
+	/* The next file was never used */
+	if(s->next_fd >= 0)
+	{
+		close(s->next_fd);
+		s->next_fd = -1;
+		
+		rf_fileio_segment_name(name, sizeof(name), s->filename, s->seg_index + 1);
+		unlink(name);
+	}
+	
+	if(s->fd >= 0)
+	{
+		_segment_finish(s, s->fd, s->seg_index, s->seg_pos);
+		s->fd = -1;
+	}
+}
+
+/* Pipe output */
+static void _pipe_start(rf_fileio_t *s, const rf_fileio_conf_t *conf)
+{
+	struct stat st;
+	size_t size;
+	int n;
+	
+	if(fstat(s->fd, &st) != 0 || !S_ISFIFO(st.st_mode))
+	{
+		return;
+	}
+	
+	s->pipe = 1;
+	
+	/* The default 64 KiB pipe holds less than a buffer */
+	size = conf && conf->pipe_size > 0 ? conf->pipe_size : RF_FILEIO_PIPE_SIZE;
+	
+	if(fcntl(s->fd, F_SETPIPE_SZ, (int) size) < 0)
+	{
+		fprintf(stderr, "Warning: Can't set the pipe size to %zu bytes (%s)\n", size, strerror(errno));
+	}
+	
+	n = fcntl(s->fd, F_GETPIPE_SZ);
+	s->pipe_size = n > 0 ? n : 0;
+	
+	/* Gifting needs to know how much the reader has taken */
+	if(conf && conf->splice && ioctl(s->fd, FIONREAD, &n) == 0)
+	{
+		s->pipe_end = calloc(s->nbuf, sizeof(uint64_t));
+		s->splice = s->pipe_end ? 1 : 0;
+	}
+}
+
+static int _write_pipe(rf_fileio_t *s, const uint8_t *data, size_t len)
+{
+	struct iovec iov;
+	ssize_t r;
+	
+	while(len > 0 && s->splice)
+	{
+		iov.iov_base = (void *) data;
+		iov.iov_len = len;
+		
+		r = vmsplice(s->fd, &iov, 1, SPLICE_F_GIFT);
+		
+		if(r < 0)
+		{
+			if(errno == EINTR) continue;
+			if(errno != EINVAL && errno != ENOSYS) return(-1);
+			
+			/* Not supported here, copy from now on */
+			s->splice = 0;
+			break;
+		}
+		
+		data += r;
+		len -= r;
+	}
+	
+	return(_write_all(s, data, len));
+}
+
+static void _pipe_release(rf_fileio_t *s)
+{
+	struct pollfd p = { s->fd, 0, 0 };
+	uint64_t taken;
+	int n;
+	
+	/* Copied buffers are free at once, as are gifted ones if the reader has gone */
+	if(!s->pipe_end || (poll(&p, 1, 0) == 1 && (p.revents & POLLERR)))
+	{
+		s->tail = s->written;
+		return;
+	}
+	
+	/* Everything before what is still in the pipe has been read */
+	if(ioctl(s->fd, FIONREAD, &n) != 0) n = 0;
+	taken = s->bytes - n;
+	
+	while(s->tail < s->written && s->pipe_end[s->tail % s->nbuf] <= taken)
+	{
+		s->tail++;
+	}
+}
+
+static void _pipe_wait(rf_fileio_t *s)
+{
+	struct timespec ts;
+	long tail = s->tail;
+	
+	/* Poll every millisecond until the reader catches up,
+	 * or another buffer arrives to be written */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += 1000000;
+	if(ts.tv_nsec >= 1000000000)
+	{
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	
+	pthread_cond_timedwait(&s->cond, &s->mutex, &ts);
+	_pipe_release(s);
+	
+	if(s->tail != tail)
+	{
+		pthread_cond_broadcast(&s->cond);
+	}
+}
+
+/* Thread backend */
+static void *_rf_fileio_thread(void *arg)
+{
+	rf_fileio_t *s = arg;
+	int b, r;
+	
+	pthread_mutex_lock(&s->mutex);
+	
+	while(1)
+	{
+		if(s->written == s->head)
+		{
+			if(s->tail < s->written)
+			{
+				/* Gifted buffers are still in the pipe, and
+				 * can't be freed until the reader has them */
+				_pipe_wait(s);
+				continue;
+			}
+			
+			if(s->closing) break;
+			
+			pthread_cond_wait(&s->cond, &s->mutex);
+			continue;
+		}
+		
+		b = s->written % s->nbuf;
+		pthread_mutex_unlock(&s->mutex);
+		
+		if(s->pipe) r = _write_pipe(s, s->buf[b], s->len[b]);
+		else r = _write_segmented(s, s->buf[b], s->len[b]);
+		
+		pthread_mutex_lock(&s->mutex);
+		
+		if(r != 0 && s->error == 0)
+		{
+			s->error = errno;
+			perror("write");
+		}
+		
+		s->bytes += s->len[b];
+		s->written++;
+		
+		if(s->pipe_end)
+		{
+			s->pipe_end[b] = s->bytes;
+		}
+		
+		_pipe_release(s);
+		pthread_cond_broadcast(&s->cond);
+	}
+	
+	pthread_mutex_unlock(&s->mutex);
+	
+	return(NULL);
+}
+
+static void _thread_queue(rf_fileio_t *s, int b)
+{
+	pthread_cond_broadcast(&s->cond);
+}
+
+static void _thread_reap(rf_fileio_t *s, int wait)
+{
+	if(wait)
+	{
+		pthread_cond_wait(&s->cond, &s->mutex);
+	}
+}
+
+static int _thread_start(rf_fileio_t *s)
+{
+	if(pthread_create(&s->thread, NULL, _rf_fileio_thread, s) != 0)
+	{
+		perror("pthread_create");
+		return(-1);
+	}
+	
+	s->queue = _thread_queue;
+	s->reap = _thread_reap;
+	s->running = 1;
+	
+	return(0);
+}
+
+static void _thread_stop(rf_fileio_t *s)
+{
+	pthread_mutex_lock(&s->mutex);
+	s->closing = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->mutex);
+	
+	pthread_join(s->thread, NULL);
+}
+
+#ifdef HAVE_IO_URING
+/* io_uring backend. The ring is driven from the encoder's thread: full
+ * buffers are submitted straight away and completions are collected
+ * without blocking, unless every buffer is still in flight */
+
+static int _io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int _io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0));
+}
+
+static int _io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+/* Hand the kernel the SQEs it hasn't taken, and with wait block for a
+ * completion. Short of resources, or with completions to reap first,
+ * they stay queued for the next call. Any other failure is an error,
+ * and what the kernel never took is failed so nothing waits on it */
+static void _uring_enter(rf_fileio_t *s, int wait)
+{
+	_rf_fileio_uring_t *u = s->uring;
+	unsigned tail;
+	int r, b;
+	
+	do
+	{
+		r = _io_uring_enter(u->fd, u->pending, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+	}
+	while(r < 0 && errno == EINTR);
+	
+	if(r >= 0)
+	{
+		u->pending -= r;
+		return;
+	}
+	
+	if(errno == EAGAIN || errno == EBUSY)
+	{
+		/* Don't spin while whatever it's short of frees up */
+		if(wait) usleep(1000);
+		return;
+	}
+	
+	if(s->error == 0)
+	{
+		s->error = errno;
+		fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+	}
+	
+	tail = *u->sq_tail;
+	
+	for(; u->pending > 0; u->pending--, u->inflight--)
+	{
+		tail--;
+		b = u->sqes[u->sq_array[tail & *u->sq_mask]].user_data;
+		u->complete[b] = 1;
+	}
+	
+	__atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+}
+
+static void _uring_submit(rf_fileio_t *s, int b)
+{
+	_rf_fileio_uring_t *u = s->uring;
+	struct io_uring_sqe *sqe;
+	unsigned tail, i;
+	
+	tail = *u->sq_tail;
+	i = tail & *u->sq_mask;
+	sqe = &u->sqes[i];
+	
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = u->fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	sqe->fd = u->fixed_file ? 0 : s->fd;
+	sqe->flags = u->fixed_file ? IOSQE_FIXED_FILE : 0;
+	sqe->addr = (uintptr_t) (s->buf[b] + u->done[b]);
+	sqe->len = s->len[b] - u->done[b];
+	sqe->off = u->seekable ? u->off[b] + u->done[b] : (uint64_t) -1;
+	sqe->buf_index = b;
+	sqe->user_data = b;
+	
+	u->sq_array[i] = i;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	
+	u->inflight++;
+	u->pending++;
+	_uring_enter(s, 0);
+}
+
+static void _uring_issue(rf_fileio_t *s)
+{
+	_rf_fileio_uring_t *u = s->uring;
+	int b;
+	
+	while(u->issued < s->head && u->inflight < u->depth)
+	{
+		b = u->issued % s->nbuf;
+		
+		/* A short final buffer under O_DIRECT has to
+		 * wait until everything before it is written */
+		if(s->direct && (s->len[b] & (RF_FILEIO_ALIGN - 1)) != 0)
+		{
+			if(u->inflight > 0) break;
+			_clear_direct(s, s->len[b]);
+		}
+		
+		u->off[b] = u->offset;
+		u->offset += s->len[b];
+		u->done[b] = 0;
+		u->complete[b] = 0;
+		u->issued++;
+		
+		_uring_submit(s, b);
+	}
+}
+
+static void _uring_queue(rf_fileio_t *s, int b)
+{
+	_uring_issue(s);
+	s->reap(s, 0);
+}
+
+static void _uring_reap(rf_fileio_t *s, int wait)
+{
+	_rf_fileio_uring_t *u = s->uring;
+	struct io_uring_cqe *cqe;
+	unsigned head;
+	int b;
+	
+	if(wait && u->inflight > 0)
+	{
+		/* Called with the mutex held, as for the thread backend */
+		pthread_mutex_unlock(&s->mutex);
+		_uring_enter(s, 1);
+		pthread_mutex_lock(&s->mutex);
+	}
+	
+	head = *u->cq_head;
+	
+	while(head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+	{
+		cqe = &u->cqes[head & *u->cq_mask];
+		b = cqe->user_data;
+		u->inflight--;
+		
+		if(cqe->res < 0 && (cqe->res == -EINTR || cqe->res == -EAGAIN))
+		{
+			/* Try again */
+			_uring_submit(s, b);
+		}
+		else if(cqe->res < 0)
+		{
+			if(s->error == 0)
+			{
+				s->error = -cqe->res;
+				fprintf(stderr, "io_uring write: %s\n", strerror(-cqe->res));
+			}
+			
+			u->complete[b] = 1;
+		}
+		else
+		{
+			u->done[b] += cqe->res;
+			
+			/* Short writes are resubmitted for the remainder */
+			if(u->done[b] < s->len[b] && cqe->res > 0) _uring_submit(s, b);
+			else u->complete[b] = 1;
+		}
+		
+		head++;
+	}
+	
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	
+	/* Buffers are reused in order, so only retire them in order */
+	while(s->tail < u->issued && u->complete[s->tail % s->nbuf])
+	{
+		b = s->tail % s->nbuf;
+		u->complete[b] = 0;
+		s->bytes += s->len[b];
+		s->tail++;
+	}
+	
+	_uring_issue(s);
+}
+
+static void _uring_free(rf_fileio_t *s)
+{
+	_rf_fileio_uring_t *u = s->uring;
+	
+	if(!u) return;
+	
+	if(u->sqes) munmap(u->sqes, u->sqes_len);
+	if(u->cq_ptr && u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_len);
+	if(u->sq_ptr) munmap(u->sq_ptr, u->sq_len);
+	if(u->fd >= 0) close(u->fd);
+	
+	free(u->off);
+	free(u->done);
+	free(u->complete);
+	free(u);
+	
+	s->uring = NULL;
+}
+
+static int _uring_start(rf_fileio_t *s)
+{
+	_rf_fileio_uring_t *u;
+	struct io_uring_params p;
+	struct iovec *iov;
+	off_t o;
+	int i;
+	
+	u = calloc(1, sizeof(_rf_fileio_uring_t));
+	if(!u) return(-1);
+	
+	s->uring = u;
+	
+	u->off = calloc(s->nbuf, sizeof(uint64_t));
+	u->done = calloc(s->nbuf, sizeof(size_t));
+	u->complete = calloc(s->nbuf, 1);
+	if(!u->off || !u->done || !u->complete)
+	{
+		_uring_free(s);
+		return(-1);
+	}
+	
+	memset(&p, 0, sizeof(p));
+	u->fd = _io_uring_setup(s->nbuf, &p);
+	if(u->fd < 0)
+	{
+		_uring_free(s);
+		return(-1);
+	}
+	
+	/* Map the rings */
+	u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(u->cq_len > u->sq_len) u->sq_len = u->cq_len;
+		u->cq_len = u->sq_len;
+	}
+	
+	u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if(u->sq_ptr == MAP_FAILED)
+	{
+		u->sq_ptr = NULL;
+		_uring_free(s);
+		return(-1);
+	}
+	
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		u->cq_ptr = u->sq_ptr;
+	}
+	else
+	{
+		u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if(u->cq_ptr == MAP_FAILED)
+		{
+			u->cq_ptr = NULL;
+			_uring_free(s);
+			return(-1);
+		}
+	}
+	
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if(u->sqes == MAP_FAILED)
+	{
+		u->sqes = NULL;
+		_uring_free(s);
+		return(-1);
+	}
+	
+	u->sq_head = (unsigned *) ((uint8_t *) u->sq_ptr + p.sq_off.head);
+	u->sq_tail = (unsigned *) ((uint8_t *) u->sq_ptr + p.sq_off.tail);
+	u->sq_mask = (unsigned *) ((uint8_t *) u->sq_ptr + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *) ((uint8_t *) u->sq_ptr + p.sq_off.array);
+	u->cq_head = (unsigned *) ((uint8_t *) u->cq_ptr + p.cq_off.head);
+	u->cq_tail = (unsigned *) ((uint8_t *) u->cq_ptr + p.cq_off.tail);
+	u->cq_mask = (unsigned *) ((uint8_t *) u->cq_ptr + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *) ((uint8_t *) u->cq_ptr + p.cq_off.cqes);
+	
+	/* Register the pool and the file. Either may be refused,
+	 * for example over the locked memory limit, which only
+	 * costs the kernel some extra work per write */
+	iov = calloc(s->nbuf, sizeof(struct iovec));
+	if(iov)
+	{
+		for(i = 0; i < s->nbuf; i++)
+		{
+			iov[i].iov_base = s->buf[i];
+			iov[i].iov_len = s->size;
+		}
+		
+		u->fixed_buffers = _io_uring_register(u->fd, IORING_REGISTER_BUFFERS, iov, s->nbuf) == 0;
+		free(iov);
+	}
+	
+	u->fixed_file = _io_uring_register(u->fd, IORING_REGISTER_FILES, &s->fd, 1) == 0;
+	
+	/* Writes to a pipe must stay in order, so only one at a time */
+	o = lseek(s->fd, 0, SEEK_CUR);
+	u->seekable = o >= 0;
+	u->offset = u->seekable ? o : 0;
+	u->depth = u->seekable ? s->nbuf : 1;
+	
+	s->queue = _uring_queue;
+	s->reap = _uring_reap;
+	
+	return(0);
+}
+
+static void _uring_stop(rf_fileio_t *s)
+{
+	pthread_mutex_lock(&s->mutex);
+	
+	while(s->tail < s->head)
+	{
+		s->reap(s, 1);
+	}
+	
+	pthread_mutex_unlock(&s->mutex);
+	
+	_uring_free(s);
+}
+#endif
+
+/* mmap backend. Output is written straight into a shared mapping of
+ * the file, one large window at a time. The file is allocated ahead of
+ * the window, and writeback of each finished part is started at once
+ * so dirty pages don't build up */
+
+static int _map_allocate(rf_fileio_t *s, uint64_t end)
+{
+	if(end <= s->allocated) return(0);
+	
+	if(fallocate(s->fd, 0, s->allocated, end - s->allocated) != 0)
+	{
+		/* Not every filesystem can, extend the file instead */
+		if(errno != EOPNOTSUPP || ftruncate(s->fd, end) != 0)
+		{
+			return(-1);
+		}
+	}
+	
+	s->allocated = end;
+	
+	return(0);
+}
+
+static int _map_window(rf_fileio_t *s)
+{
+	const uint64_t page = sysconf(_SC_PAGESIZE);
+	
+	if(s->map)
+	{
+		munmap(s->map, s->map_len);
+		s->map = NULL;
+	}
+	
+	/* The new window starts at the page holding the write position */
+	s->map_off = s->pos & ~(page - 1);
+	s->map_len = s->window;
+	
+	if(_map_allocate(s, s->map_off + s->map_len) != 0)
+	{
+		s->error = errno;
+		perror("fallocate");
+		return(-1);
+	}
+	
+	s->map = mmap(NULL, s->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, s->map_off);
+	if(s->map == MAP_FAILED)
+	{
+		s->map = NULL;
+		s->error = errno;
+		perror("mmap");
+		return(-1);
+	}
+	
+	madvise(s->map, s->map_len, MADV_SEQUENTIAL);
+	
+	return(0);
+}
+
+static int _map_start(rf_fileio_t *s, uint64_t preallocate)
+{
+	struct stat st;
+	
+	/* Only regular files can be mapped, anything else falls back */
+	if(fstat(s->fd, &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		return(1);
+	}
+	
+	/* Whole buffers worth of pages in each window */
+	s->window = s->size * s->nbuf;
+	s->mapped = 1;
+	
+	if(preallocate > 0 && _map_allocate(s, preallocate) != 0)
+	{
+		perror("fallocate");
+		return(-1);
+	}
+
+	
+	return(0);
+}
+
+static void _map_commit(rf_fileio_t *s, size_t len)
+{
+	s->pos += len;
+	s->bytes = s->pos;
+	
+	/* Start writeback of each finished buffer's worth, without waiting */
+	if(s->pos - s->synced >= s->size)
+	{
+		sync_file_range(s->fd, s->synced, s->pos - s->synced, SYNC_FILE_RANGE_WRITE);
+		s->synced = s->pos;
+	}
+}
+
+static int _map_stop(rf_fileio_t *s)
+{
+	if(s->map)
+	{
+		munmap(s->map, s->map_len);
+		s->map = NULL;
+	}
+	
+	/* Trim whatever was allocated past the end */
+	if(ftruncate(s->fd, s->pos) != 0)
+	{
+		perror("ftruncate");
+		return(-1);
+	}
+	
+	return(0);
+}
+
+static void _submit(rf_fileio_t *s)
+{
+	double t;
+	
+	pthread_mutex_lock(&s->mutex);
+	
+	s->len[s->head % s->nbuf] = s->fill;
+	s->head++;
+	s->fill = 0;
+	
+	if(s->head - s->tail > s->queued_max)
+	{
+		s->queued_max = s->head - s->tail;
+	}
+	
+	s->queue(s, (s->head - 1) % s->nbuf);
+	
+	/* The next buffer is still being written. This is
+	 * the stall the pool is there to prevent */
+	if(s->head - s->tail == s->nbuf)
+	{
+		t = _now();
+		
+		while(s->head - s->tail == s->nbuf)
+		{
+			s->reap(s, 1);
+		}
+		
+		s->stalls++;
+		s->stall_time += _now() - t;
+	}
+	
+	pthread_mutex_unlock(&s->mutex);
+}
+
+void *rf_fileio_reserve(rf_fileio_t *s, size_t *len)
+{
+	size_t n;
+	
+	if(s->mapped)
+	{
+		if(!s->map || s->pos + *len > s->map_off + s->map_len)
+		{
+			if(_map_window(s) != 0)
+			{
+				*len = 0;
+				return(NULL);
+			}
+		}
+		
+		n = s->map_off + s->map_len - s->pos;
+		if(*len > n) *len = n;
+		
+		return(s->map + (s->pos - s->map_off));
+	}
+	
+	/* The rest of the current buffer */
+	n = s->size - s->fill;
+	if(*len > n) *len = n;
+	
+	return(s->buf[s->head % s->nbuf] + s->fill);
+}
+
+int rf_fileio_commit(rf_fileio_t *s, size_t len)
+{
+	if(s->mapped)
+	{
+		_map_commit(s, len);
+	}
+	else
+	{
+		s->fill += len;
+		
+		if(s->fill == s->size)
+		{
+			_submit(s);
+		}
+	}
+	
+	if(s->error)
+	{
+		errno = s->error;
+		return(-1);
+	}
+	
+	return(0);
+}
+
+int rf_fileio_write(rf_fileio_t *s, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint8_t *dst;
+	size_t n;
+	
+	while(len > 0)
+	{
+		n = len;
+		dst = rf_fileio_reserve(s, &n);
+		if(!dst) return(-1);
+		
+		memcpy(dst, p, n);
+		p += n;
+		len -= n;
+		
+		if(rf_fileio_commit(s, n) != 0)
+		{
+			return(-1);
+		}
+	}
+	
+	return(0);
+}
+
+void rf_fileio_stats(rf_fileio_t *s, rf_fileio_stats_t *stats)
+{
+	pthread_mutex_lock(&s->mutex);
+	
+	stats->bytes = s->bytes;
+	stats->buffers = s->nbuf;
+	stats->queued = s->head - s->tail;
+	stats->queued_max = s->queued_max;
+	stats->stalls = s->stalls;
+	stats->stall_time = s->stall_time;
+	stats->segment = s->seg_index;
+	stats->segment_waits = s->segment_waits;
+	stats->pipe_size = s->pipe_size;
+	stats->splice = s->splice;
+	
+	s->queued_max = s->head - s->tail;
+	
+	pthread_mutex_unlock(&s->mutex);
+}
+
+static void _free(rf_fileio_t *s)
+{
+	int i;
+	
+	for(i = 0; s->buf && i < s->nbuf; i++)
+	{
+		free(s->buf[i]);
+	}
+	
+	free(s->buf);
+	free(s->len);
+	free(s->filename);
+	free(s->pipe_end);
+	
+	if(s->close_fd && s->fd >= 0) close(s->fd);
+	
+	pthread_cond_destroy(&s->seg_cond);
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->mutex);
+	
+	free(s);
+}
+
+int rf_fileio_close(rf_fileio_t *s)
+{
+	int r;
+	
+	if(!s) return(0);
+	
+	if(s->mapped && _map_stop(s) != 0)
+	{
+		s->error = errno;
+	}
+	
+	if(s->running)
+	{
+		/* Write out what is left and wait for the writer to finish */
+		if(s->fill > 0)
+		{
+			_submit(s);
+		}
+		
+#ifdef HAVE_IO_URING
+		if(s->uring) _uring_stop(s);
+		else
+#endif
+		_thread_stop(s);
+	}
+	
+	if(s->segment)
+	{
+		_segment_stop(s);
+	}
+	
+	r = s->error ? -1 : 0;
+	
+	if(s->close_fd && s->fd >= 0 && close(s->fd) != 0)
+	{
+		perror("close");
+		r = -1;
+	}
+	
+	s->fd = -1;
+	_free(s);
+	
+	return(r);
+}
+
+rf_fileio_t *rf_fileio_open(const char *filename, const rf_fileio_conf_t *conf)
+{
+	rf_fileio_t *s;
+	int flags;
+	int i;
+	
+	s = calloc(1, sizeof(rf_fileio_t));
+	if(!s)
+	{
+		perror("calloc");
+		return(NULL);
+	}
+	
+	s->fd = -1;
+	s->next_fd = -1;
+	s->done_fd = -1;
+	pthread_mutex_init(&s->mutex, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	pthread_cond_init(&s->seg_cond, NULL);
+	
+	s->nbuf = conf && conf->buffers > 0 ? conf->buffers : RF_FILEIO_BUFFERS;
+	s->size = conf && conf->buffer_size > 0 ? conf->buffer_size : RF_FILEIO_BUFFER_SIZE;
+	s->direct = conf ? conf->direct : 0;
+	flags = O_WRONLY | O_CREAT | O_TRUNC;
+	
+	/* Mappings need read access too, and the page cache */
+	if(conf && conf->backend == RF_FILEIO_MMAP)
+	{
+		flags = O_RDWR | O_CREAT | O_TRUNC;
+		s->direct = 0;
+	}
+	
+	/* Whole blocks keep every write but the last one aligned for O_DIRECT */
+	s->size = (s->size + RF_FILEIO_ALIGN - 1) & ~(size_t) (RF_FILEIO_ALIGN - 1);
+	if(s->nbuf < 2) s->nbuf = 2;
+	
+	if(conf && conf->segment > 0)
+	{
+		if(strcmp(filename, "-") == 0)
+		{
+			fprintf(stderr, "Warning: Standard output can't be split into segments\n");
+		}
+		else
+		{
+			s->segment = conf->segment;
+			s->keep = conf->keep;
+			s->segment_done = conf->segment_done;
+			s->arg = conf->arg;
+			s->filename = strdup(filename);
+			
+			/* Segments are switched by the writer thread */
+			if(conf->backend != RF_FILEIO_THREAD)
+			{
+				fprintf(stderr, "Warning: Segmented output uses a writer thread\n");
+				flags = O_WRONLY | O_CREAT | O_TRUNC;
+				s->direct = conf->direct;
+			}
+			
+			/* Each segment has to start on a block for O_DIRECT */
+			if(s->direct && (s->segment & (RF_FILEIO_ALIGN - 1)) != 0)
+			{
+				fprintf(stderr, "Warning: Segments are not a multiple of %d bytes, not using O_DIRECT\n", RF_FILEIO_ALIGN);
+				s->direct = 0;
+			}
+			
+			s->want_direct = s->direct;
+		}
+	}
+	
+	if(strcmp(filename, "-") == 0)
+	{
+		s->fd = STDOUT_FILENO;
+		s->direct = 0;
+	}
+	else
+	{
+		if(s->segment)
+		{
+			s->fd = s->filename ? _segment_open(s, 0, &s->direct) : -1;
+		}
+		else
+		{
+			s->fd = _open_fd(filename, flags, &s->direct);
+		}
+		
+		if(s->fd < 0)
+		{
+			_free(s);
+			return(NULL);
+		}
+		
+		s->close_fd = 1;
+	}
+	
+	s->buf = calloc(s->nbuf, sizeof(uint8_t *));
+	s->len = calloc(s->nbuf, sizeof(size_t));
+	if(!s->buf || !s->len)
+	{
+		perror("calloc");
+		_free(s);
+		return(NULL);
+	}
+	
+	if(conf && conf->backend == RF_FILEIO_MMAP && !s->segment)
+	{
+		i = _map_start(s, conf->preallocate);
+		
+		if(i == 0) return(s);
+		else if(i < 0)
+		{
+			_free(s);
+			return(NULL);
+		}
+		
+		fprintf(stderr, "Warning: '%s' can't be mapped, using a writer thread\n", filename);
+		s->mapped = 0;
+	}
+	
+	for(i = 0; i < s->nbuf; i++)
+	{
+		if(posix_memalign((void **) &s->buf[i], RF_FILEIO_ALIGN, s->size) != 0)
+		{
+			perror("posix_memalign");
+			_free(s);
+			return(NULL);
+		}
+	}
+	
+	_pipe_start(s, conf);
+	
+	if(conf && conf->backend == RF_FILEIO_URING && !s->segment)
+	{
+#ifdef HAVE_IO_URING
+		if(_uring_start(s) == 0)
+		{
+			/* The ring copies into the pipe */
+			s->splice = 0;
+			s->running = 1;
+			return(s);
+		}
+		
+		fprintf(stderr, "Warning: io_uring is not available (%s), using a writer thread\n", strerror(errno));
+#else
+		fprintf(stderr, "Warning: Built without io_uring, using a writer thread\n");
+#endif
+	}
+	
+	if(_thread_start(s) != 0)
+	{
+		_free(s);
+		return(NULL);
+	}
+	
+	if(s->segment && _segment_start(s) != 0)
+	{
+		rf_fileio_close(s);
+		return(NULL);
+	}
+	
+	return(s);
+}
+
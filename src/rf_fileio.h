@@ -0,0 +1,122 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+#ifndef _RF_FILEIO_H
+#define _RF_FILEIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Buffered file writer. Output is gathered into a pool of large aligned
+ * buffers which a thread of its own writes out, so a slow disk does not
+ * hold up the encoder until every buffer is full. Where available the
+ * buffers can instead be submitted to io_uring without a thread, or the
+ * file mapped and written in place.
+ *
+ * rf_fileio_reserve() returns space for up to *len bytes, reducing *len
+ * to what is contiguous, to be filled and passed to rf_fileio_commit().
+ *
+ * Segmented output is written as name-000000.ext, name-000001.ext, ...
+ * The writer thread switches files at exact byte counts, and a second
+ * thread opens and allocates the next file ahead of time, closes the
+ * finished one and removes those past the retention limit.
+ *
+ * When the output is a pipe it is enlarged, and with splice set the
+ * buffers are gifted to it with vmsplice rather than copied. */
+
+#define RF_FILEIO_ALIGN 4096
+
+/* Writer backends */
+#define RF_FILEIO_THREAD 0
+#define RF_FILEIO_URING  1
+#define RF_FILEIO_MMAP   2
+
+typedef void (*rf_fileio_segment_t)(void *arg, const char *filename, uint64_t index, uint64_t bytes);
+
+typedef struct {
+	
+	/* How the buffers are written */
+	int backend;
+	
+	/* Number and size of the buffers, 0 for the defaults */
+	int buffers;
+	size_t buffer_size;
+	
+	/* Bypass the page cache with O_DIRECT */
+	int direct;
+	
+	/* Bytes to allocate up front in mmap mode, 0 to grow as needed */
+	uint64_t preallocate;
+	
+	/* Split the output into files of this many bytes, keeping
+	 * the last keep of them, 0 for one file / to keep them all */
+	uint64_t segment;
+	int keep;
+	
+	/* Pipe size to ask for when writing to a pipe, 0 for the default,
+	 * and whether to hand buffers to it with vmsplice */
+	size_t pipe_size;
+	int splice;
+	
+	/* Called with each segment once it is complete and closed */
+	rf_fileio_segment_t segment_done;
+	void *arg;
+	
+} rf_fileio_conf_t;
+
+typedef struct {
+	
+	/* Bytes written to the file */
+	uint64_t bytes;
+	
+	/* Buffers in the pool, waiting to be written now, and the
+	 * most that have waited since the last call */
+	int buffers;
+	int queued;
+	int queued_max;
+	
+	/* Times the writer had to wait for a free buffer, and for how long */
+	uint64_t stalls;
+	double stall_time;
+	
+	/* Current segment, and the times it wasn't ready in time */
+	uint64_t segment;
+	uint64_t segment_waits;
+	
+	/* Pipe size if writing to one, and if vmsplice is in use */
+	size_t pipe_size;
+	int splice;
+	
+} rf_fileio_stats_t;
+
+typedef struct _rf_fileio_t rf_fileio_t;
+
+extern rf_fileio_t *rf_fileio_open(const char *filename, const rf_fileio_conf_t *conf);
+extern int rf_fileio_write(rf_fileio_t *s, const void *data, size_t len);
+extern void *rf_fileio_reserve(rf_fileio_t *s, size_t *len);
+extern int rf_fileio_commit(rf_fileio_t *s, size_t len);
+extern void rf_fileio_stats(rf_fileio_t *s, rf_fileio_stats_t *stats);
+extern int rf_fileio_close(rf_fileio_t *s);
+extern void rf_fileio_segment_name(char *dst, size_t len, const char *filename, uint64_t index);
+
+#endif
+
@@ -27,6 +27,7 @@
 #include <pthread.h>
 #include <unistd.h>
 #include "rf.h"
+#include "rf_convert.h"
 
 #define BUFFERS 32
 
@@ -65,6 +66,9 @@ typedef struct {
 	/* Buffers */
 	buffers_t buffers;
 	
+	/* int16 to int8 conversion */
+	rf_convert_t convert;
+	
 } hackrf_t;
 
 static int _buffer_init(buffers_t *buffers, size_t count, size_t length)
@@ -215,18 +219,17 @@ static int _rf_write(void *private, int16_t *iq_data, int samples)
 	int8_t iq8[4096];
 	int i, r, b;
 	
-	samples *= 2;
-	
 	while(samples > 0)
 	{
 		b = samples;
-		if(b > 4096) b = 4096;
+		if(b > 2048) b = 2048;
 		
-		for(i = 0; i < b; i++)
-		{
-			iq8[i] = *(iq_data++) >> 8;
-			samples--;
-		}
+		rf->convert(iq8, iq_data, b);
+		if(rf_debug) rf_debug(RF_INT8, iq8, b * 2);
+		
+		iq_data += b * 2;
+		samples -= b;
+		b *= 2;
 		
 		i = 0;
 		while(b)
@@ -284,6 +287,8 @@ int rf_hackrf_open(rf_t *s, const char *serial, int sample_rate, uint64_t freque
 		return(-1);
 	}
 	
+	rf->convert = rf_convert_get(RF_INT8);
+	
 	/* Allocate 0.5 seconds for output buffers */
 	_buffer_init(&rf->buffers, BUFFERS, sample_rate * 2 / BUFFERS);
 	
@@ -356,6 +361,9 @@ int rf_hackrf_open(rf_t *s, const char *serial, int sample_rate, uint64_t freque
 	s->private = rf;
 	s->write = _rf_write;
 	s->close = _rf_close;
+	s->stats = NULL;
+	s->reserve = NULL;
+	s->commit = NULL;
 	
 	return(0);
 };
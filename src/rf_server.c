@@ -0,0 +1,823 @@
+/* dsr - Digital Satellite Radio (DSR) encoder                          */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+/* Stream server sink. Each write is copied once into a ring shared by
+ * every client. A thread sends it on from each client's own position in
+ * the ring over non-blocking sockets, driven by epoll. The encoder only
+ * holds the lock long enough to fill the next frame, and the thread
+ * only to pick frames and move on: the sends themselves run without it,
+ * from frames pinned so the encoder never reuses their buffers. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netdb.h>
+#include "rf.h"
+#include "rf_convert.h"
+
+/* Longest wait (ms) for an event, so a stop is never missed */
+#define _EPOLL_TIMEOUT 100
+
+/* Frames gathered into each sendmsg() to a client */
+#define _SEND_FRAMES 16
+
+typedef struct {
+	uint8_t *data;
+	size_t len;
+	size_t size;
+} _frame_t;
+
+typedef struct {
+	
+	int fd;
+	char name[80];
+	
+	/* Next frame to send, and how much of it has gone already */
+	uint64_t next;
+	size_t offset;
+	
+	/* The rest of a frame that was replaced in the ring part way through */
+	uint8_t *tail;
+	size_t tail_len;
+	size_t tail_offset;
+	
+	int blocked;
+	int closing;
+	int evicted;
+	
+	uint64_t bytes;
+	
+} _client_t;
+
+typedef struct {
+	
+	int type;
+	rf_convert_t convert;
+	size_t data_size;
+	rf_server_conf_t conf;
+	
+	int listen_fd;
+	int epoll_fd;
+	int event_fd;
+	char *path;
+	
+	/* The last conf.queue frames, the next written is number frames */
+	_frame_t *ring;
+	uint64_t frames;
+	
+	/* The client being sent to without the lock, its frames pin_first
+	 * up to pin_last, and buffers the encoder replaced meanwhile */
+	_client_t *sending;
+	uint64_t pin_first;
+	uint64_t pin_last;
+	uint8_t *retired[_SEND_FRAMES + 1];
+	int nretired;
+	
+	_client_t **clients;
+	int nclients;
+	
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int running;
+	int idle;
+	int stop;
+	
+	uint64_t bytes;
+	uint64_t accepted;
+	uint64_t evicted;
+	uint64_t refused;
+	uint64_t skipped;
+	
+} rf_server_t;
+
+static void _put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* Called with the lock held, when the next frame a client has to send
+ * is about to be replaced, or has been during a send. rest is what it
+ * still has to send of that frame */
+static void _lapped(rf_server_t *s, _client_t *c, const uint8_t *rest, size_t rest_len)
+{
+	/* Closed if that's the policy, or if it still hasn't finished the
+	 * frame it was left with the last time */
+	if(!s->conf.skip || c->tail_len > 0)
+	{
+		c->closing = 1;
+		c->evicted = 1;
+		s->evicted++;
+		return;
+	}
+	
+	if(c->offset > 0)
+	{
+		/* Keep the rest of the frame it's part way through, so the
+		 * stream stays in step */
+		c->tail_len = rest_len;
+		c->tail_offset = 0;
+		c->tail = malloc(c->tail_len);
+		if(!c->tail)
+		{
+			c->tail_len = 0;
+			c->closing = 1;
+			return;
+		}
+		
+		memcpy(c->tail, rest, c->tail_len);
+		c->next++;
+		c->offset = 0;
+	}
+	
+	/* Then on to the newest frame */
+	s->skipped += s->frames - c->next;
+	c->next = s->frames;
+}
+
+/* Send a client as much as its socket will take. Called with the lock
+ * held, which is dropped for each sendmsg() */
+static void _send(rf_server_t *s, _client_t *c)
+{
+	struct iovec iov[_SEND_FRAMES + 1];
+	struct msghdr msg;
+	uint64_t i;
+	size_t offset, start, n, k, first;
+	ssize_t r;
+	int e;
+	
+	while(!c->blocked && !c->closing)
+	{
+		n = 0;
+		
+		if(c->tail_len > 0)
+		{
+			iov[n].iov_base = c->tail + c->tail_offset;
+			iov[n].iov_len = c->tail_len - c->tail_offset;
+			n++;
+		}
+		
+		/* Frames from iov[first] on, one to each */
+		first = n;
+		start = c->offset;
+		
+		for(i = c->next, offset = c->offset; i < s->frames && n <= _SEND_FRAMES; i++, offset = 0)
+		{
+			_frame_t *f = &s->ring[i % s->conf.queue];
+			iov[n].iov_base = f->data + offset;
+			iov[n].iov_len = f->len - offset;
+			n++;
+		}
+		
+		if(n == 0) break;
+		
+		s->sending = c;
+		s->pin_first = c->next;
+		s->pin_last = i;
+		pthread_mutex_unlock(&s->lock);
+		
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		
+		r = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		e = errno;
+		
+		pthread_mutex_lock(&s->lock);
+		s->sending = NULL;
+		
+		if(r < 0)
+		{
+			if(e == EAGAIN || e == EWOULDBLOCK) c->blocked = 1;
+			else if(e != EINTR) c->closing = 1;
+		}
+		else
+		{
+			c->bytes += r;
+			s->bytes += r;
+			
+			if(c->tail_len > 0)
+			{
+				k = (size_t) r < iov[0].iov_len ? (size_t) r : iov[0].iov_len;
+				c->tail_offset += k;
+				r -= k;
+				
+				if(c->tail_offset == c->tail_len)
+				{
+					free(c->tail);
+					c->tail = NULL;
+					c->tail_len = 0;
+				}
+			}
+			
+			for(k = first; r > 0; k++)
+			{
+				if((size_t) r < iov[k].iov_len)
+				{
+					c->offset += r;
+					break;
+				}
+				
+				r -= iov[k].iov_len;
+				c->next++;
+				c->offset = 0;
+			}
+			
+			/* The encoder may have lapped it meanwhile. What is left of
+			 * the frame it's part way through is still in iov[k] */
+			if(!c->closing && c->next + s->conf.queue <= s->frames)
+			{
+				k = first + (c->next - s->pin_first);
+				n = c->offset - (k == first ? start : 0);
+				
+				if(c->offset > 0) _lapped(s, c, (uint8_t *) iov[k].iov_base + n, iov[k].iov_len - n);
+				else _lapped(s, c, NULL, 0);
+			}
+		}
+		
+		/* Buffers the encoder replaced while they were pinned */
+		while(s->nretired > 0)
+		{
+			free(s->retired[--s->nretired]);
+		}
+	}
+}
+
+/* Discard anything a client sends, and notice when it hangs up */
+static void _receive(_client_t *c)
+{
+	uint8_t buf[1024];
+	ssize_t r;
+	
+	while((r = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT)) != 0)
+	{
+		if(r > 0) continue;
+		if(errno == EINTR) continue;
+		if(errno == EAGAIN || errno == EWOULDBLOCK) return;
+		break;
+	}
+	
+	c->closing = 1;
+}
+
+static void _accept(rf_server_t *s)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	struct epoll_event ev;
+	char host[64], port[16];
+	_client_t *c;
+	int fd;
+	
+	for(;;)
+	{
+		addr_len = sizeof(addr);
+		fd = accept4(s->listen_fd, (struct sockaddr *) &addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0)
+		{
+			if(errno == EINTR) continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK) perror("accept4");
+			return;
+		}
+		
+		if(s->nclients >= s->conf.max_clients)
+		{
+			close(fd);
+			s->refused++;
+			continue;
+		}
+		
+		c = calloc(1, sizeof(_client_t));
+		if(!c)
+		{
+			close(fd);
+			continue;
+		}
+		
+		c->fd = fd;
+		
+		/* New clients join at the next frame */
+		c->next = s->frames;
+		
+		if(addr.ss_family == AF_UNIX ||
+		   getnameinfo((struct sockaddr *) &addr, addr_len, host, sizeof(host),
+		   port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+		{
+			snprintf(c->name, sizeof(c->name), "client %llu", (unsigned long long) s->accepted + 1);
+		}
+		else
+		{
+			snprintf(c->name, sizeof(c->name), addr.ss_family == AF_INET6 ? "[%s]:%s" : "%s:%s", host, port);
+		}
+		
+		/* Edge triggered, EPOLLOUT only comes back once a full socket has room */
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = c;
+		
+		if(epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+		{
+			perror("epoll_ctl");
+			close(fd);
+			free(c);
+			continue;
+		}
+		
+		s->clients[s->nclients++] = c;
+		s->accepted++;
+		
+		fprintf(stderr, "Server: %s connected\n", c->name);
+	}
+}
+
+/* Close the clients that are finished with */
+static void _reap(rf_server_t *s)
+{
+	_client_t *c;
+	int i;
+	
+	for(i = 0; i < s->nclients; )
+	{
+		c = s->clients[i];
+		
+		if(!c->closing)
+		{
+			i++;
+			continue;
+		}
+		
+		fprintf(stderr, "Server: %s %s after %.1f MB\n", c->name,
+			c->evicted ? "fell behind and was closed" : "disconnected", c->bytes / 1e6);
+		
+		close(c->fd);
+		free(c->tail);
+		free(c);
+		
+		s->clients[i] = s->clients[--s->nclients];
+	}
+}
+
+static void *_rf_server_thread(void *arg)
+{
+	rf_server_t *s = arg;
+	struct epoll_event ev[16];
+	uint64_t v;
+	_client_t *c;
+	int i, n;
+	
+	pthread_mutex_lock(&s->lock);
+	
+	while(!s->stop)
+	{
+		for(i = 0; i < s->nclients; i++)
+		{
+			_send(s, s->clients[i]);
+		}
+		
+		_reap(s);
+		
+		/* Every client is now caught up or waiting for room, the
+		 * next write has to wake us */
+		s->idle = 1;
+		pthread_mutex_unlock(&s->lock);
+		
+		n = epoll_wait(s->epoll_fd, ev, 16, _EPOLL_TIMEOUT);
+		
+		pthread_mutex_lock(&s->lock);
+		
+		for(i = 0; i < n; i++)
+		{
+			if(ev[i].data.ptr == &s->listen_fd)
+			{
+				_accept(s);
+			}
+			else if(ev[i].data.ptr == &s->event_fd)
+			{
+				if(read(s->event_fd, &v, sizeof(v)) < 0) { }
+			}
+			else
+			{
+				c = ev[i].data.ptr;
+				
+				if(ev[i].events & EPOLLOUT) c->blocked = 0;
+				if(ev[i].events & (EPOLLIN | EPOLLRDHUP)) _receive(c);
+				if(ev[i].events & (EPOLLHUP | EPOLLERR)) c->closing = 1;
+			}
+		}
+	}
+	
+	pthread_mutex_unlock(&s->lock);
+	
+	return(NULL);
+}
+
+static int _rf_server_write(void *private, int16_t *iq_data, int samples)
+{
+	rf_server_t *s = private;
+	_frame_t *f;
+	size_t len = (size_t) samples * s->data_size;
+	uint64_t one = 1;
+	uint8_t *p;
+	int i, wake;
+	
+	pthread_mutex_lock(&s->lock);
+	
+	/* Anyone still due to send the frame about to be replaced has
+	 * fallen a whole ring behind */
+	for(i = 0; i < s->nclients; i++)
+	{
+		_client_t *c = s->clients[i];
+		
+		/* The one being sent to is checked once its send is done */
+		if(c == s->sending) continue;
+		
+		if(!c->closing && c->next + s->conf.queue <= s->frames)
+		{
+			f = &s->ring[c->next % s->conf.queue];
+			_lapped(s, c, f->data + c->offset, f->len - c->offset);
+		}
+	}
+	
+	f = &s->ring[s->frames % s->conf.queue];
+	
+	/* A frame being sent is left alone, and freed by the thread after */
+	if(s->sending && s->frames >= s->conf.queue &&
+	   s->frames - s->conf.queue >= s->pin_first &&
+	   s->frames - s->conf.queue < s->pin_last)
+	{
+		s->retired[s->nretired++] = f->data;
+		f->data = NULL;
+		f->size = 0;
+	}
+	
+	if(f->size < RF_SERVER_HEADER + len)
+	{
+		p = realloc(f->data, RF_SERVER_HEADER + len);
+		if(!p)
+		{
+			pthread_mutex_unlock(&s->lock);
+			perror("realloc");
+			return(-1);
+		}
+		
+		f->data = p;
+		f->size = RF_SERVER_HEADER + len;
+	}
+	
+	_put32(f->data, len);
+	_put32(f->data + 4, s->frames);
+	
+	if(s->convert)
+	{
+		s->convert(f->data + RF_SERVER_HEADER, iq_data, samples);
+	}
+	else
+	{
+		memcpy(f->data + RF_SERVER_HEADER, iq_data, len);
+	}
+	
+	if(rf_debug) rf_debug(s->type, f->data + RF_SERVER_HEADER, len);
+	
+	f->len = RF_SERVER_HEADER + len;
+	s->frames++;
+	
+	wake = s->idle;
+	s->idle = 0;
+	
+	pthread_mutex_unlock(&s->lock);
+	
+	/* The thread only needs waking once it has run out of work */
+	if(wake && write(s->event_fd, &one, sizeof(one)) < 0)
+	{
+		perror("write");
+	}
+	
+	return(0);
+}
+
+static int _rf_server_stats(void *private, FILE *f)
+{
+	rf_server_t *s = private;
+	uint64_t behind = 0;
+	int i;
+	
+	pthread_mutex_lock(&s->lock);
+	
+	for(i = 0; i < s->nclients; i++)
+	{
+		if(s->frames - s->clients[i]->next > behind)
+		{
+			behind = s->frames - s->clients[i]->next;
+		}
+	}
+	
+	fprintf(f, "Server: %d clients (%llu blocks behind at most), %.1f MB sent, %llu connected, "
+		"%llu closed for falling behind, %llu blocks skipped, %llu refused\n",
+		s->nclients, (unsigned long long) behind, s->bytes / 1e6,
+		(unsigned long long) s->accepted,
+		(unsigned long long) s->evicted,
+		(unsigned long long) s->skipped,
+		(unsigned long long) s->refused);
+	
+	pthread_mutex_unlock(&s->lock);
+	
+	return(0);
+}
+
+static int _rf_server_close(void *private)
+{
+	rf_server_t *s = private;
+	uint64_t one = 1;
+	int i;
+	
+	if(s->running)
+	{
+		pthread_mutex_lock(&s->lock);
+		s->stop = 1;
+		pthread_mutex_unlock(&s->lock);
+		
+		if(write(s->event_fd, &one, sizeof(one)) < 0) { }
+		pthread_join(s->thread, NULL);
+	}
+	
+	for(i = 0; i < s->nclients; i++)
+	{
+		close(s->clients[i]->fd);
+		free(s->clients[i]->tail);
+		free(s->clients[i]);
+	}
+	
+	for(i = 0; s->ring && i < s->conf.queue; i++)
+	{
+		free(s->ring[i].data);
+	}
+	
+	if(s->listen_fd >= 0) close(s->listen_fd);
+	if(s->epoll_fd >= 0) close(s->epoll_fd);
+	if(s->event_fd >= 0) close(s->event_fd);
+	
+	if(s->path)
+	{
+		unlink(s->path);
+		free(s->path);
+	}
+	
+	pthread_mutex_destroy(&s->lock);
+	free(s->clients);
+	free(s->ring);
+	free(s);
+	
+	return(0);
+}
+
+static int _listen_unix(rf_server_t *s, const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	
+	if(*path == '\0' || strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "Server: Invalid socket path '%s'\n", path);
+		return(-1);
+	}
+	
+	strcpy(addr.sun_path, path);
+	
+	/* A socket left behind by an earlier run would stop the bind,
+	 * anything else at the path is left alone */
+	if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+	{
+		unlink(path);
+	}
+	
+	s->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(s->listen_fd < 0)
+	{
+		perror("socket");
+		return(-1);
+	}
+	
+	if(bind(s->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+	{
+		fprintf(stderr, "Server: Can't bind %s: %s\n", path, strerror(errno));
+		return(-1);
+	}
+	
+	s->path = strdup(path);
+	
+	return(0);
+}
+
+static int _listen_tcp(rf_server_t *s, const char *target)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256], port[32];
+	const char *colon;
+	size_t l;
+	int r, on = 1;
+	
+	/* [host]:port, host:port, or :port for every address */
+	colon = strrchr(target, ':');
+	if(!colon || colon[1] == '\0' || strlen(colon + 1) >= sizeof(port) ||
+	   (size_t) (colon - target) >= sizeof(host))
+	{
+		fprintf(stderr, "Server: Invalid target '%s' (expected e.g. tcp://:5700)\n", target);
+		return(-1);
+	}
+	
+	l = colon - target;
+	if(l >= 2 && target[0] == '[' && target[l - 1] == ']')
+	{
+		target++;
+		l -= 2;
+	}
+	
+	memcpy(host, target, l);
+	host[l] = '\0';
+	strcpy(port, colon + 1);
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	
+	r = getaddrinfo(*host && strcmp(host, "*") != 0 ? host : NULL, port, &hints, &res);
+	if(r != 0)
+	{
+		fprintf(stderr, "Server: %s: %s\n", target, gai_strerror(r));
+		return(-1);
+	}
+	
+	for(ai = res; ai; ai = ai->ai_next)
+	{
+		s->listen_fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if(s->listen_fd < 0) continue;
+		
+		setsockopt(s->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		
+		if(bind(s->listen_fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+		
+		close(s->listen_fd);
+		s->listen_fd = -1;
+	}
+	
+	freeaddrinfo(res);
+	
+	if(s->listen_fd < 0)
+	{
+		fprintf(stderr, "Server: Can't bind %s: %s\n", target, strerror(errno));
+		return(-1);
+	}
+	
+	return(0);
+}
+
+int rf_server_open(rf_t *rf, const char *target, int type, const rf_server_conf_t *conf)
+{
+	rf_server_t *s;
+	struct epoll_event ev;
+	int r;
+	
+	s = calloc(1, sizeof(rf_server_t));
+	if(!s)
+	{
+		perror("calloc");
+		return(-1);
+	}
+	
+	s->listen_fd = s->epoll_fd = s->event_fd = -1;
+	pthread_mutex_init(&s->lock, NULL);
+	
+	if(conf) s->conf = *conf;
+	if(s->conf.queue <= 0) s->conf.queue = 250;
+	if(s->conf.max_clients <= 0) s->conf.max_clients = 16;
+	
+	/* Unmodulated output is sent as it is, one byte a "sample" */
+	s->type = type;
+	if(type == RF_UNMOD_UINT8 || type == RF_UNMOD_UDP)
+	{
+		s->data_size = 1;
+	}
+	else
+	{
+		s->convert = rf_convert_get(type);
+		s->data_size = rf_convert_size(type);
+	}
+	
+	if(s->data_size == 0)
+	{
+		fprintf(stderr, "%s: Unrecognised data type %d\n", __func__, type);
+		_rf_server_close(s);
+		return(-1);
+	}
+	
+	s->ring = calloc(s->conf.queue, sizeof(_frame_t));
+	s->clients = calloc(s->conf.max_clients, sizeof(_client_t *));
+	if(!s->ring || !s->clients)
+	{
+		perror("calloc");
+		_rf_server_close(s);
+		return(-1);
+	}
+	
+	if(!target)
+	{
+		fprintf(stderr, "Server: Target missing (expected e.g. tcp://:5700 or unix:/tmp/dsr.sock)\n");
+		_rf_server_close(s);
+		return(-1);
+	}
+	
+	if(strncmp(target, "unix:", 5) == 0)
+	{
+		r = _listen_unix(s, target + 5);
+	}
+	else
+	{
+		r = _listen_tcp(s, strncmp(target, "tcp://", 6) == 0 ? target + 6 : target);
+	}
+	
+	if(r != 0 || listen(s->listen_fd, 16) != 0)
+	{
+		if(r == 0) perror("listen");
+		_rf_server_close(s);
+		return(-1);
+	}
+	
+	s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	s->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(s->epoll_fd < 0 || s->event_fd < 0)
+	{
+		perror("epoll");
+		_rf_server_close(s);
+		return(-1);
+	}
+	
+	/* The listening socket and the wakeup are told apart by address */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &s->listen_fd;
+	r = epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->listen_fd, &ev);
+	
+	ev.data.ptr = &s->event_fd;
+	if(r != 0 || epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->event_fd, &ev) != 0)
+	{
+		perror("epoll_ctl");
+		_rf_server_close(s);
+		return(-1);
+	}
+	
+	if(pthread_create(&s->thread, NULL, _rf_server_thread, s) != 0)
+	{
+		perror("pthread_create");
+		_rf_server_close(s);
+		return(-1);
+	}
+	
+	s->running = 1;
+	
+	rf->private = s;
+	rf->write = _rf_server_write;
+	rf->close = _rf_server_close;
+	rf->stats = _rf_server_stats;
+	rf->reserve = NULL;
+	rf->commit = NULL;
+	
+	return(0);
+}
+
@@ -0,0 +1,52 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+
+#ifndef _RF_SERVER_H
+#define _RF_SERVER_H
+
+#include <stdint.h>
+
+/* Stream server sink. Listens on "tcp://[host]:port" or "unix:/path" and
+ * sends every client the same output from the moment it connects. Each
+ * write is one frame on the stream:
+ *
+ *   0   length of the data that follows                   (32 bits)
+ *   4   block number since the start of the output         (32 bits)
+ *   8   data, in the output data type
+ *
+ * Both fields are big-endian. A client that is skipped ahead sees a gap
+ * in the block numbers. The encoder never waits on a client. */
+
+#define RF_SERVER_HEADER 8
+
+typedef struct {
+	int queue;        /* Blocks a client may fall behind (250) */
+	int skip;         /* Non-zero to skip a client that falls further
+	                   * behind to the newest block, rather than close it */
+	int max_clients;  /* (16) */
+} rf_server_conf_t;
+
+extern int rf_server_open(rf_t *s, const char *target, int type, const rf_server_conf_t *conf);
+
+#endif
+
@@ -0,0 +1,195 @@
+/* dsr - Digital Satellite Radio (DSR) encoder                          */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rf.h"
+#include "rf_convert.h"
+#include "shmring.h"
+
+typedef struct {
+	shmring_t ring;
+	int type;
+	rf_convert_t convert;
+	size_t data_size;
+	int drop;
+	uint32_t block;
+	uint8_t *reserved;
+} rf_shm_t;
+
+static int16_t *_rf_shm_reserve(void *private, int samples)
+{
+	rf_shm_t *s = private;
+	
+	if((size_t) samples * s->data_size > s->ring.h->frame_size)
+	{
+		return(NULL);
+	}
+	
+	/* NULL while a dropping ring is full, the block then comes
+	 * through _rf_shm_write() to be counted */
+	s->reserved = shmring_reserve(&s->ring, !s->drop);
+	
+	return((int16_t *) s->reserved);
+}
+
+static int _rf_shm_commit(void *private, int samples)
+{
+	rf_shm_t *s = private;
+	size_t len = (size_t) samples * s->data_size;
+	
+	if(rf_debug) rf_debug(s->type, s->reserved, len);
+	
+	shmring_commit(&s->ring, len, s->block++);
+	
+	return(0);
+}
+
+static int _rf_shm_write(void *private, int16_t *iq_data, int samples)
+{
+	rf_shm_t *s = private;
+	size_t len = (size_t) samples * s->data_size;
+	uint8_t *p;
+	
+	if(len > s->ring.h->frame_size)
+	{
+		fprintf(stderr, "%s: %zu byte block is larger than the ring's %llu\n",
+			s->ring.name, len, (unsigned long long) s->ring.h->frame_size);
+		return(-1);
+	}
+	
+	p = shmring_reserve(&s->ring, !s->drop);
+	if(!p)
+	{
+		/* The reader sees the gap in the block numbers */
+		s->ring.h->dropped++;
+		s->block++;
+		return(0);
+	}
+	
+	if(s->convert)
+	{
+		s->convert(p, iq_data, samples);
+	}
+	else
+	{
+		memcpy(p, iq_data, len);
+	}
+	
+	if(rf_debug) rf_debug(s->type, p, len);
+	
+	shmring_commit(&s->ring, len, s->block++);
+	
+	return(0);
+}
+
+static int _rf_shm_stats(void *private, FILE *f)
+{
+	rf_shm_t *s = private;
+	shmring_header_t *h = s->ring.h;
+	
+	fprintf(f, "Shared memory: %s, %d/%u blocks queued, %llu written, %llu dropped, "
+		"waited for the reader %llu times, the reader waited %llu times\n",
+		s->ring.name, shmring_used(&s->ring), h->slots,
+		(unsigned long long) h->head,
+		(unsigned long long) h->dropped,
+		(unsigned long long) h->writer_waits,
+		(unsigned long long) h->reader_waits);
+	
+	return(0);
+}
+
+static int _rf_shm_close(void *private)
+{
+	rf_shm_t *s = private;
+	
+	shmring_close(&s->ring);
+	free(s);
+	
+	return(0);
+}
+
+int rf_shm_open(rf_t *rf, const char *name, int type, const rf_shm_conf_t *conf)
+{
+	rf_shm_t *s;
+	
+	s = calloc(1, sizeof(rf_shm_t));
+	if(!s)
+	{
+		perror("calloc");
+		return(-1);
+	}
+	
+	/* Unmodulated output is passed on as it is, one byte a "sample" */
+	s->type = type;
+	if(type == RF_UNMOD_UINT8 || type == RF_UNMOD_UDP)
+	{
+		s->data_size = 1;
+	}
+	else
+	{
+		s->convert = rf_convert_get(type);
+		s->data_size = rf_convert_size(type);
+	}
+	
+	s->drop = conf->drop;
+	
+	if(s->data_size == 0)
+	{
+		fprintf(stderr, "%s: Unrecognised data type %d\n", __func__, type);
+		free(s);
+		return(-1);
+	}
+	
+	if(!name || *name == '\0')
+	{
+		fprintf(stderr, "Shared memory: Name missing (expected e.g. /dsr)\n");
+		free(s);
+		return(-1);
+	}
+	
+	if(shmring_create(&s->ring, name, conf->slots > 0 ? conf->slots : 64,
+		conf->frame_size, type, conf->sample_rate) != 0)
+	{
+		free(s);
+		return(-1);
+	}
+	
+	rf->private = s;
+	rf->write = _rf_shm_write;
+	rf->close = _rf_shm_close;
+	rf->stats = _rf_shm_stats;
+	rf->reserve = NULL;
+	rf->commit = NULL;
+	
+	/* Raw int16 is modulated straight into the ring */
+	if(type == RF_INT16)
+	{
+		rf->reserve = _rf_shm_reserve;
+		rf->commit = _rf_shm_commit;
+	}
+	
+	return(0);
+}
+
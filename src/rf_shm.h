@@ -0,0 +1,44 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+
+#ifndef _RF_SHM_H
+#define _RF_SHM_H
+
+#include <stddef.h>
+
+/* Shared memory sink. Each block goes into the next slot of a shmring
+ * (see shmring.h) named by the output, e.g. "/dsr". Modulated int16
+ * output is rendered straight into the slot */
+
+typedef struct {
+	int slots;                 /* Blocks in the ring (64) */
+	int drop;                  /* Non-zero to drop blocks while the ring is
+	                            * full, rather than wait for the reader */
+	size_t frame_size;         /* Bytes in the largest block */
+	unsigned int sample_rate;  /* Recorded for the reader */
+} rf_shm_conf_t;
+
+extern int rf_shm_open(rf_t *s, const char *name, int type, const rf_shm_conf_t *conf);
+
+#endif
+
@@ -0,0 +1,333 @@
+/* dsr - Digital Satellite Radio (DSR) encoder                          */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+/* Shared memory SPSC ring, see shmring.h for the layout and protocol */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shmring.h"
+
+/* Longest sleep (ms) for the writer, in case a reader goes away mid-wake */
+#define _WRITER_TIMEOUT 100
+
+static int _futex_wait(uint32_t *addr, uint32_t v, int timeout)
+{
+	struct timespec ts;
+	
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (long) (timeout % 1000) * 1000000;
+	
+	/* Not FUTEX_PRIVATE, the word is shared between processes */
+	return(syscall(SYS_futex, addr, FUTEX_WAIT, v, timeout < 0 ? NULL : &ts, NULL, 0));
+}
+
+static void _futex_wake(uint32_t *addr)
+{
+	__atomic_fetch_add(addr, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline uint8_t *_slot(shmring_t *s, uint64_t n)
+{
+	return(s->slots + (size_t) (n % s->h->slots) * s->h->stride);
+}
+
+int shmring_create(shmring_t *s, const char *name, int slots, size_t frame_size, int type, unsigned int sample_rate)
+{
+	shmring_header_t *h;
+	size_t stride, offset;
+	
+	memset(s, 0, sizeof(shmring_t));
+	s->fd = -1;
+	s->writer = 1;
+	
+	if(slots < 2 || frame_size == 0 || frame_size > UINT32_MAX)
+	{
+		fprintf(stderr, "%s: Invalid ring of %d slots of %zu bytes\n", name, slots, frame_size);
+		return(-1);
+	}
+	
+	/* Each slot starts on a cache line, and the first on a page */
+	stride = (SHMRING_FRAME + frame_size + 63) & ~(size_t) 63;
+	offset = (sizeof(shmring_header_t) + 4095) & ~(size_t) 4095;
+	s->size = offset + stride * slots;
+	
+	/* A ring left behind by an earlier writer is replaced, readers
+	 * still attached to it keep their copy */
+	shm_unlink(name);
+	
+	s->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+	if(s->fd < 0 || ftruncate(s->fd, s->size) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		shmring_close(s);
+		return(-1);
+	}
+	
+	s->name = strdup(name);
+	
+	/* Populated up front, so no page is faulted in while running */
+	h = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s->fd, 0);
+	if(h == MAP_FAILED)
+	{
+		perror("mmap");
+		shmring_close(s);
+		return(-1);
+	}
+	
+	s->h = h;
+	s->slots = (uint8_t *) h + offset;
+	
+	h->version = SHMRING_VERSION;
+	h->slots = slots;
+	h->stride = stride;
+	h->frame_size = frame_size;
+	h->type = type;
+	h->sample_rate = sample_rate;
+	h->offset = offset;
+	
+	/* Readers check the magic last */
+	__atomic_store_n(&h->magic, SHMRING_MAGIC, __ATOMIC_RELEASE);
+	
+	return(0);
+}
+
+uint8_t *shmring_reserve(shmring_t *s, int wait)
+{
+	shmring_header_t *h = s->h;
+	uint32_t want, v;
+	
+	while(s->head - s->tail >= h->slots)
+	{
+		/* Full as of the last look, look again */
+		s->tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+		if(s->head - s->tail < h->slots) break;
+		
+		if(!wait) return(NULL);
+		
+		/* Wait for a quarter of the ring to come free, so the reader
+		 * isn't waking us for every frame */
+		want = h->slots / 4 > 0 ? h->slots / 4 : 1;
+		v = __atomic_load_n(&h->space_seq, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&h->space_wanted, want, __ATOMIC_SEQ_CST);
+		
+		s->tail = __atomic_load_n(&h->tail, __ATOMIC_SEQ_CST);
+		if(h->slots - (s->head - s->tail) < want)
+		{
+			h->writer_waits++;
+			_futex_wait(&h->space_seq, v, _WRITER_TIMEOUT);
+		}
+		
+		__atomic_store_n(&h->space_wanted, 0, __ATOMIC_SEQ_CST);
+	}
+	
+	return(_slot(s, s->head) + SHMRING_FRAME);
+}
+
+void shmring_commit(shmring_t *s, size_t len, uint32_t block)
+{
+	shmring_header_t *h = s->h;
+	uint32_t *f = (uint32_t *) _slot(s, s->head);
+	
+	f[0] = len;
+	f[1] = block;
+	
+	s->head++;
+	__atomic_store_n(&h->head, s->head, __ATOMIC_SEQ_CST);
+	
+	if(__atomic_load_n(&h->reader_waiting, __ATOMIC_SEQ_CST))
+	{
+		_futex_wake(&h->data_seq);
+	}
+}
+
+int shmring_open(shmring_t *s, const char *name, int quiet)
+{
+	shmring_header_t *h;
+	struct stat st;
+	
+	memset(s, 0, sizeof(shmring_t));
+	
+	s->fd = shm_open(name, O_RDWR, 0);
+	if(s->fd < 0 || fstat(s->fd, &st) != 0)
+	{
+		int missing = (errno == ENOENT);
+		
+		if(!missing || !quiet) fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		shmring_close(s);
+		return(missing ? 1 : -1);
+	}
+	
+	/* The writer sizes the segment after creating it */
+	if((size_t) st.st_size < sizeof(shmring_header_t))
+	{
+		if(!quiet) fprintf(stderr, "%s: Not a DSR ring\n", name);
+		shmring_close(s);
+		return(1);
+	}
+	
+	s->size = st.st_size;
+	
+	h = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s->fd, 0);
+	if(h == MAP_FAILED)
+	{
+		perror("mmap");
+		shmring_close(s);
+		return(-1);
+	}
+	
+	s->h = h;
+	
+	/* The writer sets the magic last */
+	if(__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHMRING_MAGIC)
+	{
+		if(!quiet) fprintf(stderr, "%s: Not a DSR ring\n", name);
+		shmring_close(s);
+		return(1);
+	}
+	
+	if(h->version != SHMRING_VERSION ||
+	   h->slots == 0 || h->stride < SHMRING_FRAME + h->frame_size ||
+	   (size_t) h->offset + (size_t) h->stride * h->slots > s->size)
+	{
+		fprintf(stderr, "%s: Not a DSR ring, or a different version\n", name);
+		shmring_close(s);
+		return(-1);
+	}
+	
+	s->slots = (uint8_t *) h + h->offset;
+	
+	/* Carry on from wherever the last reader left off */
+	s->tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+	s->head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+	
+	return(0);
+}
+
+int shmring_read(shmring_t *s, const uint8_t **data, size_t *len, uint32_t *block, int timeout)
+{
+	shmring_header_t *h = s->h;
+	uint32_t *f;
+	uint32_t v;
+	int r;
+	
+	while(s->tail == s->head)
+	{
+		/* Empty as of the last look, look again */
+		s->head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+		if(s->tail != s->head) break;
+		
+		if(__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE))
+		{
+			/* The last frames may have landed just before */
+			s->head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+			if(s->tail != s->head) break;
+			return(-1);
+		}
+		
+		if(timeout == 0) return(0);
+		
+		v = __atomic_load_n(&h->data_seq, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&h->reader_waiting, 1, __ATOMIC_SEQ_CST);
+		
+		s->head = __atomic_load_n(&h->head, __ATOMIC_SEQ_CST);
+		r = 0;
+		
+		if(s->tail == s->head && !__atomic_load_n(&h->closed, __ATOMIC_SEQ_CST))
+		{
+			h->reader_waits++;
+			r = _futex_wait(&h->data_seq, v, timeout);
+		}
+		
+		__atomic_store_n(&h->reader_waiting, 0, __ATOMIC_SEQ_CST);
+		
+		if(r != 0 && errno == ETIMEDOUT)
+		{
+			s->head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+			if(s->tail == s->head) return(0);
+		}
+	}
+	
+	f = (uint32_t *) _slot(s, s->tail);
+	
+	*len = f[0] <= h->frame_size ? f[0] : h->frame_size;
+	*data = (const uint8_t *) &f[2];
+	if(block) *block = f[1];
+	
+	return(1);
+}
+
+void shmring_release(shmring_t *s)
+{
+	shmring_header_t *h = s->h;
+	uint32_t want;
+	
+	s->tail++;
+	__atomic_store_n(&h->tail, s->tail, __ATOMIC_SEQ_CST);
+	
+	/* Only wake the writer once it has all the room it asked for */
+	want = __atomic_load_n(&h->space_wanted, __ATOMIC_SEQ_CST);
+	if(want > 0 && h->slots - (__atomic_load_n(&h->head, __ATOMIC_ACQUIRE) - s->tail) >= want)
+	{
+		_futex_wake(&h->space_seq);
+	}
+}
+
+int shmring_used(shmring_t *s)
+{
+	return(__atomic_load_n(&s->h->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&s->h->tail, __ATOMIC_ACQUIRE));
+}
+
+void shmring_close(shmring_t *s)
+{
+	if(s->h && s->writer)
+	{
+		__atomic_store_n(&s->h->closed, 1, __ATOMIC_SEQ_CST);
+		_futex_wake(&s->h->data_seq);
+	}
+	
+	if(s->h) munmap(s->h, s->size);
+	if(s->fd >= 0) close(s->fd);
+	
+	/* The name goes with the writer, a reader still attached keeps
+	 * the segment until it lets go */
+	if(s->name)
+	{
+		shm_unlink(s->name);
+		free(s->name);
+	}
+	
+	memset(s, 0, sizeof(shmring_t));
+	s->fd = -1;
+}
+
@@ -0,0 +1,121 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+
+#ifndef _SHMRING_H
+#define _SHMRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Single producer, single consumer ring of frames in POSIX shared memory,
+ * for handing the output to another process on the same host. Used by
+ * the shm sink in dsrtx, and on its own by readers such as dsrshm_cat.
+ *
+ * The segment starts with a shmring_header_t, then the slots, each
+ * stride bytes apart. A slot holds a frame header and its data:
+ *
+ *   0   length of the data                                 (32 bits)
+ *   4   block number since the start of the output         (32 bits)
+ *   8   data
+ *
+ * Fields are in host byte order. The writer owns head, the reader owns
+ * tail, and neither makes a system call while there is data or room.
+ * Whoever runs out sets its waiting word and sleeps on a futex in the
+ * segment. The other side only wakes it when that word is set, and the
+ * writer is only woken once a quarter of the ring is free. */
+
+#define SHMRING_MAGIC    0x44535253  /* "DSRS" */
+#define SHMRING_VERSION  1
+#define SHMRING_FRAME    8
+
+typedef struct {
+	
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t stride;
+	uint64_t frame_size;  /* Largest frame, less its header */
+	int32_t type;         /* Output data type (RF_UINT8 ...) */
+	uint32_t sample_rate;
+	uint32_t offset;      /* Of the first slot from the start */
+	uint32_t closed;      /* Set once the writer is done */
+	
+	/* Writer's line: frames written, and its counters */
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t dropped;
+	uint64_t writer_waits;
+	
+	/* Reader's line: frames read */
+	uint64_t tail __attribute__((aligned(64)));
+	uint64_t reader_waits;
+	
+	/* Futex words. A waiting side sets its waiting word, then sleeps
+	 * on the matching seq word, which is bumped before each wake.
+	 * space_wanted is the free slots the writer is waiting for */
+	uint32_t data_seq __attribute__((aligned(64)));
+	uint32_t reader_waiting;
+	uint32_t space_seq __attribute__((aligned(64)));
+	uint32_t space_wanted;
+	
+} shmring_header_t;
+
+typedef struct {
+	int fd;
+	char *name;
+	int writer;
+	size_t size;
+	shmring_header_t *h;
+	uint8_t *slots;
+	
+	/* Cached copy of the other side's counter */
+	uint64_t head;
+	uint64_t tail;
+} shmring_t;
+
+/* Writer. shmring_create() makes a new segment, replacing any left by
+ * an earlier writer. shmring_reserve() returns the next free slot's data,
+ * waiting for room if wait is set or returning NULL if the ring is full.
+ * shmring_commit() publishes it. shmring_close() marks the ring closed
+ * and removes the name, readers can still drain what's left */
+extern int shmring_create(shmring_t *s, const char *name, int slots, size_t frame_size, int type, unsigned int sample_rate);
+extern uint8_t *shmring_reserve(shmring_t *s, int wait);
+extern void shmring_commit(shmring_t *s, size_t len, uint32_t block);
+
+/* Reader. shmring_open() returns 1 if the ring isn't there yet, or the
+ * writer is still setting it up, and -1 on any other error. quiet keeps
+ * the first case silent, for callers waiting on the writer.
+ * shmring_read() returns 1 with the oldest frame, which stays
+ * in place until shmring_release(); 0 if nothing arrived within timeout
+ * ms (-1 waits for ever); or -1 once the writer has closed and the ring
+ * is empty */
+extern int shmring_open(shmring_t *s, const char *name, int quiet);
+extern int shmring_read(shmring_t *s, const uint8_t **data, size_t *len, uint32_t *block, int timeout);
+extern void shmring_release(shmring_t *s);
+
+/* Frames waiting to be read */
+extern int shmring_used(shmring_t *s);
+
+extern void shmring_close(shmring_t *s);
+
+#endif
+
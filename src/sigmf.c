@@ -0,0 +1,223 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+/* SigMF sidecar writer. The metadata is written when the capture is
+ * opened and again when it is closed, each time to a temporary file
+ * renamed over the old one, so readers never see a partial file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sigmf.h"
+#include "mux.h"
+#include "rf_convert.h"
+
+static const char *_datatype(int type)
+{
+	switch(type)
+	{
+	case RF_UINT8: return("cu8");
+	case RF_INT8: return("ci8");
+	case RF_UINT16: return("cu16_le");
+	case RF_INT16: return("ci16_le");
+	case RF_INT32: return("ci32_le");
+	case RF_FLOAT: return("cf32_le");
+	case RF_UNMOD_UINT8: return("ru8");
+	}
+	
+	return(NULL);
+}
+
+static char *_path(const char *filename)
+{
+	const char *ext = ".sigmf-data";
+	size_t l;
+	char *path;
+	
+	/* name.sigmf-data gets name.sigmf-meta, anything else has it appended */
+	l = strlen(filename);
+	path = malloc(l + 12);
+	if(!path)
+	{
+		perror("malloc");
+		return(NULL);
+	}
+	
+	strcpy(path, filename);
+	if(l > strlen(ext) && strcmp(filename + l - strlen(ext), ext) == 0)
+	{
+		l -= strlen(ext);
+	}
+	
+	strcpy(path + l, ".sigmf-meta");
+	
+	return(path);
+}
+
+int sigmf_open(sigmf_t *s, const char *filename, int type, unsigned int sample_rate, int interpolation, int delay, double frequency, uint64_t first_block)
+{
+	memset(s, 0, sizeof(sigmf_t));
+	
+	s->datatype = _datatype(type);
+	if(!s->datatype || strcmp(filename, "-") == 0)
+	{
+		fprintf(stderr, "Warning: No SigMF metadata for this output\n");
+		return(-1);
+	}
+	
+	s->path = _path(filename);
+	if(!s->path) return(-1);
+	
+	if(type == RF_UNMOD_UINT8)
+	{
+		/* One byte per 8 bits of the stream */
+		s->sample_rate = DSR_SYMBOL_RATE * 2 / 8;
+		s->frame_bytes = MUX_BLOCK_BYTES / SIGMF_FRAMES;
+		s->offset = 0;
+	}
+	else
+	{
+		/* Two bits per symbol */
+		s->sample_rate = sample_rate;
+		s->frame_bytes = MUX_BLOCK_BITS / SIGMF_FRAMES / 2 * interpolation * rf_convert_size(type);
+		s->offset = delay * rf_convert_size(type);
+	}
+	
+	s->block_bytes = s->frame_bytes * SIGMF_FRAMES;
+	s->frequency = frequency;
+	s->first_block = first_block;
+	clock_gettime(CLOCK_REALTIME, &s->datetime);
+	
+	return(sigmf_write(s));
+}
+
+uint64_t sigmf_block_offset(const sigmf_t *s, uint64_t block)
+{
+	return(s->offset + block * s->block_bytes);
+}
+
+static uint64_t _sa_first_frame(const sigmf_t *s)
+{
+	const uint64_t cycle = SIGMF_FRAMES * SIGMF_SA_BLOCKS;
+	
+	/* The SA bits lead the audio blocks by 16 frames, so each
+	 * cycle starts 16 frames before a multiple of 128 blocks */
+	return((cycle * 2 - 16 - (s->first_block * SIGMF_FRAMES) % cycle) % cycle);
+}
+
+uint64_t sigmf_sa_offset(const sigmf_t *s, uint64_t cycle)
+{
+	return(s->offset + (_sa_first_frame(s) + cycle * SIGMF_FRAMES * SIGMF_SA_BLOCKS) * s->frame_bytes);
+}
+
+int sigmf_write(sigmf_t *s)
+{
+	char tmp[4096];
+	char datetime[32];
+	struct tm tm;
+	FILE *f;
+	
+	if(!s->path) return(-1);
+	
+	snprintf(tmp, sizeof(tmp), "%s.tmp", s->path);
+	
+	f = fopen(tmp, "w");
+	if(!f)
+	{
+		perror(tmp);
+		return(-1);
+	}
+	
+	gmtime_r(&s->datetime.tv_sec, &tm);
+	strftime(datetime, sizeof(datetime), "%Y-%m-%dT%H:%M:%S", &tm);
+	
+	fprintf(f,
+		"{\n"
+		"  \"global\": {\n"
+		"    \"core:datatype\": \"%s\",\n"
+		"    \"core:sample_rate\": %.0f,\n"
+		"    \"core:version\": \"1.0.0\",\n"
+		"    \"core:recorder\": \"dsrtx\",\n"
+		"    \"core:description\": \"%s\",\n"
+		"    \"core:extensions\": [ { \"name\": \"dsr\", \"version\": \"1.0.0\", \"optional\": true } ],\n"
+		"    \"dsr:frame_bytes\": %zu,\n"
+		"    \"dsr:block_bytes\": %zu,\n"
+		"    \"dsr:offset\": %llu,\n"
+		"    \"dsr:first_block\": %llu,\n"
+		"    \"dsr:blocks\": %llu,\n"
+		"    \"dsr:sa_cycle_blocks\": %d,\n"
+		"    \"dsr:sa_first_frame\": %llu\n"
+		"  },\n"
+		"  \"captures\": [\n"
+		"    {\n"
+		"      \"core:sample_start\": 0,\n"
+		"      \"core:frequency\": %.0f,\n"
+		"      \"core:datetime\": \"%s.%03ldZ\"\n"
+		"    }\n"
+		"  ],\n"
+		"  \"annotations\": []\n"
+		"}\n",
+		s->datatype,
+		s->sample_rate,
+		strcmp(s->datatype, "ru8") == 0 ? "DSR bitstream, MSB first" : "DSR QPSK baseband",
+		s->frame_bytes,
+		s->block_bytes,
+		(unsigned long long) s->offset,
+		(unsigned long long) s->first_block,
+		(unsigned long long) s->blocks,
+		SIGMF_SA_BLOCKS,
+		(unsigned long long) _sa_first_frame(s),
+		s->frequency,
+		datetime, s->datetime.tv_nsec / 1000000
+	);
+	
+	if(fclose(f) != 0 || rename(tmp, s->path) != 0)
+	{
+		perror(s->path);
+		remove(tmp);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+void sigmf_close(sigmf_t *s)
+{
+	if(!s->path) return;
+	
+	sigmf_write(s);
+	
+	free(s->path);
+	s->path = NULL;
+}
+
+void sigmf_remove(const char *filename)
+{
+	char *path = _path(filename);
+	
+	if(path)
+	{
+		remove(path);
+		free(path);
+	}
+}
+
@@ -0,0 +1,72 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+#ifndef _SIGMF_H
+#define _SIGMF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+/* SigMF metadata for file captures. The .sigmf-meta sidecar describes
+ * the sample format and carries an index of the DSR stream, so a reader
+ * can seek to any block or SA cycle without searching for sync:
+ *
+ *   block n:    dsr:offset + n * dsr:block_bytes
+ *   SA cycle k: dsr:offset + (dsr:sa_first_frame + k * 8192) * dsr:frame_bytes
+ *
+ * dsr:offset covers the modulator's filter delay, so it points at the
+ * centre of the first symbol of block 0. */
+
+#define SIGMF_FRAMES    64   /* Frame pairs per 2ms block */
+#define SIGMF_SA_BLOCKS 128  /* Blocks per SA cycle */
+
+typedef struct {
+	
+	/* Path of the sidecar */
+	char *path;
+	
+	const char *datatype;
+	double sample_rate;
+	double frequency;
+	struct timespec datetime;
+	
+	/* Stream layout */
+	size_t frame_bytes;
+	size_t block_bytes;
+	uint64_t offset;
+	uint64_t first_block;
+	
+	/* Blocks written so far */
+	uint64_t blocks;
+	
+} sigmf_t;
+
+extern int sigmf_open(sigmf_t *s, const char *filename, int type, unsigned int sample_rate, int interpolation, int delay, double frequency, uint64_t first_block);
+extern uint64_t sigmf_block_offset(const sigmf_t *s, uint64_t block);
+extern uint64_t sigmf_sa_offset(const sigmf_t *s, uint64_t cycle);
+extern int sigmf_write(sigmf_t *s);
+extern void sigmf_close(sigmf_t *s);
+extern void sigmf_remove(const char *filename);
+
+#endif
+
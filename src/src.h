@@ -36,6 +36,9 @@ typedef struct {
 	int audio_len;
 	int eof;
 	
+	/* Samples after which the audio repeats exactly, 0 if it doesn't */
+	long period;
+	
 } src_t;
 
 extern int src_read_stereo(src_t *s, int16_t *dst_l, int step_l, int16_t *dst_r, int step_r, int samples);
@@ -100,6 +100,14 @@ int src_rawaudio_open(src_t *s, const char *filename, int exec, int stereo, int
 	src->channels = stereo ? 2 : 1;
 	src->repeat = repeat;
 	
+	/* A repeated file loops after its length */
+	if(src->repeat && !src->exec && fseek(src->f, 0, SEEK_END) == 0)
+	{
+		s->period = ftell(src->f) / (sizeof(int16_t) * src->channels);
+		if(s->period < 0) s->period = 0;
+		fseek(src->f, 0, SEEK_SET);
+	}
+	
 	/* Allocate memory for output buffer (0.1 seconds) */
 	src->audio_len = SRC_SAMPLE_RATE * 0.1;
 	src->audio = malloc(src->audio_len * sizeof(int16_t) * src->channels);
@@ -34,6 +34,10 @@ typedef struct {
 	double delta;
 	double level;
 	
+	/* Samples in one whole period */
+	long period;
+	long n;
+	
 } src_tone_t;
 
 static int _src_tone_read(src_tone_t *src, int16_t *audio[2], int audio_step[2])
@@ -45,6 +49,13 @@ static int _src_tone_read(src_tone_t *src, int16_t *audio[2], int audio_step[2])
 	{
 		src->audio[i] = sin(src->x) * src->level * INT16_MAX;
 		src->x += src->delta;
+		
+		/* Restart each period to keep the output exactly periodic */
+		if(++src->n == src->period)
+		{
+			src->x = 0;
+			src->n = 0;
+		}
 	}
 	
 	/* Map our mono signal to the two stereo track */
@@ -61,9 +72,24 @@ static int _src_tone_close(src_tone_t *src)
 	return(0);
 }
 
+static long _gcd(long a, long b)
+{
+	long t;
+	
+	while(b)
+	{
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	
+	return(a);
+}
+
 int src_tone_open(src_t *s, double frequency, double level)
 {
 	src_tone_t *src;
+	long f;
 	
 	memset(s, 0, sizeof(src_t));
 	
@@ -87,6 +113,14 @@ int src_tone_open(src_t *s, double frequency, double level)
 	src->delta = 2.0 * M_PI * frequency / SRC_SAMPLE_RATE;
 	src->level = level;
 	
+	/* A whole number of Hz repeats after a whole number of samples */
+	f = lround(fabs(frequency));
+	if(f == fabs(frequency))
+	{
+		src->period = SRC_SAMPLE_RATE / _gcd(f, SRC_SAMPLE_RATE);
+		s->period = src->period;
+	}
+	
 	/* Register the callback functions */
 	s->private = src;
 	s->read = (src_read_t) _src_tone_read;
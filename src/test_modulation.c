@@ -8,12 +8,22 @@
 /* or implied. The user assumes full responsibility for any use of      */
 /* this code.                                                            */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
 #include "dsr.h"
 #include "rf.h"
 #include "rf_file.h"
+#include "rf_convert.h"
+#include "sigmf.h"
+#include "fec.h"
+#include "shmring.h"
+#include "pace.h"
+#include "loop.h"
 
 /* Fixed seed for reproducible test data */
 #define TEST_SEED 0x12345678
@@ -110,6 +120,1250 @@ static int test_modulation_format(int data_type, const char *format_name, const
 	return 0;
 }
 
+/* Compare the threaded modulator against a single-threaded one */
+static int test_modulator_threads(int interpolation, int threads, double offset, int16_t (*audio_data)[TEST_BLOCKS][64 * 32])
+{
+	dsr_t dsr;
+	rf_qpsk_t ref, mt;
+	rf_nco_t ref_nco, mt_nco;
+	uint8_t block[5120];
+	int16_t *a, *b;
+	int block_num;
+	int la, lb;
+	int errors = 0;
+	
+	printf("\n=== Testing modulator: interpolation %d, %d threads, offset %.0f Hz ===\n",
+		interpolation, threads, offset);
+	
+	a = malloc(sizeof(int16_t) * 2 * 20480 * interpolation);
+	b = malloc(sizeof(int16_t) * 2 * 20480 * interpolation);
+	if(!a || !b) {
+		free(a);
+		free(b);
+		return -1;
+	}
+	
+	dsr_init(&dsr);
+	rf_qpsk_init(&ref, interpolation, 0.8);
+	rf_qpsk_init(&mt, interpolation, 0.8);
+	rf_qpsk_set_threads(&mt, threads);
+	
+	if(offset != 0) {
+		rf_nco_init(&ref_nco, offset, DSR_SYMBOL_RATE * interpolation);
+		rf_nco_init(&mt_nco, offset, DSR_SYMBOL_RATE * interpolation);
+		rf_qpsk_set_nco(&ref, &ref_nco);
+		rf_qpsk_set_nco(&mt, &mt_nco);
+	}
+	
+	for(block_num = 0; block_num < TEST_BLOCKS; block_num++) {
+		dsr_encode(&dsr, block, (*audio_data)[block_num]);
+		
+		la = rf_qpsk_modulate(&ref, a, block, 40960);
+		lb = rf_qpsk_modulate(&mt, b, block, 40960);
+		
+		if(la != lb || memcmp(a, b, sizeof(int16_t) * 2 * la) != 0) {
+			fprintf(stderr, "ERROR: Block %d differs from the single-threaded output\n", block_num);
+			errors++;
+			break;
+		}
+	}
+	
+	/* The shift must fit at the default level */
+	if(errors == 0 && (ref.level.clips != 0 || ref.level.wraps != 0)) {
+		fprintf(stderr, "ERROR: %llu samples clipped, %llu wrapped\n",
+			(unsigned long long) ref.level.clips, (unsigned long long) ref.level.wraps);
+		errors++;
+	}
+	
+	rf_qpsk_free(&ref);
+	rf_qpsk_free(&mt);
+	free(a);
+	free(b);
+	
+	if(errors == 0) printf("✓ Output is bit-identical\n");
+	return errors ? -1 : 0;
+}
+
+/* Compare each specialised modulator kernel against the generic one, and
+ * the generic one against the checked one, also at a level that wraps.
+ * The static kernels are reached through the ones rf_qpsk_init() picks:
+ * interpolation 3 has no specialised kernel, a high level gets the
+ * checked one */
+static int test_qpsk_kernels(int16_t (*audio_data)[TEST_BLOCKS][64 * 32])
+{
+	static const int interpolations[] = { 1, 2, 3, 4, 5, 8 };
+	static const double levels[] = { 0.8, 2.5 };
+	rf_qpsk_t m[3];
+	void (*generic)(const rf_qpsk_t *s, int16_t *dst, const uint8_t *syms, int nsym, rf_level_t *level);
+	void (*checked)(const rf_qpsk_t *s, int16_t *dst, const uint8_t *syms, int nsym, rf_level_t *level);
+	dsr_t dsr;
+	uint8_t block[5120];
+	int16_t *out[3];
+	uint64_t wraps = 0;
+	int i, l, k, n, len[3];
+	int block_num;
+	int errors = 0;
+	
+	printf("\n=== Testing specialised modulator kernels ===\n");
+	
+	rf_qpsk_init(&m[0], 3, 0.8);
+	generic = m[0].kernel;
+	rf_qpsk_free(&m[0]);
+	
+	for(i = 0; i < (int) (sizeof(interpolations) / sizeof(interpolations[0])); i++) {
+		for(l = 0; l < 2; l++) {
+			int interpolation = interpolations[i];
+			
+			for(k = 0; k < 3; k++) {
+				rf_qpsk_init(&m[k], interpolation, levels[l]);
+				out[k] = malloc(sizeof(int16_t) * 2 * 20480 * interpolation);
+			}
+			
+			/* m[0] keeps the kernel it was given, m[1] runs the generic
+			 * one and m[2] the checked one on the same taps */
+			rf_qpsk_init(&m[2], interpolation, levels[1]);
+			checked = m[2].kernel;
+			rf_qpsk_free(&m[2]);
+			rf_qpsk_init(&m[2], interpolation, levels[l]);
+			
+			m[1].kernel = generic;
+			m[2].kernel = checked;
+			
+			dsr_init(&dsr);
+			
+			for(block_num = 0; block_num < TEST_BLOCKS && errors == 0; block_num++) {
+				dsr_encode(&dsr, block, (*audio_data)[block_num]);
+				
+				for(k = 0; k < 3; k++) {
+					len[k] = rf_qpsk_modulate(&m[k], out[k], block, 40960);
+				}
+				
+				for(k = 1; k < 3; k++) {
+					n = len[k] == len[0] ? memcmp(out[0], out[k], sizeof(int16_t) * 2 * len[0]) : 1;
+					if(n != 0) {
+						fprintf(stderr, "ERROR: Interpolation %d, level %.1f: the %s kernel differs at block %d\n",
+							interpolation, levels[l], k == 1 ? "generic" : "checked", block_num);
+						errors++;
+					}
+				}
+			}
+			
+			if(l == 1) wraps += m[2].level.wraps;
+			
+			for(k = 0; k < 3; k++) {
+				rf_qpsk_free(&m[k]);
+				free(out[k]);
+			}
+		}
+	}
+	
+	if(errors == 0 && wraps == 0) {
+		fprintf(stderr, "ERROR: Level %.1f never wrapped\n", levels[1]);
+		errors++;
+	}
+	
+	if(errors == 0) printf("✓ Every kernel is bit-identical to the generic one\n");
+	return errors ? -1 : 0;
+}
+
+/* Compare each SIMD conversion kernel against the scalar one */
+static int test_convert(void)
+{
+	static const struct { int type; const char *name; } types[] = {
+		{ RF_UINT8, "uint8" }, { RF_INT8, "int8" }, { RF_UINT16, "uint16" },
+		{ RF_INT16, "int16" }, { RF_INT32, "int32" }, { RF_FLOAT, "float" },
+	};
+	static const char *isas[] = { "scalar", "sse2", "avx2" };
+	int16_t *src;
+	uint8_t *a, *b;
+	int t, isa, n, i;
+	size_t size;
+	int errors = 0;
+	
+	printf("\n=== Testing format conversion (best: %s) ===\n", isas[rf_convert_isa()]);
+	
+	/* Every int16 value, as 32768 complex samples */
+	src = malloc(sizeof(int16_t) * 65536);
+	a = malloc(65536 * 4);
+	b = malloc(65536 * 4);
+	if(!src || !a || !b) {
+		free(src);
+		free(a);
+		free(b);
+		return -1;
+	}
+	
+	for(i = 0; i < 65536; i++) {
+		src[i] = (int16_t)(i - 32768);
+	}
+	
+	for(t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+		size = rf_convert_size(types[t].type);
+		
+		for(isa = RF_CONVERT_SSE2; isa <= rf_convert_isa(); isa++) {
+			/* Full range, then odd lengths and offsets to exercise the tails */
+			for(n = 0; n < 40 && errors == 0; n++) {
+				int len = n == 0 ? 32768 : n;
+				const int16_t *in = n == 0 ? src : src + n * 811 * 2;
+				
+				memset(a, 0xAA, 65536 * 4);
+				memset(b, 0xAA, 65536 * 4);
+				rf_convert_get_isa(types[t].type, RF_CONVERT_SCALAR)(a, in, len);
+				rf_convert_get_isa(types[t].type, isa)(b, in, len);
+				
+				if(memcmp(a, b, 65536 * 4) != 0) {
+					fprintf(stderr, "ERROR: %s %s differs from scalar (%d samples)\n",
+						types[t].name, isas[isa], len);
+					errors++;
+				}
+			}
+			
+			if(errors) break;
+			printf("  %s %s: %zu bytes/sample, matches scalar\n", types[t].name, isas[isa], size);
+		}
+	}
+	
+	free(src);
+	free(a);
+	free(b);
+	
+	if(errors == 0) printf("✓ Conversions are bit-identical\n");
+	return errors ? -1 : 0;
+}
+
+/* Check the SigMF block index against the raw DSR stream */
+static int test_sigmf(const char *filename)
+{
+	sigmf_t meta;
+	uint8_t sync[2];
+	FILE *f;
+	uint64_t n;
+	int errors = 0;
+	
+	printf("\n=== Testing SigMF index: %s ===\n", filename);
+	
+	if(sigmf_open(&meta, filename, RF_UNMOD_UINT8, 0, 0, 0, 0, 0) != 0) {
+		return -1;
+	}
+	
+	meta.blocks = TEST_BLOCKS;
+	sigmf_close(&meta);
+	
+	f = fopen(filename, "rb");
+	if(!f) {
+		perror(filename);
+		return -1;
+	}
+	
+	/* Every indexed block starts with a frame sync */
+	for(n = 0; n < TEST_BLOCKS; n++) {
+		if(fseek(f, sigmf_block_offset(&meta, n), SEEK_SET) != 0 ||
+		   fread(sync, 1, 2, f) != 2 || sync[0] != 0xA9 || sync[1] != 0x59) {
+			fprintf(stderr, "ERROR: No sync at the offset of block %llu\n", (unsigned long long) n);
+			errors++;
+			break;
+		}
+	}
+	
+	fclose(f);
+	
+	/* A fresh encoder starts its first SA cycle 16 frames before block 128 */
+	if(sigmf_sa_offset(&meta, 0) != sigmf_block_offset(&meta, 128) - 16 * meta.frame_bytes) {
+		fprintf(stderr, "ERROR: Wrong SA cycle offset\n");
+		errors++;
+	}
+	
+	if(errors == 0) printf("✓ Index matches the stream\n");
+	return errors ? -1 : 0;
+}
+
+/* Receive on a loopback port of our own */
+static int _loopback(char *port, size_t port_len)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	struct timeval tv = { 1, 0 };
+	int rcvbuf = 4 << 20;
+	int sock;
+	
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+	   getsockname(sock, (struct sockaddr *) &addr, &addr_len) != 0) {
+		perror("socket");
+		if(sock >= 0) close(sock);
+		return -1;
+	}
+	snprintf(port, port_len, "%d", ntohs(addr.sin_port));
+	
+	/* Don't hang if a packet goes missing */
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	
+	return sock;
+}
+
+/* sendmmsg() as udpsink sees it. With _gso_fail_port set, a segmented send
+ * to that port fails the way one over a route with a small MTU does */
+static int _gso_fail_port = 0;
+
+int sendmmsg(int sock, struct mmsghdr *msgs, unsigned int n, int flags)
+{
+	unsigned int i;
+	
+	for(i = 0; _gso_fail_port && i < n; i++)
+	{
+		struct sockaddr_in *sin = msgs[i].msg_hdr.msg_name;
+		
+		if(msgs[i].msg_hdr.msg_iovlen > 1 && sin && ntohs(sin->sin_port) == _gso_fail_port)
+		{
+			break;
+		}
+	}
+	
+	if(!_gso_fail_port) i = n;
+	
+	if(i == 0)
+	{
+		errno = EMSGSIZE;
+		return(-1);
+	}
+	
+	return(syscall(SYS_sendmmsg, sock, msgs, i, flags));
+}
+
+/* Read what has arrived on a loopback port onto the end of out */
+static int _drain(int sock, uint8_t *out, size_t *len, size_t size, int flags)
+{
+	uint8_t pkt[2048];
+	int r;
+	
+	while((r = recv(sock, pkt, sizeof(pkt), flags)) > 0)
+	{
+		if(*len + r > size) return(-1);
+		memcpy(out + *len, pkt, r);
+		*len += r;
+	}
+	
+	return(0);
+}
+
+/* Two destinations, with UDP_SEGMENT failing for the second part way
+ * through a batch: each must still get the stream once, in order */
+static int test_udp_gso_fallback(const char *filename)
+{
+	rf_udp_conf_t conf = { .payload = 1400, .gso = 1, .batch = 4 };
+	size_t size = 5120 * TEST_BLOCKS;
+	uint8_t *data, *out[2];
+	size_t len[2] = { 0, 0 };
+	char port[2][16];
+	void *udp = NULL;
+	FILE *f;
+	int sock[2], n, i;
+	int gso = 1;
+	int errors = 0;
+	
+	printf("\n=== Testing the UDP_SEGMENT fallback with two destinations ===\n");
+	
+	data = malloc(size);
+	out[0] = malloc(size);
+	out[1] = malloc(size);
+	f = fopen(filename, "rb");
+	if(!data || !out[0] || !out[1] || !f || fread(data, 5120, TEST_BLOCKS, f) != TEST_BLOCKS) {
+		fprintf(stderr, "ERROR: Can't read %s\n", filename);
+		if(f) fclose(f);
+		free(data);
+		free(out[0]);
+		free(out[1]);
+		return -1;
+	}
+	fclose(f);
+	
+	sock[0] = _loopback(port[0], sizeof(port[0]));
+	sock[1] = _loopback(port[1], sizeof(port[1]));
+	if(sock[0] < 0 || sock[1] < 0 ||
+	   rf_udp_open_conf(&udp, "127.0.0.1", port[0], &conf) != 0 ||
+	   rf_udp_add_dest(udp, "127.0.0.1", port[1]) != 0) {
+		if(udp) rf_udp_close(udp);
+		if(sock[0] >= 0) close(sock[0]);
+		if(sock[1] >= 0) close(sock[1]);
+		free(data);
+		free(out[0]);
+		free(out[1]);
+		return -1;
+	}
+	
+	_gso_fail_port = atoi(port[1]);
+	
+	for(n = 0; n < TEST_BLOCKS && errors == 0; n++) {
+		rf_udp_send(udp, data + n * 5120, 5120);
+		
+		for(i = 0; i < 2; i++) {
+			if(_drain(sock[i], out[i], &len[i], size, MSG_DONTWAIT) != 0) errors++;
+		}
+	}
+	
+	gso = ((rf_udp_t *) udp)->gso;
+	rf_udp_close(udp);
+	_gso_fail_port = 0;
+	
+	for(i = 0; i < 2; i++) {
+		if(_drain(sock[i], out[i], &len[i], size, MSG_DONTWAIT) != 0 ||
+		   len[i] != size || memcmp(out[i], data, size) != 0) {
+			fprintf(stderr, "ERROR: Destination %d got %zu of %zu bytes, or not in order\n", i + 1, len[i], size);
+			errors++;
+		}
+		close(sock[i]);
+	}
+	
+	if(gso) {
+		fprintf(stderr, "ERROR: The segmented send didn't fail\n");
+		errors++;
+	}
+	
+	free(data);
+	free(out[0]);
+	free(out[1]);
+	
+	if(errors == 0) printf("✓ Both destinations got the stream once, in order\n");
+	return errors ? -1 : 0;
+}
+
+/* Send the raw stream as sequenced packets over loopback and check each one */
+static int test_udp_rtp(const char *filename)
+{
+	rf_udp_conf_t conf = { .payload = 1400, .gso = 1, .rtp = 1 };
+	uint8_t *data, pkt[2048];
+	char port[16];
+	void *udp = NULL;
+	FILE *f;
+	int sock, n, r;
+	int packets = 0;
+	uint16_t seq = 0;
+	int errors = 0;
+	
+	printf("\n=== Testing sequenced UDP packets ===\n");
+	
+	data = malloc(5120 * TEST_BLOCKS);
+	f = fopen(filename, "rb");
+	if(!data || !f || fread(data, 5120, TEST_BLOCKS, f) != TEST_BLOCKS) {
+		fprintf(stderr, "ERROR: Can't read %s\n", filename);
+		if(f) fclose(f);
+		free(data);
+		return -1;
+	}
+	fclose(f);
+	
+	sock = _loopback(port, sizeof(port));
+	if(sock < 0) {
+		free(data);
+		return -1;
+	}
+	
+	if(rf_udp_open_conf(&udp, "127.0.0.1", port, &conf) != 0) {
+		close(sock);
+		free(data);
+		return -1;
+	}
+	
+	for(n = 0; n < TEST_BLOCKS && errors == 0; n++) {
+		int frame = 0;
+		
+		rf_udp_send(udp, data + n * 5120, 5120);
+		
+		/* 17 + 17 + 17 + 13 frame pairs per block */
+		while(frame < 64 && errors == 0) {
+			int count = frame < 51 ? 17 : 13;
+			
+			r = recv(sock, pkt, sizeof(pkt), 0);
+			
+			if(r != RF_UDP_RTP_HEADER + count * 80 ||
+			   pkt[0] != 0x80 || pkt[1] != ((frame == 0 ? 0x80 : 0) | RF_UDP_RTP_TYPE) ||
+			   (pkt[2] << 8 | pkt[3]) != seq ||
+			   ((uint32_t) pkt[4] << 24 | pkt[5] << 16 | pkt[6] << 8 | pkt[7]) != (uint32_t) (n * 64 + frame) * RF_UDP_FRAME_TICKS ||
+			   ((uint32_t) pkt[12] << 24 | pkt[13] << 16 | pkt[14] << 8 | pkt[15]) != n ||
+			   (pkt[16] << 8 | pkt[17]) != frame ||
+			   (pkt[18] << 8 | pkt[19]) != count ||
+			   memcmp(pkt + RF_UDP_RTP_HEADER, data + n * 5120 + frame * 80, count * 80) != 0) {
+				fprintf(stderr, "ERROR: Bad packet %d (block %d, frame pair %d, %d bytes)\n", packets, n, frame, r);
+				errors++;
+			}
+			
+			frame += count;
+			seq++;
+			packets++;
+		}
+	}
+	
+	rf_udp_close(udp);
+	close(sock);
+	free(data);
+	
+	if(errors == 0) printf("✓ %d packets in sequence, frame aligned\n", packets);
+	return errors ? -1 : 0;
+}
+
+/* Wrap the raw stream in MPEG-TS over RTP and take it apart again */
+static int _ts_packet(const uint8_t *p, uint8_t *cc, uint8_t *out, size_t *out_len, uint64_t *pcr)
+{
+	int pid = (p[1] & 0x1F) << 8 | p[2];
+	int af = p[3] & 0x20 ? p[4] + 1 : 0;
+	int first = p[1] & 0x40;
+	size_t n;
+	
+	if(p[0] != 0x47) return(-1);
+	if(pid == TS_NULL_PID) return(0);
+	
+	/* Continuity counters must run on without a gap on every PID */
+	if(cc[pid] != 0xFF && ((cc[pid] + 1) & 0x0F) != (p[3] & 0x0F)) return(-1);
+	cc[pid] = p[3] & 0x0F;
+	
+	if(pid != 0x100) return(0);
+	
+	if(first)
+	{
+		if(af < 8 || !(p[5] & 0x10) || p[4 + af + 3] != 0xBD) return(-1);
+		*pcr = ((uint64_t) p[6] << 25 | p[7] << 17 | p[8] << 9 | p[9] << 1 | p[10] >> 7) * 300 +
+			((p[10] & 1) << 8 | p[11]);
+		af += 14;
+	}
+	
+	n = TS_PACKET - 4 - af;
+	memcpy(out + *out_len, p + 4 + af, n);
+	*out_len += n;
+	
+	return(first ? 2 : 1);
+}
+
+static int test_udp_ts(const char *filename)
+{
+	rf_udp_conf_t conf = { .payload = 1400, .gso = 1, .ts = 2, .ts_pid = 0x100, .queue = 4 };
+	uint8_t *data, *out, pkt[2048], cc[8192];
+	uint64_t queued = 0;
+	size_t out_len = 0;
+	uint64_t pcr = 0;
+	uint16_t seq = 0;
+	char port[16];
+	void *udp = NULL;
+	FILE *f;
+	int sock, n, r, i, len;
+	int datagrams = 0, packets = 0, blocks = 0, tail = 0;
+	int errors = 0;
+	
+	printf("\n=== Testing MPEG-TS over RTP ===\n");
+	
+	/* The stream may end on a full datagram, so stop on the packet count */
+	
+	data = malloc(5120 * TEST_BLOCKS);
+	out = malloc(5120 * TEST_BLOCKS + 4096);
+	f = fopen(filename, "rb");
+	if(!data || !out || !f || fread(data, 5120, TEST_BLOCKS, f) != TEST_BLOCKS) {
+		fprintf(stderr, "ERROR: Can't read %s\n", filename);
+		if(f) fclose(f);
+		free(data);
+		free(out);
+		return -1;
+	}
+	fclose(f);
+	
+	sock = _loopback(port, sizeof(port));
+	if(sock < 0 || rf_udp_open_conf(&udp, "127.0.0.1", port, &conf) != 0) {
+		if(sock >= 0) close(sock);
+		free(data);
+		free(out);
+		return -1;
+	}
+	memset(cc, 0xFF, sizeof(cc));
+	
+	for(n = 0; n <= TEST_BLOCKS && errors == 0; n++) {
+		
+		/* Close after the last block to send the part-full datagram */
+		if(n < TEST_BLOCKS) {
+			rf_udp_send(udp, data + n * 5120, 5120);
+		} else {
+			queued = ((rf_udp_t *) udp)->queued_packets;
+			rf_udp_close(udp);
+		}
+		
+		while(errors == 0 && packets < 30 * TEST_BLOCKS && (r = recv(sock, pkt, sizeof(pkt), n < TEST_BLOCKS ? MSG_DONTWAIT : 0)) > 0) {
+			
+			/* Only the last datagram may be short */
+			if(tail || (r - 12) % TS_PACKET != 0 || pkt[0] != 0x80 || pkt[1] != RF_UDP_TS_RTP_TYPE ||
+			   (pkt[2] << 8 | pkt[3]) != seq) {
+				fprintf(stderr, "ERROR: Bad datagram %d (%d bytes)\n", datagrams, r);
+				errors++;
+				break;
+			}
+			
+			if(r != 12 + RF_UDP_TS_PACKETS * TS_PACKET) tail = 1;
+			
+			for(i = 12, len = r; i < len && errors == 0; i += TS_PACKET, packets++) {
+				r = _ts_packet(pkt + i, cc, out, &out_len, &pcr);
+				
+				/* Each block starts a PES packet, with a PCR inside its 2ms */
+				if(r < 0 || (r == 2 && pcr / TS_BLOCK_TICKS != (uint64_t) blocks++)) {
+					fprintf(stderr, "ERROR: Bad TS packet %d\n", packets);
+					errors++;
+				}
+			}
+			
+			seq++;
+			datagrams++;
+		}
+	}
+	
+	if(errors == 0 && (blocks != TEST_BLOCKS ||
+	   packets != 30 * TEST_BLOCKS || out_len != 5120 * TEST_BLOCKS ||
+	   memcmp(out, data, out_len) != 0 || queued != (uint64_t) packets / RF_UDP_TS_PACKETS)) {
+		fprintf(stderr, "ERROR: %d TS packets, %zu bytes in %d blocks, %llu datagrams queued\n",
+			packets, out_len, blocks, (unsigned long long) queued);
+		errors++;
+	}
+	
+	if(n <= TEST_BLOCKS) rf_udp_close(udp);
+	close(sock);
+	free(data);
+	free(out);
+	
+	if(errors == 0) printf("✓ %d datagrams, %d TS packets, payload and PCR intact\n", datagrams, packets);
+	return errors ? -1 : 0;
+}
+
+/* Lose a burst and some scattered packets, and rebuild the stream with parity */
+static int test_udp_fec(const char *filename)
+{
+	rf_udp_conf_t conf = { .payload = 1400, .rtp = 1, .fec_cols = 8, .fec_rows = 4, .fec_row = 1 };
+	fec_enc_t enc;
+	fec_dec_t dec;
+	uint8_t *data, *out, pkt[2048];
+	const uint8_t *p;
+	char port[16];
+	void *udp = NULL;
+	FILE *f;
+	size_t len, pos = 0;
+	int sock, n, r;
+	int media = 0, dropped = 0;
+	int errors = 0;
+	
+	printf("\n=== Testing UDP parity recovery ===\n");
+	
+	/* Matrices past the SMPTE 2022-1 limits would outrun the receiver */
+	if(fec_enc_init(&enc, 20, 20, 0, 1400, 0) == 0 || fec_enc_init(&enc, 21, 4, 0, 1400, 0) == 0 ||
+	   fec_enc_init(&enc, 20, 5, 1, 1400, 0) != 0) {
+		fprintf(stderr, "ERROR: Parity matrix limits not kept\n");
+		return -1;
+	}
+	fec_enc_free(&enc);
+	
+	data = malloc(5120 * TEST_BLOCKS);
+	out = calloc(5120, TEST_BLOCKS);
+	f = fopen(filename, "rb");
+	if(!data || !out || !f || fread(data, 5120, TEST_BLOCKS, f) != TEST_BLOCKS ||
+	   fec_dec_init(&dec, 2048, 128) != 0) {
+		fprintf(stderr, "ERROR: Can't read %s\n", filename);
+		if(f) fclose(f);
+		free(data);
+		free(out);
+		return -1;
+	}
+	fclose(f);
+	
+	sock = _loopback(port, sizeof(port));
+	if(sock < 0 || rf_udp_open_conf(&udp, "127.0.0.1", port, &conf) != 0) {
+		if(sock >= 0) close(sock);
+		free(data);
+		free(out);
+		fec_dec_free(&dec);
+		return -1;
+	}
+	
+	/* Media packets 40-47 are lost in a burst, then every 37th after that */
+	for(n = 0; n <= TEST_BLOCKS; n++) {
+		if(n < TEST_BLOCKS) {
+			rf_udp_send(udp, data + n * 5120, 5120);
+		} else {
+			rf_udp_close(udp);
+		}
+		
+		while((r = recv(sock, pkt, sizeof(pkt), MSG_DONTWAIT)) > 0) {
+			if((pkt[1] & 0x7F) == RF_UDP_RTP_TYPE) {
+				int lose = (media >= 40 && media < 48) || (media > 48 && media % 37 == 0);
+				media++;
+				
+				if(lose) {
+					dropped++;
+					continue;
+				}
+			}
+			
+			fec_dec_push(&dec, pkt, r);
+			
+			while(fec_dec_pop(&dec, &p, &len) > 0) {
+				memcpy(out + pos, p + RF_UDP_RTP_HEADER, len - RF_UDP_RTP_HEADER);
+				pos += len - RF_UDP_RTP_HEADER;
+			}
+		}
+	}
+	
+	fec_dec_flush(&dec);
+	while((r = fec_dec_pop(&dec, &p, &len)) != 0) {
+		if(r < 0) continue;
+		memcpy(out + pos, p + RF_UDP_RTP_HEADER, len - RF_UDP_RTP_HEADER);
+		pos += len - RF_UDP_RTP_HEADER;
+	}
+	
+	if(dec.recovered != dropped || dec.lost != 0 || pos != 5120 * TEST_BLOCKS ||
+	   memcmp(out, data, pos) != 0) {
+		fprintf(stderr, "ERROR: %d dropped, %llu recovered, %llu lost\n",
+			dropped, (unsigned long long) dec.recovered, (unsigned long long) dec.lost);
+		errors++;
+	}
+	
+	close(sock);
+	fec_dec_free(&dec);
+	free(data);
+	free(out);
+	
+	if(errors == 0) printf("✓ %d of %d packets lost and rebuilt\n", dropped, media);
+	return errors ? -1 : 0;
+}
+
+/* Connect to the stream server's Unix socket */
+static int _server_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	struct timeval tv = { 1, 0 };
+	int sock;
+	
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if(sock < 0 || connect(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+		perror("connect");
+		if(sock >= 0) close(sock);
+		return -1;
+	}
+	
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	
+	/* Nothing written before the server takes the client on is sent to it */
+	usleep(100000);
+	
+	return sock;
+}
+
+/* Read the next frame, returns its block number, -1 at the end of the
+ * stream or -2 on an error */
+static long _server_frame(int sock, uint8_t *buf, size_t size, size_t *len)
+{
+	uint8_t h[RF_SERVER_HEADER];
+	size_t want = sizeof(h), got = 0;
+	uint8_t *p = h;
+	int r, i;
+	
+	for(i = 0; i < 2; i++) {
+		while(got < want) {
+			r = recv(sock, p + got, want - got, 0);
+			if(r == 0) return -1;
+			if(r < 0) return -2;
+			got += r;
+		}
+		
+		if(i == 0) {
+			*len = (size_t) h[0] << 24 | h[1] << 16 | h[2] << 8 | h[3];
+			if(*len > size) return -2;
+			p = buf;
+			want = *len;
+			got = 0;
+		}
+	}
+	
+	return (long) ((uint32_t) h[4] << 24 | h[5] << 16 | h[6] << 8 | h[7]);
+}
+
+/* A client that stops reading while the encoder runs ahead of it. The
+ * writes must never wait, and what the client then reads must be whole
+ * frames, skipped ahead or cut off by the policy */
+static int _server_flood(const uint8_t *data, int skip)
+{
+	rf_server_conf_t conf = { .queue = 4, .skip = skip };
+	const char *path = "test_output/server.sock";
+	uint8_t buf[5120];
+	rf_t rf;
+	size_t len;
+	long block, last = -1;
+	int sock, n, frames = 0, gaps = 0, end = 0;
+	int errors = 0;
+	
+	if(rf_server_open(&rf, "unix:test_output/server.sock", RF_UNMOD_UINT8, &conf) != 0) return -1;
+	
+	sock = _server_connect(path);
+	if(sock < 0) {
+		rf_close(&rf);
+		return -1;
+	}
+	
+	/* Spaced out a little, so the socket fills before the ring laps it */
+	for(n = 0; n < 2000; n++) {
+		rf_write(&rf, (int16_t *) (data + (n % TEST_BLOCKS) * 5120), 5120);
+		usleep(100);
+	}
+	
+	while(errors == 0 && (block = _server_frame(sock, buf, sizeof(buf), &len)) != -1) {
+		if(block < 0 || block <= last || len != 5120 ||
+		   memcmp(buf, data + (block % TEST_BLOCKS) * 5120, 5120) != 0) {
+			fprintf(stderr, "ERROR: Bad frame after block %ld (%ld, %zu bytes)\n", last, block, len);
+			errors++;
+			break;
+		}
+		
+		if(block != last + 1) gaps++;
+		last = block;
+		frames++;
+		
+		/* All caught up */
+		if(skip && block == n - 1) break;
+	}
+	
+	if(block == -1) end = 1;
+	
+	if(errors == 0 && (skip ? gaps == 0 || last != n - 1 : gaps != 0 || !end)) {
+		fprintf(stderr, "ERROR: %d frames, %d gaps, last block %ld%s\n", frames, gaps, last, end ? ", closed" : "");
+		errors++;
+	}
+	
+	close(sock);
+	rf_close(&rf);
+	
+	if(errors == 0) {
+		if(skip) printf("✓ Slow client skipped ahead %d times, read %d whole frames\n", gaps, frames);
+		else printf("✓ Slow client closed after %d whole frames\n", frames);
+	}
+	
+	return errors ? -1 : 0;
+}
+
+/* Serve the raw stream over a Unix socket and read back every frame */
+static int test_server(const char *filename)
+{
+	const char *path = "test_output/server.sock";
+	uint8_t *data, buf[5120];
+	rf_t rf;
+	size_t len;
+	long block;
+	FILE *f;
+	int sock, n;
+	int errors = 0;
+	
+	printf("\n=== Testing the stream server ===\n");
+	
+	data = malloc(5120 * TEST_BLOCKS);
+	f = fopen(filename, "rb");
+	if(!data || !f || fread(data, 5120, TEST_BLOCKS, f) != TEST_BLOCKS) {
+		fprintf(stderr, "ERROR: Can't read %s\n", filename);
+		if(f) fclose(f);
+		free(data);
+		return -1;
+	}
+	fclose(f);
+	
+	if(rf_server_open(&rf, "unix:test_output/server.sock", RF_UNMOD_UINT8, NULL) != 0) {
+		free(data);
+		return -1;
+	}
+	
+	sock = _server_connect(path);
+	
+	for(n = 0; sock >= 0 && n < TEST_BLOCKS && errors == 0; n++) {
+		rf_write(&rf, (int16_t *) (data + n * 5120), 5120);
+		
+		block = _server_frame(sock, buf, sizeof(buf), &len);
+		if(block != n || len != 5120 || memcmp(buf, data + n * 5120, 5120) != 0) {
+			fprintf(stderr, "ERROR: Bad frame %d (block %ld, %zu bytes)\n", n, block, len);
+			errors++;
+		}
+	}
+	
+	if(sock < 0) errors++;
+	else close(sock);
+	rf_close(&rf);
+	
+	if(errors == 0) printf("✓ %d frames in order\n", TEST_BLOCKS);
+	
+	if(errors == 0 && _server_flood(data, 1) != 0) errors++;
+	if(errors == 0 && _server_flood(data, 0) != 0) errors++;
+	
+	free(data);
+	
+	return errors ? -1 : 0;
+}
+
+/* Pass the raw stream through the shared memory ring, around it several
+ * times, then fill it and check the overflow is dropped and counted */
+static int test_shm(const char *filename)
+{
+	rf_shm_conf_t conf = { .slots = 8, .drop = 1, .frame_size = 5120 };
+	shmring_t reader;
+	const uint8_t *p;
+	uint8_t *data;
+	uint32_t block;
+	size_t len;
+	rf_t rf;
+	FILE *f;
+	int n, r;
+	int errors = 0;
+	
+	printf("\n=== Testing the shared memory ring ===\n");
+	
+	data = malloc(5120 * TEST_BLOCKS);
+	f = fopen(filename, "rb");
+	if(!data || !f || fread(data, 5120, TEST_BLOCKS, f) != TEST_BLOCKS) {
+		fprintf(stderr, "ERROR: Can't read %s\n", filename);
+		if(f) fclose(f);
+		free(data);
+		return -1;
+	}
+	fclose(f);
+	
+	if(rf_shm_open(&rf, "/dsr-test", RF_UNMOD_UINT8, &conf) != 0) {
+		free(data);
+		return -1;
+	}
+	
+	if(shmring_open(&reader, "/dsr-test", 0) != 0) {
+		rf_close(&rf);
+		free(data);
+		return -1;
+	}
+	
+	/* Three blocks behind at a time */
+	for(n = 0; n < TEST_BLOCKS + 3 && errors == 0; n++) {
+		if(n < TEST_BLOCKS) rf_write(&rf, (int16_t *) (data + n * 5120), 5120);
+		if(n < 3) continue;
+		
+		r = shmring_read(&reader, &p, &len, &block, 0);
+		if(r != 1 || block != (uint32_t) n - 3 || len != 5120 || memcmp(p, data + (n - 3) * 5120, 5120) != 0) {
+			fprintf(stderr, "ERROR: Bad block %d (%d, block %u, %zu bytes)\n", n - 3, r, block, len);
+			errors++;
+		}
+		
+		shmring_release(&reader);
+	}
+	
+	/* Twice as many as fit, the second half is dropped */
+	for(n = 0; n < 16; n++) {
+		rf_write(&rf, (int16_t *) (data + n * 5120), 5120);
+	}
+	
+	for(n = 0; errors == 0 && (r = shmring_read(&reader, &p, &len, &block, 0)) == 1; n++) {
+		if(block != (uint32_t) TEST_BLOCKS + n || memcmp(p, data + n * 5120, 5120) != 0) {
+			fprintf(stderr, "ERROR: Bad block %u after the overflow\n", block);
+			errors++;
+		}
+		
+		shmring_release(&reader);
+	}
+	
+	if(errors == 0 && (n != 8 || reader.h->dropped != 8)) {
+		fprintf(stderr, "ERROR: Read %d blocks, %llu dropped\n", n, (unsigned long long) reader.h->dropped);
+		errors++;
+	}
+	
+	/* The reader hears when the writer goes */
+	rf_close(&rf);
+	if(errors == 0 && shmring_read(&reader, &p, &len, &block, 1000) != -1) {
+		fprintf(stderr, "ERROR: Ring not closed\n");
+		errors++;
+	}
+	
+	shmring_close(&reader);
+	free(data);
+	
+	if(errors == 0) printf("✓ %d blocks through 8 slots, 8 dropped when full\n", TEST_BLOCKS);
+	return errors ? -1 : 0;
+}
+
+/* Split the raw stream into segments and check they join back up */
+static int test_segments(const char *filename)
+{
+	rf_fileio_conf_t conf;
+	rf_fileio_t *io;
+	uint8_t *data, *seg;
+	char name[256];
+	FILE *f;
+	long len, pos;
+	size_t n;
+	int i, count;
+	int errors = 0;
+	
+	printf("\n=== Testing segmented output ===\n");
+	
+	data = malloc(5120 * TEST_BLOCKS);
+	seg = malloc(5120 * 7);
+	f = fopen(filename, "rb");
+	if(!data || !seg || !f || (len = fread(data, 1, 5120 * TEST_BLOCKS, f)) != 5120 * TEST_BLOCKS) {
+		fprintf(stderr, "ERROR: Failed to read %s\n", filename);
+		if(f) fclose(f);
+		free(data);
+		free(seg);
+		return -1;
+	}
+	fclose(f);
+	
+	/* 7 blocks to a segment, keeping the last 3, written in odd sized pieces */
+	memset(&conf, 0, sizeof(conf));
+	conf.buffer_size = 12345;
+	conf.segment = 5120 * 7;
+	conf.keep = 3;
+	
+	io = rf_fileio_open("test_output/test_segment.bin", &conf);
+	if(!io) {
+		free(data);
+		free(seg);
+		return -1;
+	}
+	
+	for(pos = 0; pos < len; pos += n) {
+		n = len - pos < 3001 ? len - pos : 3001;
+		rf_fileio_write(io, data + pos, n);
+	}
+	
+	if(rf_fileio_close(io) != 0) errors++;
+	
+	/* 50 blocks make 7 full segments and one of a single block */
+	count = (TEST_BLOCKS + 6) / 7;
+	for(i = 0; i < count; i++) {
+		rf_fileio_segment_name(name, sizeof(name), "test_output/test_segment.bin", i);
+		f = fopen(name, "rb");
+		
+		if(i < count - 3) {
+			if(f) {
+				fprintf(stderr, "ERROR: %s should have been removed\n", name);
+				fclose(f);
+				errors++;
+			}
+			continue;
+		}
+		
+		n = f ? fread(seg, 1, 5120 * 7, f) : 0;
+		if(f) fclose(f);
+		
+		pos = (long) i * 5120 * 7;
+		if(n != (len - pos < 5120 * 7 ? len - pos : 5120 * 7) || memcmp(seg, data + pos, n) != 0) {
+			fprintf(stderr, "ERROR: %s doesn't match the stream\n", name);
+			errors++;
+		}
+	}
+	
+	free(data);
+	free(seg);
+	
+	if(errors == 0) printf("✓ Segments match the stream\n");
+	return errors ? -1 : 0;
+}
+
+/* Render a stream of 128 block period live, and through the loop cache
+ * the way dsrtx does. The audio is chosen so the differential modulator
+ * turns the carrier over a period, and the cached output has to take in
+ * more than one, or fall back to the encoded blocks */
+static int test_loop(void)
+{
+	const int blocks = LOOP_WARMUP + LOOP_PERIODS * 128 + 64;
+	const size_t iq_len = sizeof(int16_t) * 2 * (MUX_BLOCK_BITS / 2) * 2;
+	rf_qpsk_t live, looped;
+	rf_qpsk_state_t state;
+	loop_t loop, enc;
+	dsr_t dsr;
+	int16_t audio[64 * 32];
+	int16_t *a, *b;
+	uint8_t *bits;
+	long longest = 0;
+	int v, p, n, raw;
+	int fallbacks = 0;
+	int errors = 0;
+	
+	printf("\n=== Testing loop playback ===\n");
+	
+	a = malloc(iq_len);
+	b = malloc(iq_len);
+	bits = malloc((size_t) MUX_BLOCK_BYTES * blocks);
+	if(!a || !b || !bits) {
+		free(a);
+		free(b);
+		free(bits);
+		return -1;
+	}
+	
+	for(v = 0; v < 4 && errors == 0; v++) {
+		
+		/* Periodic audio, so the encoded stream repeats every 128 blocks */
+		dsr_init(&dsr);
+		for(n = 0; n < blocks; n++) {
+			generate_test_audio(audio, v * 1000 + n % 128);
+			dsr_encode(&dsr, bits + (size_t) MUX_BLOCK_BYTES * n, audio);
+		}
+		
+		/* Room for every period it may take, then for just the one */
+		for(p = 0; p < 2 && errors == 0; p++) {
+			rf_qpsk_init(&live, 2, 0.8);
+			rf_qpsk_init(&looped, 2, 0.8);
+			loop_open(&loop, 128, p ? 1 : LOOP_PERIODS, iq_len, NULL);
+			loop_open(&enc, 128, 1, MUX_BLOCK_BYTES, NULL);
+			raw = 0;
+			
+			for(n = 0; n < blocks && errors == 0; n++) {
+				const uint8_t *block = bits + (size_t) MUX_BLOCK_BYTES * n;
+				
+				rf_qpsk_modulate(&live, a, block, MUX_BLOCK_BITS);
+				
+				if(loop_ready(&loop)) {
+					if(raw) rf_qpsk_modulate(&looped, b, loop_block(&loop, n - LOOP_WARMUP), MUX_BLOCK_BITS);
+					else memcpy(b, loop_block(&loop, n - LOOP_WARMUP), iq_len);
+				}
+				else {
+					rf_qpsk_modulate(&looped, b, block, MUX_BLOCK_BITS);
+					
+					if(n >= LOOP_WARMUP) {
+						memcpy(loop_block(&loop, n - LOOP_WARMUP), b, iq_len);
+						memcpy(loop_block(&enc, n - LOOP_WARMUP), block, MUX_BLOCK_BYTES);
+					}
+					
+					if(n >= LOOP_WARMUP - 1) {
+						rf_qpsk_get_state(&looped, &state);
+						if(loop_state(&loop, n - LOOP_WARMUP, &state, 1) != 0) {
+							loop_close(&loop);
+							loop = enc;
+							memset(&enc, 0, sizeof(loop_t));
+							raw = 1;
+							fallbacks++;
+						}
+						else if(loop_ready(&loop) && loop.blocks > longest) {
+							longest = loop.blocks;
+						}
+					}
+				}
+				
+				if(memcmp(a, b, iq_len) != 0) {
+					fprintf(stderr, "ERROR: Audio %d, room for %d periods: block %d differs\n",
+						v, p ? 1 : LOOP_PERIODS, n);
+					errors++;
+				}
+			}
+			
+			if(errors == 0 && !loop_ready(&loop)) {
+				fprintf(stderr, "ERROR: Audio %d, room for %d periods: never looped\n",
+					v, p ? 1 : LOOP_PERIODS);
+				errors++;
+			}
+			
+			loop_close(&loop);
+			loop_close(&enc);
+			rf_qpsk_free(&live);
+			rf_qpsk_free(&looped);
+		}
+	}
+	
+	if(errors == 0 && (longest <= 128 || fallbacks == 0)) {
+		fprintf(stderr, "ERROR: The carrier never turned over a period\n");
+		errors++;
+	}
+	
+	free(a);
+	free(b);
+	free(bits);
+	
+	if(errors == 0) printf("✓ Looped output identical, up to %ld blocks cached, %d fallbacks\n", longest, fallbacks);
+	return errors ? -1 : 0;
+}
+
+static uint64_t _pace_now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Pace 2ms blocks, working 0.5ms on each, then fall behind a little
+ * and then past max_late */
+static int test_pace(void)
+{
+	pace_t pace;
+	uint64_t now, due, start;
+	int i;
+	int errors = 0;
+	
+	printf("\n=== Testing real-time pacing ===\n");
+	
+	pace_init(&pace, DSR_BLOCK_RATE, 0.02);
+	start = pace.start;
+	
+	/* Absolute deadlines absorb the work done between blocks. Sleeping
+	 * a period after each would drift 20ms over the 40 blocks */
+	for(i = 0; i < 40 && errors == 0; i++) {
+		pace_wait(&pace);
+		now = _pace_now();
+		due = pace.start + (pace.block - 1) * pace.period;
+		if(now < due) {
+			fprintf(stderr, "ERROR: Block %d sent %.3f ms early\n", i, (due - now) / 1e6);
+			errors++;
+		}
+		usleep(500);
+	}
+	
+	if(errors == 0 && now - start > 39 * pace.period + 5000000) {
+		fprintf(stderr, "ERROR: 40 blocks took %.3f ms\n", (now - start) / 1e6);
+		errors++;
+	}
+	
+	/* 9ms behind: the blocks already due go out at once to catch up,
+	 * on the same timeline */
+	usleep(9000);
+	for(i = 0; i < 10; i++) {
+		pace_wait(&pace);
+	}
+	
+	if(errors == 0 && (pace.start != start || pace.resyncs != 0 || pace.late < 3)) {
+		fprintf(stderr, "ERROR: Catching up: %llu late blocks, %llu resyncs\n",
+			(unsigned long long) pace.late, (unsigned long long) pace.resyncs);
+		errors++;
+	}
+	
+	/* 50ms behind, past max_late: the timeline moves forward and the
+	 * following blocks keep the period rather than bursting */
+	usleep(50000);
+	pace_wait(&pace);
+	
+	if(errors == 0 && (pace.resyncs != 1 || pace.start < start + 40000000)) {
+		fprintf(stderr, "ERROR: Timeline moved %.3f ms in %llu resyncs\n",
+			((double) pace.start - start) / 1e6, (unsigned long long) pace.resyncs);
+		errors++;
+	}
+	
+	start = _pace_now();
+	for(i = 1; i <= 5 && errors == 0; i++) {
+		pace_wait(&pace);
+		now = _pace_now();
+		due = pace.start + (pace.block - 1) * pace.period;
+		if(now < due || now - start < i * pace.period - 1000000) {
+			fprintf(stderr, "ERROR: Block %d after the resync sent at %.3f ms\n", i, (now - start) / 1e6);
+			errors++;
+		}
+	}
+	
+	if(errors == 0 && pace.resyncs != 1) {
+		fprintf(stderr, "ERROR: %llu resyncs\n", (unsigned long long) pace.resyncs);
+		errors++;
+	}
+	
+	if(errors == 0) printf("✓ Deadlines kept, catch up and resync as expected\n");
+	return errors ? -1 : 0;
+}
+
 int main(int argc, char **argv)
 {
 	const char *output_dir = "test_output";
@@ -181,6 +1435,31 @@ int main(int argc, char **argv)
 	if(test_modulation_format(RF_UNMOD_UINT8, "unmod_uint8 (raw)", 
 		"test_output/test_unmod_uint8_raw.bin", &audio_data) != 0) errors++;
 	
+	if(test_sigmf("test_output/test_unmod_uint8_raw.bin") != 0) errors++;
+	if(test_segments("test_output/test_unmod_uint8_raw.bin") != 0) errors++;
+	if(test_udp_gso_fallback("test_output/test_unmod_uint8_raw.bin") != 0) errors++;
+	if(test_udp_rtp("test_output/test_unmod_uint8_raw.bin") != 0) errors++;
+	if(test_udp_fec("test_output/test_unmod_uint8_raw.bin") != 0) errors++;
+	if(test_udp_ts("test_output/test_unmod_uint8_raw.bin") != 0) errors++;
+	if(test_server("test_output/test_unmod_uint8_raw.bin") != 0) errors++;
+	if(test_shm("test_output/test_unmod_uint8_raw.bin") != 0) errors++;
+	
+	/* Specialised modulator kernels must match the generic one exactly */
+	if(test_qpsk_kernels(&audio_data) != 0) errors++;
+	
+	/* Threaded modulator must match the single-threaded output exactly */
+	if(test_modulator_threads(2, 4, 0, &audio_data) != 0) errors++;
+	if(test_modulator_threads(3, 2, 0, &audio_data) != 0) errors++;
+	if(test_modulator_threads(8, 3, 5e6, &audio_data) != 0) errors++;
+	
+	/* SIMD sample conversions must match the scalar ones exactly */
+	if(test_convert() != 0) errors++;
+	
+	if(test_pace() != 0) errors++;
+	
+	/* Looped output must match rendering every block */
+	if(test_loop() != 0) errors++;
+	
 	printf("\n========================================\n");
 	if(errors == 0) {
 		printf("✓ All tests completed successfully!\n");
@@ -192,8 +1471,9 @@ int main(int argc, char **argv)
 		printf("  test_output/test_int32_modulated.iq\n");
 		printf("  test_output/test_float_modulated.iq\n");
 		printf("  test_output/test_unmod_uint8_raw.bin\n");
-		printf("\nNote: unmod_udp format requires UDP socket setup\n");
-		printf("      and is not tested in this standalone test.\n");
+		printf("  test_output/test_unmod_uint8_raw.bin.sigmf-meta\n");
+		printf("\nNote: unmod_udp is only sent over loopback, in the\n");
+		printf("      sequenced packet format, and not written to a file.\n");
 	} else {
 		printf("✗ %d test(s) failed!\n", errors);
 	}
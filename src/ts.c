@@ -0,0 +1,267 @@
+/* dsr - Digital Satellite Radio (DSR) encoder                          */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+/* MPEG transport stream packetiser, see ts.h */
+
+#include <stdint.h>
+#include <string.h>
+#include "ts.h"
+
+/* PES header with a PTS, and an adaptation field holding only a PCR */
+#define _PES_HEADER 14
+#define _PCR_FIELD  8
+
+static uint32_t _crc32(const uint8_t *p, size_t len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	int i;
+	
+	/* CRC-32/MPEG-2, MSB first with no final XOR */
+	while(len--)
+	{
+		crc ^= (uint32_t) *p++ << 24;
+		
+		for(i = 0; i < 8; i++)
+		{
+			crc = crc & 0x80000000 ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+		}
+	}
+	
+	return(crc);
+}
+
+/* A whole packet of a table section, sent as it is but for the continuity counter */
+static void _section(uint8_t *pkt, int pid, const uint8_t *section, size_t len)
+{
+	uint32_t crc = _crc32(section, len);
+	
+	memset(pkt, 0xFF, TS_PACKET);
+	
+	pkt[0] = 0x47;
+	pkt[1] = 0x40 | pid >> 8;
+	pkt[2] = pid & 0xFF;
+	pkt[3] = 0x10;
+	pkt[4] = 0x00;
+	
+	memcpy(pkt + 5, section, len);
+	pkt[5 + len] = crc >> 24;
+	pkt[6 + len] = crc >> 16;
+	pkt[7 + len] = crc >> 8;
+	pkt[8 + len] = crc;
+}
+
+static int _data_packets(size_t len)
+{
+	return((_PCR_FIELD + _PES_HEADER + len + 183) / 184);
+}
+
+int ts_mux_min_packets(size_t len)
+{
+	/* Room for the PAT and PMT in the blocks that carry them */
+	return(_data_packets(len) + 2);
+}
+
+int ts_mux_init(ts_mux_t *s, int pid, uint64_t rate, size_t len)
+{
+	int min = ts_mux_min_packets(len);
+	
+	memset(s, 0, sizeof(ts_mux_t));
+	
+	if(pid < 0x10 || pid >= TS_NULL_PID || pid == TS_PMT_PID)
+	{
+		return(-1);
+	}
+	
+	s->pid = pid;
+	
+	/* Whole packets per block, so each one starts on time */
+	s->packets = (rate + TS_PACKET * 8 * 500 - 1) / (TS_PACKET * 8 * 500);
+	if(rate == 0) s->packets = min;
+	if(s->packets < min) return(-1);
+	
+	s->rate = (uint64_t) s->packets * TS_PACKET * 8 * 500;
+	
+	/* One program, its PMT and the data PID that carries the PCR */
+	const uint8_t pat[] = {
+		0x00, 0xB0, 13, 0x00, 0x01, 0xC1, 0x00, 0x00,
+		0x00, 0x01, 0xE0 | TS_PMT_PID >> 8, TS_PMT_PID & 0xFF,
+	};
+	
+	const uint8_t pmt[] = {
+		0x02, 0xB0, 24, 0x00, 0x01, 0xC1, 0x00, 0x00,
+		0xE0 | pid >> 8, pid & 0xFF, 0xF0, 0x00,
+		0x06, 0xE0 | pid >> 8, pid & 0xFF, 0xF0, 6,
+		0x05, 4, 'D', 'S', 'R', '1',
+	};
+	
+	_section(s->pat, TS_PAT_PID, pat, sizeof(pat));
+	_section(s->pmt, TS_PMT_PID, pmt, sizeof(pmt));
+	
+	return(0);
+}
+
+void ts_mux_block(ts_mux_t *s, const uint8_t *data, size_t len)
+{
+	s->block = s->blocks++;
+	s->data = data;
+	s->len = len;
+	s->pos = 0;
+	s->index = 0;
+	s->sent = 0;
+	s->psi = s->block % TS_PSI_BLOCKS == 0 ? 2 : 0;
+	s->due = s->psi + _data_packets(len);
+}
+
+static void _table(uint8_t *out, const uint8_t *table, uint8_t *cc)
+{
+	memcpy(out, table, TS_PACKET);
+	out[3] = 0x10 | (*cc & 0x0F);
+	(*cc)++;
+}
+
+static void _null(uint8_t *out)
+{
+	out[0] = 0x47;
+	out[1] = TS_NULL_PID >> 8;
+	out[2] = TS_NULL_PID & 0xFF;
+	out[3] = 0x10;
+	memset(out + 4, 0xFF, TS_PACKET - 4);
+}
+
+static void _data(ts_mux_t *s, uint8_t *out, uint64_t pcr)
+{
+	int first = s->pos == 0;
+	size_t pes = first ? _PES_HEADER : 0;
+	size_t af = first ? _PCR_FIELD : 0;
+	size_t n = s->len - s->pos;
+	uint64_t base = (pcr / 300) & 0x1FFFFFFFFULL;
+	uint64_t pts;
+	uint8_t *p = out + 4;
+	size_t plen;
+	
+	/* Fill the packet, or stretch the adaptation field over the rest */
+	if(af + pes + n > TS_PACKET - 4) n = TS_PACKET - 4 - af - pes;
+	else af = TS_PACKET - 4 - pes - n;
+	
+	out[0] = 0x47;
+	out[1] = (first ? 0x40 : 0x00) | s->pid >> 8;
+	out[2] = s->pid & 0xFF;
+	out[3] = (af > 0 ? 0x30 : 0x10) | (s->cc_data & 0x0F);
+	s->cc_data++;
+	
+	if(af > 0)
+	{
+		p[0] = af - 1;
+		
+		if(af > 1)
+		{
+			p[1] = first ? 0x10 : 0x00;
+			
+			if(first)
+			{
+				p[2] = base >> 25;
+				p[3] = base >> 17;
+				p[4] = base >> 9;
+				p[5] = base >> 1;
+				p[6] = (base & 1) << 7 | 0x7E | (pcr % 300) >> 8;
+				p[7] = (pcr % 300) & 0xFF;
+			}
+			
+			memset(p + (first ? _PCR_FIELD : 2), 0xFF, af - (first ? _PCR_FIELD : 2));
+		}
+		
+		p += af;
+	}
+	
+	if(first)
+	{
+		/* private_stream_1, presented one block after it starts */
+		pts = ((s->block + 1) * (TS_BLOCK_TICKS / 300)) & 0x1FFFFFFFFULL;
+		plen = 8 + s->len <= 0xFFFF ? 8 + s->len : 0;
+		
+		p[0] = 0x00;
+		p[1] = 0x00;
+		p[2] = 0x01;
+		p[3] = 0xBD;
+		p[4] = plen >> 8;
+		p[5] = plen & 0xFF;
+		p[6] = 0x84;
+		p[7] = 0x80;
+		p[8] = 5;
+		p[9] = 0x21 | ((pts >> 29) & 0x0E);
+		p[10] = pts >> 22;
+		p[11] = 0x01 | ((pts >> 14) & 0xFE);
+		p[12] = pts >> 7;
+		p[13] = 0x01 | ((pts << 1) & 0xFE);
+		p += _PES_HEADER;
+	}
+	
+	memcpy(p, s->data + s->pos, n);
+	s->pos += n;
+	
+	if(s->pos >= s->len) s->data = NULL;
+}
+
+int ts_mux_next(ts_mux_t *s, uint8_t *out, uint64_t *pcr)
+{
+	int left = s->psi + (s->data ? 1 : 0);
+	
+	if(s->index >= s->packets && !left) return(0);
+	
+	*pcr = s->block * TS_BLOCK_TICKS + (uint64_t) s->index * TS_BLOCK_TICKS / s->packets;
+	
+	/* Payload spread evenly through the block, nulls between. A block
+	 * too big for its share runs over rather than lose anything */
+	if(left && (s->index >= s->packets ||
+	   s->sent < ((s->index + 1) * s->due + s->packets - 1) / s->packets))
+	{
+		if(s->psi == 2)
+		{
+			_table(out, s->pat, &s->cc_pat);
+			s->psi_packets++;
+			s->psi--;
+		}
+		else if(s->psi == 1)
+		{
+			_table(out, s->pmt, &s->cc_pmt);
+			s->psi_packets++;
+			s->psi--;
+		}
+		else
+		{
+			_data(s, out, *pcr);
+			s->data_packets++;
+		}
+		
+		s->sent++;
+	}
+	else
+	{
+		_null(out);
+		s->null_packets++;
+	}
+	
+	s->index++;
+	
+	return(1);
+}
+
@@ -0,0 +1,92 @@
+/* dsr - Digitale Satelliten Radio (DSR) encoder                         */
+/*=======================================================================*/
+/* Copyright 2021 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/*                                                                       */
+/* This code has been modified by janosch79.                             */
+/* This code is provided "as is" without warranty of any kind, express  */
+/* or implied. The user assumes full responsibility for any use of      */
+/* this code.                                                            */
+
+
+#ifndef _TS_H
+#define _TS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* MPEG transport stream packetiser for the raw DSR stream. Each 2ms block
+ * becomes one PES packet (private_stream_1, with a PTS) on a single
+ * private data PID, described by a PAT and PMT every 100ms. The PMT
+ * gives stream type 0x06 with a "DSR1" registration descriptor.
+ *
+ * Every block takes the same whole number of TS packets, padded out
+ * with null packets spread through it, so the mux rate is constant and
+ * locked to the symbol clock. The first data packet of each block
+ * carries a PCR on the data PID: block n starts at symbol n * 20480,
+ * which is n * 54000 ticks of the 27 MHz clock. */
+
+#define TS_PACKET      188
+#define TS_PAT_PID     0x0000
+#define TS_PMT_PID     0x1000
+#define TS_NULL_PID    0x1FFF
+#define TS_BLOCK_TICKS 54000  /* 27 MHz ticks per block */
+#define TS_PSI_BLOCKS  50     /* Blocks between each PAT and PMT */
+
+typedef struct {
+	
+	int pid;
+	int packets;         /* TS packets per block */
+	uint64_t rate;       /* Mux rate in bits per second */
+	
+	/* Tables, sent with their continuity counter patched in */
+	uint8_t pat[TS_PACKET];
+	uint8_t pmt[TS_PACKET];
+	uint8_t cc_pat;
+	uint8_t cc_pmt;
+	uint8_t cc_data;
+	
+	/* The block being cut up, the next packet and what it still owes */
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+	uint64_t block;
+	uint64_t blocks;
+	int index;
+	int psi;
+	int due;
+	int sent;
+	
+	uint64_t data_packets;
+	uint64_t null_packets;
+	uint64_t psi_packets;
+	
+} ts_mux_t;
+
+/* Packets needed to carry a block of len bytes, with the tables */
+extern int ts_mux_min_packets(size_t len);
+
+/* rate is the mux rate in bits per second, rounded up to whole packets
+ * per block, or 0 for the least that fits. Returns -1 if it's too low */
+extern int ts_mux_init(ts_mux_t *s, int pid, uint64_t rate, size_t len);
+
+/* Start on the next block, then call ts_mux_next() for each of its
+ * packets until it returns 0. pcr is the 27 MHz time of the packet.
+ * The block must stay in place until the last packet is out */
+extern void ts_mux_block(ts_mux_t *s, const uint8_t *data, size_t len);
+extern int ts_mux_next(ts_mux_t *s, uint8_t *out, uint64_t *pcr);
+
+#endif
+
@@ -22,20 +22,149 @@
 
 // udpsink.c - UDP network sink for the dsr - Digitale Satelliten Radio (DSR) encoder
 
+#define _GNU_SOURCE
 #include "rf.h"
 #include <fcntl.h>
+#include <poll.h>
+#include <math.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <net/if.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 
-static inline void add_ns(struct timespec *t, uint64_t ns){
-    t->tv_nsec += (long)(ns % 1000000000ULL);
-    t->tv_sec  += (time_t)(ns / 1000000000ULL);
-    if(t->tv_nsec >= 1000000000L){ t->tv_nsec -= 1000000000L; t->tv_sec += 1; }
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+/* Kernel limits for one UDP_SEGMENT send */
+#define UDP_GSO_MAX_SEGS  64
+#define UDP_GSO_MAX_BYTES 65507
+
+/* With SO_TXTIME, hand each batch to the kernel this far ahead of time */
+#define UDP_TXTIME_LEAD 1000000
+
+/* Without it, datagrams due this close together share a send call */
+#define UDP_PACE_SLACK  50000
+
+/* Longest wait (ms) for a full socket buffer to drain before dropping */
+#define UDP_POLL_TIMEOUT 100
+
+#define UDP_CTRL_SIZE (CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t)))
+
+static int _udp_ring_start(rf_udp_t *u, int depth, int drop);
+
+static inline uint64_t _udp_now(rf_udp_t *u)
+{
+    struct timespec ts;
+    clock_gettime(u->clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline size_t _udp_msg_bytes(const struct msghdr *h)
+{
+    size_t i, n = 0;
+    for (i = 0; i < h->msg_iovlen; i++) n += h->msg_iov[i].iov_len;
+    return n;
+}
+
+/* Bytes of the DSR stream in datagram i: none in parity packets, and
+ * the sequenced format's header doesn't count */
+static inline size_t _udp_stream_bytes(rf_udp_t *u, int i)
+{
+    const uint8_t *p = u->iov[i].iov_base;
+
+    if (u->ts == 2) return u->iov[i].iov_len - RF_UDP_TS_RTP_HEADER;
+    if (!u->rtp) return u->iov[i].iov_len;
+    if ((p[1] & 0x7F) != RF_UDP_RTP_TYPE) return 0;
+    return u->iov[i].iov_len - RF_UDP_RTP_HEADER;
+}
+
+/* Due time of the byte at offset bytes in the stream */
+static inline uint64_t _udp_due(rf_udp_t *u, uint64_t bytes)
+{
+    uint64_t bits = bytes * 8;
+    return u->start + bits / u->bitrate_bps * 1000000000ULL
+         + bits % u->bitrate_bps * 1000000000ULL / u->bitrate_bps;
+}
+
+static int _udp_is_multicast(const struct sockaddr_storage *a)
+{
+    if (a->ss_family == AF_INET)
+        return IN_MULTICAST(ntohl(((const struct sockaddr_in *)a)->sin_addr.s_addr));
+    if (a->ss_family == AF_INET6)
+        return IN6_IS_ADDR_MULTICAST(&((const struct sockaddr_in6 *)a)->sin6_addr);
+    return 0;
+}
+
+/* Outgoing interface, TTL and loopback for multicast groups */
+static void _udp_multicast(rf_udp_t *u)
+{
+    int loop = u->mcast_loop ? 1 : 0;
+    int r = 0;
+
+    if (u->mcast_set) return;
+    u->mcast_set = 1;
+
+    if (u->family == AF_INET6) {
+        r |= setsockopt(u->sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &u->mcast_ttl, sizeof(u->mcast_ttl));
+        r |= setsockopt(u->sock, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof(loop));
+        if (u->mcast_ifindex) {
+            r |= setsockopt(u->sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &u->mcast_ifindex, sizeof(u->mcast_ifindex));
+        }
+    } else {
+        r |= setsockopt(u->sock, IPPROTO_IP, IP_MULTICAST_TTL, &u->mcast_ttl, sizeof(u->mcast_ttl));
+        r |= setsockopt(u->sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+        if (u->mcast_ifindex || u->mcast_if.s_addr) {
+            struct ip_mreqn mreq;
+            memset(&mreq, 0, sizeof(mreq));
+            mreq.imr_ifindex = u->mcast_ifindex;
+            mreq.imr_address = u->mcast_if;
+            r |= setsockopt(u->sock, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq));
+        }
+    }
+
+    if (r) fprintf(stderr, "Warning: multicast options not set: %s\n", strerror(errno));
+}
+
+static int _udp_add_addr(rf_udp_t *u, const void *addr, socklen_t len)
+{
+    struct sockaddr_storage *dest = realloc(u->dest, sizeof(*dest) * (u->ndest + 1));
+    if (!dest) return -1;
+    u->dest = dest;
+
+    socklen_t *dest_len = realloc(u->dest_len, sizeof(*dest_len) * (u->ndest + 1));
+    if (!dest_len) return -1;
+    u->dest_len = dest_len;
+
+    memset(&u->dest[u->ndest], 0, sizeof(*dest));
+    memcpy(&u->dest[u->ndest], addr, len);
+    u->dest_len[u->ndest] = len;
+
+    if (_udp_is_multicast(&u->dest[u->ndest])) _udp_multicast(u);
+
+    u->ndest++;
+    return 0;
 }
 
 //Open UDP Socket
 int rf_udp_open(void **out_private, const char *host, const char *port, size_t payload_bytes)
+{
+    rf_udp_conf_t conf = { .payload = payload_bytes };
+
+    return rf_udp_open_conf(out_private, host, port, &conf);
+}
+
+int rf_udp_open_conf(void **out_private, const char *host, const char *port, const rf_udp_conf_t *conf)
 {
     if (!out_private || !host || !port) return -1;
 
+    size_t payload_bytes = conf ? conf->payload : 0;
+
     struct addrinfo hints, *res = NULL, *rp = NULL;
     memset(&hints, 0, sizeof(hints));
     hints.ai_family   = AF_UNSPEC;
@@ -89,102 +218,880 @@ int rf_udp_open(void **out_private, const char *host, const char *port, size_t p
     u->sock         = sock;
     u->payload      = (payload_bytes && payload_bytes < 9000) ? payload_bytes : 1400;
     u->preview_done = 0;
-    
+    u->family       = target_addr.ss_family;
+
+    /* Multicast: TTL 1 keeps it on the local network unless told otherwise */
+    u->mcast_ttl  = (conf && conf->ttl > 0) ? conf->ttl : 1;
+    u->mcast_loop = conf ? conf->loop : 0;
+
+    if (conf && conf->interface && conf->interface[0]) {
+        u->mcast_ifindex = if_nametoindex(conf->interface);
+        if (!u->mcast_ifindex && inet_pton(AF_INET, conf->interface, &u->mcast_if) != 1) {
+            fprintf(stderr, "UDP: unknown interface '%s'\n", conf->interface);
+            close(sock);
+            free(u);
+            return -1;
+        }
+    }
+
     /* Zieladresse speichern */
-    memcpy(&u->addr, &target_addr, target_addrlen);
-    u->addrlen = target_addrlen;
+    if (_udp_add_addr(u, &target_addr, target_addrlen) != 0) {
+        close(sock);
+        free(u->dest);
+        free(u->dest_len);
+        free(u);
+        return -1;
+    }
 
     /* Pacing default: off */
-    u->bitrate_bps  = 0;
-    u->tokens_bytes = 0.0;
-    clock_gettime(CLOCK_MONOTONIC, &u->last);
+    u->clock    = CLOCK_MONOTONIC;
+    u->max_late = (conf && conf->max_late > 0 ? conf->max_late : 0.1) * 1e9;
+    rf_udp_set_bitrate(u, conf ? conf->bitrate : 0);
+
+    /* One block per sendmmsg() by default */
+    u->batch = (conf && conf->batch > 1) ? conf->batch : 1;
+
+    /* Sequenced packets carry as many whole frame pairs as fit */
+    if (conf && conf->rtp) {
+        // Parity packets run 8 bytes longer than the longest media packet
+        int fec = conf->fec_cols > 0 && conf->fec_rows > 0;
+        int header = RF_UDP_RTP_HEADER + (fec ? 8 : 0);
+
+        u->rtp = 1;
+        u->rtp_frames = ((int)u->payload - header) / RF_UDP_FRAME_BYTES;
+        if (u->rtp_frames < 1) u->rtp_frames = 1;
+        if (u->rtp_frames > RF_UDP_BLOCK_FRAMES) u->rtp_frames = RF_UDP_BLOCK_FRAMES;
+        u->payload  = RF_UDP_RTP_HEADER + (size_t)u->rtp_frames * RF_UDP_FRAME_BYTES;
+        u->rtp_ssrc = (uint32_t)getpid() ^ (uint32_t)time(NULL);
+
+        if (fec) {
+            if (fec_enc_init(&u->fec, conf->fec_cols, conf->fec_rows, conf->fec_row, u->payload, u->rtp_ssrc) != 0) {
+                fprintf(stderr, "UDP FEC: invalid matrix %dx%d, L and D go up to %d and L x D to %d\n",
+                    conf->fec_cols, conf->fec_rows, FEC_MAX_COLS, FEC_MAX_MATRIX);
+                close(sock);
+                free(u->dest);
+                free(u->dest_len);
+                free(u);
+                return -1;
+            }
+            u->use_fec = 1;
+        }
+    }
+
+    /* Transport stream packets, 7 to a datagram, paced at the mux rate */
+    if (conf && conf->ts) {
+        size_t block = RF_UDP_FRAME_BYTES * RF_UDP_BLOCK_FRAMES;
+
+        if (ts_mux_init(&u->tsm, conf->ts_pid ? conf->ts_pid : 0x100, conf->ts_rate, block) != 0) {
+            double min = ts_mux_min_packets(block) * TS_PACKET * 8 * 500.0;
+            if (conf->ts_rate > 0 && conf->ts_rate < min)
+                fprintf(stderr, "UDP TS: ts_rate must be at least %.3f Mbit/s\n", min / 1e6);
+            else
+                fprintf(stderr, "UDP TS: invalid data PID %d\n", conf->ts_pid);
+            close(sock);
+            free(u->dest);
+            free(u->dest_len);
+            free(u);
+            return -1;
+        }
+
+        u->ts       = conf->ts;
+        u->payload  = (u->ts == 2 ? RF_UDP_TS_RTP_HEADER : 0) + RF_UDP_TS_PACKETS * TS_PACKET;
+        u->rtp_ssrc = (uint32_t)getpid() ^ (uint32_t)time(NULL);
+        if (u->bitrate_bps > 0) rf_udp_set_bitrate(u, u->tsm.rate);
+    }
+
+    /* Kernel-timed launch, on the TAI clock used by the etf qdisc */
+    if (conf && conf->txtime && u->bitrate_bps > 0) {
+        struct sock_txtime st = { .clockid = CLOCK_TAI, .flags = SOF_TXTIME_REPORT_ERRORS };
+
+        if (setsockopt(sock, SOL_SOCKET, SO_TXTIME, &st, sizeof(st)) == 0) {
+            u->txtime = 1;
+            u->clock  = CLOCK_TAI;
+        } else {
+            fprintf(stderr, "SO_TXTIME not supported (%s), pacing in user space\n", strerror(errno));
+        }
+    }
+
+    /* Let the kernel split each block into datagrams, if it can. Not
+     * with SO_TXTIME: every datagram needs a launch time of its own */
+    if (conf && conf->gso && !u->txtime) {
+        int val = 0;
+        socklen_t val_len = sizeof(val);
+
+        if (getsockopt(sock, SOL_UDP, UDP_SEGMENT, &val, &val_len) == 0) {
+            u->gso = 1;
+            u->gso_segs = UDP_GSO_MAX_BYTES / (int)u->payload;
+            if (u->gso_segs > UDP_GSO_MAX_SEGS) u->gso_segs = UDP_GSO_MAX_SEGS;
+        } else {
+            fprintf(stderr, "UDP_SEGMENT not supported (%s), using sendmmsg()\n", strerror(errno));
+        }
+    }
+
+    /* Hand writes to a sender thread through a ring */
+    if (conf && conf->queue > 0 && _udp_ring_start(u, conf->queue, conf->drop) != 0) {
+        fprintf(stderr, "UDP: could not start the sender thread\n");
+        rf_udp_close(u);
+        return -1;
+    }
 
     *out_private = u;
     return 0;
 }
 
+/* Another destination, sent the same datagrams from the same buffers */
+int rf_udp_add_dest(void *priv, const char *host, const char *port)
+{
+    rf_udp_t *u = (rf_udp_t*)priv;
+    struct addrinfo hints, *res = NULL;
+    int r;
+
+    if (!u || !host || !port) return -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = u->family;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err) {
+        fprintf(stderr, "getaddrinfo(%s:%s): %s\n", host, port, gai_strerror(err));
+        return -1;
+    }
+
+    r = _udp_add_addr(u, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+
+    return r;
+}
+
 void rf_udp_set_bitrate(void *priv, uint64_t bps)
 {
     rf_udp_t *u = (rf_udp_t*)priv;
     if (!u) return;
     u->bitrate_bps = bps;      /* 0 = Pacing off */
-    u->tokens_bytes = 0.0;
-    clock_gettime(CLOCK_MONOTONIC, &u->last);
+
+    /* Restart the timeline with the next flush */
+    u->start = 0;
+    u->sent_bytes = 0;
 }
 
-static inline int64_t ts_diff_ns(const struct timespec *a, const struct timespec *b)
+/* The counters the stats show belong to ring_lock while a sender
+ * thread runs, and to the caller's thread otherwise */
+static void _udp_stats_lock(rf_udp_t *u)
 {
-    return ((int64_t)a->tv_sec - (int64_t)b->tv_sec) * 1000000000LL
-           + ((int64_t)a->tv_nsec - (int64_t)b->tv_nsec);
+    if (u->ring_depth > 0) pthread_mutex_lock(&u->ring_lock);
 }
 
-/*Send UDP Packages*/
-int rf_udp_send(void *priv, const uint8_t *data, size_t len)
+static void _udp_stats_unlock(rf_udp_t *u)
+{
+    if (u->ring_depth > 0) pthread_mutex_unlock(&u->ring_lock);
+}
+
+static void _udp_sleep_until(rf_udp_t *u, uint64_t t)
+{
+    struct timespec ts = { (time_t)(t / 1000000000ULL), (long)(t % 1000000000ULL) };
+    while (clock_nanosleep(u->clock, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/* Work out when each queued datagram is due. With SO_TXTIME, also wait
+ * until a little before the first of them */
+static void _udp_schedule(rf_udp_t *u)
+{
+    uint64_t now = _udp_now(u);
+    uint64_t due, off;
+    int i;
+
+    if (u->start == 0) u->start = now;
+
+    due = _udp_due(u, u->sent_bytes);
+
+    if (now > due + u->max_late) {
+        // Too far behind to catch up: move the timeline instead of bursting
+        u->start += now - due;
+        _udp_stats_lock(u);
+        u->resyncs++;
+        _udp_stats_unlock(u);
+        due = now;
+    }
+
+    if (u->txtime && due - UDP_TXTIME_LEAD > now) _udp_sleep_until(u, due - UDP_TXTIME_LEAD);
+
+    off = u->sent_bytes;
+    for (i = 0; i < u->nmsgs; i++) {
+        u->due[i] = _udp_due(u, off);
+        off += _udp_stream_bytes(u, i);
+    }
+}
+
+/* Launch times the kernel missed come back on the error queue */
+static void _udp_txtime_errors(rf_udp_t *u)
+{
+    uint8_t ctrl[256];
+    struct msghdr h;
+    struct cmsghdr *cm;
+    uint64_t missed = 0;
+
+    for (;;) {
+        memset(&h, 0, sizeof(h));
+        h.msg_control    = ctrl;
+        h.msg_controllen = sizeof(ctrl);
+        if (recvmsg(u->sock, &h, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+
+        for (cm = CMSG_FIRSTHDR(&h); cm; cm = CMSG_NXTHDR(&h, cm)) {
+            struct sock_extended_err *e = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (e->ee_origin == SO_EE_ORIGIN_TXTIME) missed++;
+        }
+    }
+
+    _udp_stats_lock(u);
+    u->txtime_missed += missed;
+    _udp_stats_unlock(u);
+}
+
+void rf_udp_pace_stats(void *priv, FILE *f)
 {
     rf_udp_t *u = (rf_udp_t*)priv;
-    if (!u || !data || len == 0) return -1;
+    if (!u || u->bitrate_bps == 0) return;
 
-    size_t off = 0;
-    
-    const double TOKENS_CAP = (double)u->payload * 6.0;
-
-    while (off < len) {
-        size_t chunk = u->payload;
-        if (chunk > (len - off)) chunk = (len - off);
-
-        if (u->bitrate_bps > 0) {
-            struct timespec now;
-            clock_gettime(CLOCK_MONOTONIC, &now);
-            int64_t dtns = ts_diff_ns(&now, &u->last);
-            if (dtns > 0) {
-                double add = ((double)u->bitrate_bps * (double)dtns) / 8000000000.0;
-                u->tokens_bytes += add;
-                if (u->tokens_bytes > TOKENS_CAP) u->tokens_bytes = TOKENS_CAP;
-                u->last = now;
+    _udp_stats_lock(u);
+
+    double mean = u->jitter_n ? u->jitter_sum / u->jitter_n : 0.0;
+    double var  = u->jitter_n ? u->jitter_sq / u->jitter_n - mean * mean : 0.0;
+
+    fprintf(f, "UDP pace: %.3f Mbit/s, %s %.1f us mean, %.1f us sd, %.1f us worst, %llu resyncs",
+        u->bitrate_bps / 1e6,
+        u->txtime ? "handed over" : "departure",
+        mean / 1e3, (var > 0 ? sqrt(var) : 0.0) / 1e3, u->jitter_max / 1e3,
+        (unsigned long long)u->resyncs);
+
+    if (u->txtime) {
+        fprintf(f, ", %llu launch times missed", (unsigned long long)u->txtime_missed);
+    }
+
+    fprintf(f, "\n");
+
+    u->jitter_n   = 0;
+    u->jitter_sum = 0;
+    u->jitter_sq  = 0;
+    u->jitter_max = 0;
+
+    _udp_stats_unlock(u);
+}
+
+/* Make room for n more datagrams */
+static int _udp_reserve(rf_udp_t *u, int n)
+{
+    if (u->nmsgs + n <= u->max_msgs) return 0;
+
+    int max = u->nmsgs + n;
+    if (max < u->max_msgs * 2) max = u->max_msgs * 2;
+
+    struct iovec *iov = realloc(u->iov, sizeof(*iov) * max);
+    if (!iov) return -1;
+    u->iov = iov;
+
+    uint64_t *due = realloc(u->due, sizeof(*due) * max);
+    if (!due) return -1;
+    u->due = due;
+
+    u->max_msgs = max;
+    return 0;
+}
+
+/* Make room for n messages, one per datagram or GSO run per destination */
+static int _udp_reserve_sends(rf_udp_t *u, int n)
+{
+    if (n <= u->max_sends) return 0;
+
+    struct mmsghdr *msgs = realloc(u->msgs, sizeof(*msgs) * n);
+    if (!msgs) return -1;
+    u->msgs = msgs;
+
+    uint8_t *ctrl = realloc(u->ctrl, UDP_CTRL_SIZE * n);
+    if (!ctrl) return -1;
+    u->ctrl = ctrl;
+
+    u->max_sends = n;
+    return 0;
+}
+
+/* Build the messages for datagrams first..nmsgs-1, to every destination.
+ * The first run of them, what is left of a failed GSO send, only go to
+ * destinations from dest on. With GSO a run of full-size datagrams, plus
+ * one shorter tail, becomes a single message */
+static int _udp_build(rf_udp_t *u, int first, int dest, int run)
+{
+    int i, k, d, m = 0;
+
+    if (_udp_reserve_sends(u, (u->nmsgs - first) * u->ndest) != 0) return -1;
+
+    for (i = first; i < u->nmsgs; i += k) {
+        k = 1;
+        if (u->gso) {
+            while (i + k < u->nmsgs && k < u->gso_segs && u->iov[i + k - 1].iov_len == u->payload
+                   && u->iov[i + k].iov_len <= u->payload) k++;
+        }
+
+        // The same iovecs go to each destination
+        for (d = (i < first + run ? dest : 0); d < u->ndest; d++, m++) {
+            struct msghdr *h = &u->msgs[m].msg_hdr;
+
+            memset(&u->msgs[m], 0, sizeof(u->msgs[m]));
+            h->msg_name    = &u->dest[d];
+            h->msg_namelen = u->dest_len[d];
+            h->msg_iov     = &u->iov[i];
+            h->msg_iovlen  = k;
+
+            if (k > 1 || u->txtime) {
+                uint8_t *ctrl = u->ctrl + UDP_CTRL_SIZE * m;
+                struct cmsghdr *cm;
+
+                memset(ctrl, 0, UDP_CTRL_SIZE);
+                h->msg_control    = ctrl;
+                h->msg_controllen = UDP_CTRL_SIZE;
+                cm = CMSG_FIRSTHDR(h);
+
+                if (k > 1) {
+                    cm->cmsg_level = SOL_UDP;
+                    cm->cmsg_type  = UDP_SEGMENT;
+                    cm->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+                    *(uint16_t *)CMSG_DATA(cm) = (uint16_t)u->payload;
+                    cm = CMSG_NXTHDR(h, cm);
+                }
+
+                if (u->txtime) {
+                    cm->cmsg_level = SOL_SOCKET;
+                    cm->cmsg_type  = SCM_TXTIME;
+                    cm->cmsg_len   = CMSG_LEN(sizeof(uint64_t));
+                    memcpy(CMSG_DATA(cm), &u->due[i], sizeof(uint64_t));
+                    cm = CMSG_NXTHDR(h, cm);
+                }
+
+                h->msg_controllen = (uint8_t *)cm - ctrl;
             }
+        }
+    }
+
+    return m;
+}
+
+/* Send everything queued with as few sendmmsg() calls as possible */
+int rf_udp_flush(void *priv)
+{
+    rf_udp_t *u = (rf_udp_t*)priv;
+    if (!u) return -1;
+
+    int i, j, m, r, failed = 0;
+    size_t bytes = 0;
+    uint64_t t = 0;
+
+    if (u->nmsgs == 0) return 0;
+
+    // Stream bytes, for pacing, without the packet headers
+    for (i = 0; i < u->nmsgs; i++) bytes += _udp_stream_bytes(u, i);
+
+    if (u->bitrate_bps > 0) _udp_schedule(u);
+
+    m = _udp_build(u, 0, 0, 0);
+    if (m < 0) {
+        _udp_stats_lock(u);
+        u->errors += (uint64_t)u->nmsgs * u->ndest;
+        u->last_error = ENOMEM;
+        _udp_stats_unlock(u);
+        m = 0;
+        failed = 1;
+    }
+
+    j = 0;
+    while (j < m) {
+        int n = m - j;
+
+        if (u->bitrate_bps > 0 && !u->txtime) {
+            // Sleep until message j is due, then send it with any due right behind it
+            uint64_t due = u->due[u->msgs[j].msg_hdr.msg_iov - u->iov];
+
+            t = _udp_now(u);
+            if (due > t) {
+                _udp_sleep_until(u, due);
+                t = _udp_now(u);
+            }
+
+            for (n = 1; j + n < m; n++) {
+                if (u->due[u->msgs[j + n].msg_hdr.msg_iov - u->iov] > t + UDP_PACE_SLACK) break;
+            }
+        } else if (u->bitrate_bps > 0) {
+            t = _udp_now(u);
+        }
 
-            if (u->tokens_bytes < (double)chunk) {
-                double deficit = (double)chunk - u->tokens_bytes;
-                uint64_t need_ns = (uint64_t)((deficit * 8000000000.0) / (double)u->bitrate_bps);
-                if (need_ns > 0) {
-                    struct timespec ts;
-                    ts.tv_sec  = (time_t)(need_ns / 1000000000ULL);
-                    ts.tv_nsec = (long)(need_ns % 1000000000ULL);
-                    nanosleep(&ts, NULL);
-
-                    clock_gettime(CLOCK_MONOTONIC, &now);
-                    dtns = ts_diff_ns(&now, &u->last);
-                    if (dtns > 0) {
-                        double add2 = ((double)u->bitrate_bps * (double)dtns) / 8000000000.0;
-                        u->tokens_bytes += add2;
-                        if (u->tokens_bytes > TOKENS_CAP) u->tokens_bytes = TOKENS_CAP;
-                        u->last = now;
+        r = sendmmsg(u->sock, u->msgs + j, n, 0);
+        int err = errno;
+
+        _udp_stats_lock(u);
+        u->syscalls++;
+
+        if (r > 0) {
+            for (i = j; i < j + r; i++) {
+                u->packets += u->msgs[i].msg_hdr.msg_iovlen;
+                u->sent_bytes_total += _udp_msg_bytes(&u->msgs[i].msg_hdr);
+                if (u->msgs[i].msg_hdr.msg_iovlen > 1) u->gso_sends++;
+
+                if (u->bitrate_bps > 0) {
+                    // Userspace pacing sends late; SO_TXTIME hands over early
+                    int d0 = (int)(u->msgs[i].msg_hdr.msg_iov - u->iov);
+                    for (int d = d0; d < d0 + (int)u->msgs[i].msg_hdr.msg_iovlen; d++) {
+                        int64_t e = (int64_t)(t - u->due[d]);
+                        if (u->txtime) e = -e;
+                        u->jitter_n++;
+                        u->jitter_sum += e;
+                        u->jitter_sq  += (double)e * e;
+                        if (llabs(e) > u->jitter_max) u->jitter_max = llabs(e);
                     }
                 }
             }
+            _udp_stats_unlock(u);
+            j += r;
+            continue;
         }
 
-        ssize_t s = sendto(u->sock, data + off, chunk, 0, 
-                          (struct sockaddr *)&u->addr, u->addrlen);
-        if (s < 0) {
-            // fprintf(stderr, "UDP sendto failed: %s\n", strerror(errno));
-            return -1;
+        _udp_stats_unlock(u);
+        if (err == EINTR) continue;
+
+        struct msghdr *h = &u->msgs[j].msg_hdr;
+
+        // No segmentation offload on this route: rebuild the rest as plain datagrams
+        if (h->msg_iovlen > 1 && (err == EIO || err == EINVAL || err == EMSGSIZE || err == EOPNOTSUPP || err == ENOPROTOOPT)) {
+            fprintf(stderr, "UDP_SEGMENT send failed (%s), using sendmmsg()\n", strerror(err));
+            u->gso = 0;
+            m = _udp_build(u, (int)(h->msg_iov - u->iov), (int)((struct sockaddr_storage *)h->msg_name - u->dest), (int)h->msg_iovlen);
+            j = 0;
+            continue;
+        }
+
+        // Socket buffer full: wait for it to drain, then try again
+        if (err == EAGAIN || err == EWOULDBLOCK) {
+            struct pollfd pfd = { .fd = u->sock, .events = POLLOUT };
+
+            _udp_stats_lock(u);
+            u->socket_waits++;
+            _udp_stats_unlock(u);
+            if (poll(&pfd, 1, UDP_POLL_TIMEOUT) > 0) continue;
+        }
+
+        // Message j failed: count its datagrams and carry on with the rest
+        _udp_stats_lock(u);
+        if (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS) {
+            u->dropped += h->msg_iovlen;
+            u->dropped_bytes += _udp_msg_bytes(h);
+        } else {
+            u->errors += h->msg_iovlen;
+            u->last_error = err;
+            failed = 1;
+        }
+        _udp_stats_unlock(u);
+        j++;
+    }
+
+    if (u->txtime) _udp_txtime_errors(u);
+
+    u->sent_bytes += bytes;
+    u->nmsgs   = 0;
+    u->writes  = 0;
+    u->buf_len = 0;
+
+    return failed ? -1 : 0;
+}
+
+/* Space for len bytes in the batch buffer, flushing first if it is full */
+static uint8_t *_udp_buffer(rf_udp_t *u, size_t len)
+{
+    uint8_t *p;
+
+    if (u->buf_len + len > u->buf_size && u->nmsgs > 0) rf_udp_flush(u);
+
+    if (u->buf_len + len > u->buf_size) {
+        size_t size = len * u->batch;
+        uint8_t *buf = realloc(u->buf, size);
+        if (!buf) return NULL;
+        u->buf = buf;
+        u->buf_size = size;
+    }
+
+    p = u->buf + u->buf_len;
+    u->buf_len += len;
+    return p;
+}
+
+static inline void _put16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+static inline void _put32(uint8_t *p, uint32_t v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+
+/* Cut whole frame pairs into sequenced packets, never across a block */
+static int _udp_send_rtp(rf_udp_t *u, const uint8_t *data, size_t len)
+{
+    int frames = (int)(len / RF_UDP_FRAME_BYTES);
+    int n = frames / u->rtp_frames + 2;
+    int parity = 0;
+    size_t size = len + (size_t)n * RF_UDP_RTP_HEADER;
+
+    // Room for the parity too: at most a row packet per media packet,
+    // and the columns of each matrix that fills up
+    if (u->use_fec) {
+        n += n + u->fec.cols * (n / (u->fec.cols * u->fec.rows) + 1);
+        size = (size_t)n * (u->payload + 8);
+    }
+
+    uint8_t *p = _udp_buffer(u, size);
+    if (!p || _udp_reserve(u, n) != 0) return -1;
+
+    while (frames > 0) {
+        int frame = (int)(u->rtp_frame % RF_UDP_BLOCK_FRAMES);
+        int k = RF_UDP_BLOCK_FRAMES - frame;
+        if (k > u->rtp_frames) k = u->rtp_frames;
+        if (k > frames) k = frames;
+
+        p[0] = 0x80;
+        p[1] = (frame == 0 ? 0x80 : 0x00) | RF_UDP_RTP_TYPE;
+        _put16(p + 2, u->rtp_seq++);
+        _put32(p + 4, (uint32_t)(u->rtp_frame * RF_UDP_FRAME_TICKS));
+        _put32(p + 8, u->rtp_ssrc);
+        _put32(p + 12, (uint32_t)(u->rtp_frame / RF_UDP_BLOCK_FRAMES));
+        _put16(p + 16, (uint16_t)frame);
+        _put16(p + 18, (uint16_t)k);
+        memcpy(p + RF_UDP_RTP_HEADER, data, (size_t)k * RF_UDP_FRAME_BYTES);
+
+        u->iov[u->nmsgs].iov_base = p;
+        u->iov[u->nmsgs].iov_len  = RF_UDP_RTP_HEADER + (size_t)k * RF_UDP_FRAME_BYTES;
+        u->nmsgs++;
+
+        p      += u->iov[u->nmsgs - 1].iov_len;
+        data   += (size_t)k * RF_UDP_FRAME_BYTES;
+        frames -= k;
+        u->rtp_frame += k;
+
+        if (u->use_fec) {
+            // Parity is XORed from the packet in place, then queued behind it
+            size_t flen;
+
+            fec_enc_add(&u->fec, u->iov[u->nmsgs - 1].iov_base, u->iov[u->nmsgs - 1].iov_len);
+
+            while ((flen = fec_enc_next(&u->fec, p)) > 0) {
+                u->iov[u->nmsgs].iov_base = p;
+                u->iov[u->nmsgs].iov_len  = flen;
+                u->nmsgs++;
+                p += flen;
+                parity++;
+            }
+        }
+    }
+
+    // Give back the headers reserved for packets that weren't needed
+    u->buf_len = (size_t)(p - u->buf);
+
+    if (parity > 0) {
+        _udp_stats_lock(u);
+        u->fec_packets += parity;
+        _udp_stats_unlock(u);
+    }
+
+    if (++u->writes < u->batch) return 0;
+
+    return rf_udp_flush(u);
+}
+
+/* Cut a block into TS packets, RF_UDP_TS_PACKETS to a datagram. The
+ * payload is copied once, straight from the block into its packet */
+static int _udp_send_ts(rf_udp_t *u, const uint8_t *data, size_t len)
+{
+    size_t header = u->ts == 2 ? RF_UDP_TS_RTP_HEADER : 0;
+    int packets = ts_mux_min_packets(len);
+    if (packets < u->tsm.packets) packets = u->tsm.packets;
+
+    int n = (u->ts_count + packets) / RF_UDP_TS_PACKETS + 1;
+    uint8_t *d = _udp_buffer(u, (size_t)n * u->payload);
+    if (!d || _udp_reserve(u, n) != 0) return -1;
+
+    // Carry on with the datagram the last block left part full
+    if (u->ts_count > 0) memcpy(d, u->ts_hold, header + (size_t)u->ts_count * TS_PACKET);
+
+    uint64_t pcr;
+    ts_mux_block(&u->tsm, data, len);
+
+    while (ts_mux_next(&u->tsm, d + header + (size_t)u->ts_count * TS_PACKET, &pcr)) {
+        if (header && u->ts_count == 0) {
+            d[0] = 0x80;
+            d[1] = RF_UDP_TS_RTP_TYPE;
+            _put16(d + 2, u->rtp_seq++);
+            _put32(d + 4, (uint32_t)(pcr / 300));
+            _put32(d + 8, u->rtp_ssrc);
+        }
+
+        if (++u->ts_count == RF_UDP_TS_PACKETS) {
+            u->iov[u->nmsgs].iov_base = d;
+            u->iov[u->nmsgs].iov_len  = u->payload;
+            u->nmsgs++;
+            d += u->payload;
+            u->ts_count = 0;
+        }
+    }
+
+    if (u->ts_count > 0) memcpy(u->ts_hold, d, header + (size_t)u->ts_count * TS_PACKET);
+    u->buf_len = (size_t)(d - u->buf);
+
+    _udp_stats_lock(u);
+    u->ts_packets[0] = u->tsm.data_packets;
+    u->ts_packets[1] = u->tsm.null_packets;
+    u->ts_packets[2] = u->tsm.psi_packets;
+    _udp_stats_unlock(u);
+
+    if (++u->writes < u->batch) return 0;
+
+    return rf_udp_flush(u);
+}
+
+/* Send the part-full TS datagram at the end of the stream */
+static void _udp_ts_tail(rf_udp_t *u)
+{
+    size_t len = (u->ts == 2 ? RF_UDP_TS_RTP_HEADER : 0) + (size_t)u->ts_count * TS_PACKET;
+    uint8_t *d = _udp_buffer(u, len);
+
+    if (!d || _udp_reserve(u, 1) != 0) return;
+
+    memcpy(d, u->ts_hold, len);
+    u->iov[u->nmsgs].iov_base = d;
+    u->iov[u->nmsgs].iov_len  = len;
+    u->nmsgs++;
+    u->ts_count = 0;
+}
+
+/* Cut a write into datagrams and queue them, flushing each batch */
+static int _udp_send_now(rf_udp_t *u, const uint8_t *data, size_t len)
+{
+    if (u->ts) return _udp_send_ts(u, data, len);
+    if (u->rtp) return _udp_send_rtp(u, data, len);
+
+    int n = (int)((len + u->payload - 1) / u->payload);
+
+    if (u->batch > 1) {
+        // Keep a copy, the caller's buffer is reused before the batch goes out
+        uint8_t *p = _udp_buffer(u, len);
+        if (!p) return -1;
+        memcpy(p, data, len);
+        data = p;
+    }
+
+    if (_udp_reserve(u, n) != 0) return -1;
+
+    // One iovec per datagram, pointing straight at the data
+    for (size_t off = 0; off < len; off += u->payload) {
+        size_t chunk = len - off;
+        if (chunk > u->payload) chunk = u->payload;
+
+        u->iov[u->nmsgs].iov_base = (void *)(data + off);
+        u->iov[u->nmsgs].iov_len  = chunk;
+        u->nmsgs++;
+    }
+
+    if (++u->writes < u->batch) return 0;
+
+    return rf_udp_flush(u);
+}
+
+/* Datagrams a write of len bytes becomes, not counting parity. TS
+ * datagrams run on across writes, so ts_total counts the TS packets
+ * before this one and the write is charged the datagrams it completes */
+static uint64_t _udp_packets(rf_udp_t *u, size_t len, uint64_t *ts_total)
+{
+    if (u->ts) {
+        uint64_t before = *ts_total;
+        int packets = ts_mux_min_packets(len);
+        if (packets < u->tsm.packets) packets = u->tsm.packets;
+
+        *ts_total += packets;
+        return *ts_total / RF_UDP_TS_PACKETS - before / RF_UDP_TS_PACKETS;
+    }
+    if (u->rtp) {
+        size_t frames = len / RF_UDP_FRAME_BYTES;
+        return (frames + u->rtp_frames - 1) / u->rtp_frames;
+    }
+    return (len + u->payload - 1) / u->payload;
+}
+
+/* Sender thread: take writes from the ring and send them. A partly
+ * filled batch goes out as soon as the ring runs dry */
+static void *_udp_ring_thread(void *arg)
+{
+    rf_udp_t *u = (rf_udp_t*)arg;
+
+    pthread_mutex_lock(&u->ring_lock);
+
+    for (;;) {
+        while (u->ring_count == 0 && !u->ring_stop) {
+            if (u->nmsgs > 0) {
+                pthread_mutex_unlock(&u->ring_lock);
+                rf_udp_flush(u);
+                pthread_mutex_lock(&u->ring_lock);
+                continue;
+            }
+            pthread_cond_wait(&u->ring_ready, &u->ring_lock);
+        }
+
+        if (u->ring_count == 0) break;
+
+        // Swap buffers with the slot, so the caller can refill it at once
+        int i = u->ring_head;
+        uint8_t *data = u->ring_data[i];
+        size_t len = u->ring_len[i];
+        size_t cap = u->ring_cap[i];
+
+        u->ring_data[i] = u->ring_buf;
+        u->ring_cap[i]  = u->ring_buf_cap;
+        u->ring_buf     = data;
+        u->ring_buf_cap = cap;
+
+        // Writes dropped ahead of this one keep their frame numbers, so
+        // receivers see the gap rather than a silent splice
+        uint64_t skip = u->ring_skip;
+        u->ring_skip = 0;
+
+        u->ring_head = (i + 1) % u->ring_depth;
+        u->ring_count--;
+        pthread_cond_signal(&u->ring_room);
+        pthread_mutex_unlock(&u->ring_lock);
+
+        if (u->rtp) u->rtp_frame += skip / RF_UDP_FRAME_BYTES;
+
+        _udp_send_now(u, data, len);
+
+        pthread_mutex_lock(&u->ring_lock);
+    }
+
+    pthread_mutex_unlock(&u->ring_lock);
+
+    return NULL;
+}
+
+/* Copy a write into the ring, waiting for room or dropping the oldest */
+static int _udp_ring_put(rf_udp_t *u, const uint8_t *data, size_t len)
+{
+    int i;
+
+    pthread_mutex_lock(&u->ring_lock);
+
+    while (u->ring_count == u->ring_depth) {
+        if (u->ring_drop) {
+            i = u->ring_head;
+            u->ring_dropped_packets += _udp_packets(u, u->ring_len[i], &u->ts_dropped);
+            u->ring_dropped_bytes   += u->ring_len[i];
+            u->ring_skip            += u->ring_len[i];
+            u->ring_head = (i + 1) % u->ring_depth;
+            u->ring_count--;
+            break;
         }
-        off += (size_t)s;
 
-        if (u->bitrate_bps > 0) {
-            u->tokens_bytes -= (double)s;
-            if (u->tokens_bytes < 0.0) u->tokens_bytes = 0.0;
+        u->ring_waits++;
+        pthread_cond_wait(&u->ring_room, &u->ring_lock);
+    }
+
+    i = (u->ring_head + u->ring_count) % u->ring_depth;
+
+    if (u->ring_cap[i] < len) {
+        uint8_t *p = realloc(u->ring_data[i], len);
+        if (!p) {
+            pthread_mutex_unlock(&u->ring_lock);
+            return -1;
         }
+        u->ring_data[i] = p;
+        u->ring_cap[i]  = len;
+    }
+
+    memcpy(u->ring_data[i], data, len);
+    u->ring_len[i] = len;
+    u->ring_count++;
+    if (u->ring_count > u->ring_max) u->ring_max = u->ring_count;
+
+    u->queued_packets += _udp_packets(u, len, &u->ts_queued);
+    u->queued_bytes   += len;
+
+    pthread_cond_signal(&u->ring_ready);
+    pthread_mutex_unlock(&u->ring_lock);
+
+    return 0;
+}
+
+static int _udp_ring_start(rf_udp_t *u, int depth, int drop)
+{
+    u->ring_data = calloc(depth, sizeof(*u->ring_data));
+    u->ring_len  = calloc(depth, sizeof(*u->ring_len));
+    u->ring_cap  = calloc(depth, sizeof(*u->ring_cap));
+    if (!u->ring_data || !u->ring_len || !u->ring_cap) return -1;
+
+    u->ring_depth = depth;
+    u->ring_drop  = drop;
+
+    pthread_mutex_init(&u->ring_lock, NULL);
+    pthread_cond_init(&u->ring_ready, NULL);
+    pthread_cond_init(&u->ring_room, NULL);
+
+    if (pthread_create(&u->ring_thread, NULL, _udp_ring_thread, u) != 0) {
+        u->ring_depth = 0;
+        return -1;
     }
 
     return 0;
 }
 
+/* Send every write queued so far, then stop the sender thread */
+static void _udp_ring_stop(rf_udp_t *u)
+{
+    int i;
+
+    pthread_mutex_lock(&u->ring_lock);
+    u->ring_stop = 1;
+    pthread_cond_signal(&u->ring_ready);
+    pthread_mutex_unlock(&u->ring_lock);
+
+    pthread_join(u->ring_thread, NULL);
+
+    pthread_mutex_destroy(&u->ring_lock);
+    pthread_cond_destroy(&u->ring_ready);
+    pthread_cond_destroy(&u->ring_room);
+
+    for (i = 0; i < u->ring_depth; i++) free(u->ring_data[i]);
+    free(u->ring_buf);
+
+    // What is left goes out from this thread, without the lock
+    u->ring_depth = 0;
+}
+
+/*Send UDP Packages*/
+int rf_udp_send(void *priv, const uint8_t *data, size_t len)
+{
+    rf_udp_t *u = (rf_udp_t*)priv;
+    if (!u || !data || len == 0) return -1;
+
+    if (u->ring_depth > 0) return _udp_ring_put(u, data, len);
+
+    return _udp_send_now(u, data, len);
+}
+
 int rf_udp_close(void *priv){
     rf_udp_t *u = (rf_udp_t*)priv;
     if(!u) return 0;
+    if(u->ring_depth > 0) _udp_ring_stop(u);
+    if(u->ts_count > 0) _udp_ts_tail(u);
+    if(u->nmsgs > 0) rf_udp_flush(u);
     if(u->sock>=0) close(u->sock);
+    free(u->msgs);
+    free(u->iov);
+    free(u->buf);
+    free(u->ctrl);
+    free(u->due);
+    free(u->dest);
+    free(u->dest_len);
+    if(u->use_fec) fec_enc_free(&u->fec);
+    free(u->ring_data);
+    free(u->ring_len);
+    free(u->ring_cap);
     free(u);
     return 0;
 }
\ No newline at end of file